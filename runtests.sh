@@ -44,7 +44,8 @@ else
 fi
 
 if [ $valgrind = yes ]; then
-    command_template="valgrind -q --leak-check=full --show-leak-kinds=all --suppressions=valgrind-suppressions.sup $command_template"
+    # With JIT, valgrind would also check the Jou programs (and all memory the compiler had when running them)
+    command_template="valgrind -q --leak-check=full --show-leak-kinds=all --suppressions=valgrind-suppressions.sup ${command_template/ %s/ --no-jit %s}"
 fi
 
 if [ $run_make = yes ]; then
@@ -11,10 +11,9 @@ struct State {
 
 static const LocalVariable *find_local_var(const struct State *st, const char *name)
 {
-    for (LocalVariable **var = st->cfg->locals.ptr; var < End(st->cfg->locals); var++)
-        if (!strcmp((*var)->name, name))
-            return *var;
-    return NULL;
+    // Variables created by the type checker come first, with the same ids.
+    int i = hashtable_get(&st->fomtypes->local_indexes, name);
+    return i == -1 ? NULL : st->cfg->locals.ptr[i];
 }
 
 static LocalVariable *add_local_var(struct State *st, const Type *t)
@@ -28,18 +27,25 @@ static LocalVariable *add_local_var(struct State *st, const Type *t)
 
 static const ExpressionTypes *get_expr_types(const struct State *st, const AstExpression *expr)
 {
-    // TODO: a fancy binary search algorithm (need to add sorting)
     assert(st->fomtypes);
-    for (int i = 0; i < st->fomtypes->expr_types.len; i++)
-        if (st->fomtypes->expr_types.ptr[i]->expr == expr)
-            return st->fomtypes->expr_types.ptr[i];
-    return NULL;
+    if (expr->types_index == -1)
+        return NULL;
+    assert(0 <= expr->types_index && expr->types_index < st->fomtypes->expr_types.len);
+    const ExpressionTypes *types = st->fomtypes->expr_types.ptr[expr->types_index];
+    assert(types->expr == expr);
+    return types;
+}
+
+static void append_block(CfGraph *cfg, CfBlock *block)
+{
+    block->index = cfg->all_blocks.len;
+    Append(&cfg->all_blocks, block);
 }
 
 static CfBlock *add_block(const struct State *st)
 {
     CfBlock *block = calloc(1, sizeof *block);
-    Append(&st->cfg->all_blocks, block);
+    append_block(st->cfg, block);
     return block;
 }
 
@@ -205,18 +211,15 @@ static const LocalVariable *build_class_field_pointer(
     assert(instance->type->data.valuetype->kind == TYPE_CLASS);
     const Type *classtype = instance->type->data.valuetype;
 
-    for (struct ClassField *f = classtype->data.classdata.fields.ptr; f < End(classtype->data.classdata.fields); f++) {
-        if (!strcmp(f->name, fieldname)) {
-            union CfInstructionData dat;
-            safe_strcpy(dat.fieldname, f->name);
+    const struct ClassField *f = find_class_field(classtype, fieldname);
+    assert(f);
 
-            LocalVariable* result = add_local_var(st, get_pointer_type(f->type));
-            add_instruction(st, location, CF_PTR_CLASS_FIELD, &dat, (const LocalVariable*[]){instance,NULL}, result);
-            return result;
-        }
-    }
+    union CfInstructionData dat;
+    safe_strcpy(dat.fieldname, f->name);
 
-    assert(0);
+    LocalVariable* result = add_local_var(st, get_pointer_type(f->type));
+    add_instruction(st, location, CF_PTR_CLASS_FIELD, &dat, (const LocalVariable*[]){instance,NULL}, result);
+    return result;
 }
 
 static const LocalVariable *build_class_field(
@@ -248,7 +251,7 @@ static const LocalVariable *build_increment_or_decrement(
     assert(addr->type->kind == TYPE_POINTER);
     const Type *t = addr->type->data.valuetype;
     if (!is_integer_type(t) && !is_pointer_type(t))
-        fail_with_error(location, "cannot %s a value of type %s", diff==1?"increment":"decrement", t->name);
+        fail_with_error(location, "cannot %s a value of type %s", diff==1?"increment":"decrement", type_name(t));
 
     const LocalVariable *old_value = add_local_var(st, t);
     const LocalVariable *new_value = add_local_var(st, t);
@@ -347,7 +350,7 @@ static const LocalVariable *build_address_of_expression(struct State *st, const
         } else {
             // Global variable (possibly imported from another file)
             union CfInstructionData data;
-            safe_strcpy(data.globalname, address_of_what->data.varname);
+            checked_strcpy(data.globalname, address_of_what->data.varname);
             add_instruction(st, address_of_what->location, CF_ADDRESS_OF_GLOBAL_VAR, &data, NULL, addr);
         }
         return addr;
@@ -438,22 +441,13 @@ static const LocalVariable *build_function_or_method_call(struct State *st, cons
         assert(self->type->kind == TYPE_POINTER);
         const Type *selfclass = self->type->data.valuetype;
         assert(selfclass->kind == TYPE_CLASS);
-        for (const Signature *s = selfclass->data.classdata.methods.ptr; s < End(selfclass->data.classdata.methods); s++) {
-            assert(get_self_class(s) == selfclass);
-            if (!strcmp(s->name, call->calledname)) {
-                sig = s;
-                break;
-            }
-        }
+        sig = find_class_method(selfclass, call->calledname);
+        assert(sig && get_self_class(sig) == selfclass);
     } else {
-        for (const struct SignatureAndUsedPtr *f = st->filetypes->functions.ptr; f < End(st->filetypes->functions); f++) {
-            if (!strcmp(f->signature.name, call->calledname)) {
-                sig = &f->signature;
-                break;
-            }
-        }
+        int i = hashtable_get(&st->filetypes->function_indexes, call->calledname);
+        assert(i != -1);
+        sig = &st->filetypes->functions.ptr[i].signature;
     }
-    assert(sig);
 
     union CfInstructionData data = { .signature = copy_signature(sig) };
     add_instruction(st, location, CF_CALL, &data, args, return_value);
@@ -517,7 +511,8 @@ static const LocalVariable *build_expression(struct State *st, const AstExpressi
 
     const LocalVariable *result, *temp;
 
-    switch(expr->kind) {
+    // Expressions like 4*1024 were already evaluated when type-checking.
+    switch(types && types->value ? (enum AstExpressionKind)AST_EXPR_CONSTANT : expr->kind) {
     case AST_EXPR_DEREF_AND_CALL_METHOD:
         temp = build_expression(st, expr->data.methodcall.obj);
         assert(temp);
@@ -590,10 +585,7 @@ static const LocalVariable *build_expression(struct State *st, const AstExpressi
         result = build_address_of_expression(st, &expr->data.operands[0]);
         break;
     case AST_EXPR_SIZEOF:
-        result = add_local_var(st, longType);
-        union CfInstructionData data = { .type = get_expr_types(st, &expr->data.operands[0])->type };
-        add_instruction(st, expr->location, CF_SIZEOF, &data, NULL, result);
-        break;
+        assert(0);  // always evaluated when type-checking
     case AST_EXPR_DEREFERENCE:
         temp = build_expression(st, &expr->data.operands[0]);
         result = add_local_var(st, types->type);
@@ -601,7 +593,7 @@ static const LocalVariable *build_expression(struct State *st, const AstExpressi
         break;
     case AST_EXPR_CONSTANT:
         result = add_local_var(st, types->type);
-        add_constant(st, expr->location, expr->data.constant, result);
+        add_constant(st, expr->location, types->value ? *types->value : expr->data.constant, result);
         break;
     case AST_EXPR_AND:
         result = build_and_or(st, &expr->data.operands[0], &expr->data.operands[1], AND);
@@ -878,8 +870,8 @@ static CfGraph *build_function_or_method(struct State *st, const Type *selfclass
     st->cfg->signature = copy_signature(&st->fomtypes->signature);
     for (LocalVariable **v = st->fomtypes->locals.ptr; v < End(st->fomtypes->locals); v++)
         Append(&st->cfg->locals, *v);
-    Append(&st->cfg->all_blocks, &st->cfg->start_block);
-    Append(&st->cfg->all_blocks, &st->cfg->end_block);
+    append_block(st->cfg, &st->cfg->start_block);
+    append_block(st->cfg, &st->cfg->end_block);
     st->current_block = &st->cfg->start_block;
 
     assert(st->breakstack.len == 0 && st->continuestack.len == 0);
@@ -0,0 +1,294 @@
+/*
+Object file cache. See jou_compiler.h for an overview.
+
+Each cached object file "foo.o" has a file "foo.o.cache" next to it. The
+first line of the cache file is the cache key in hex, and the remaining
+lines are warnings that were shown when the object file was compiled.
+There may also be an interface file "foo.o.iface" (see interface.c).
+
+A cache file is written only after its object file has been written
+successfully, and it is deleted before the object file is overwritten. So if
+the cache file exists and contains the right key, the object file is good.
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "jou_compiler.h"
+#include "util.h"
+
+// Bump this if something changes in how files are compiled, without changing the jou executable.
+#define CACHE_FORMAT_VERSION 1
+
+struct Hasher {
+    uint64_t hash;
+    List(const Type *) seen_types;
+};
+
+// FNV-1a
+static void hash_bytes(struct Hasher *hs, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hs->hash ^= p[i];
+        hs->hash *= 0x100000001b3ULL;
+    }
+}
+
+static void hash_int(struct Hasher *hs, long long n)
+{
+    hash_bytes(hs, &n, sizeof n);
+}
+
+static void hash_string(struct Hasher *hs, const char *s)
+{
+    hash_bytes(hs, s, strlen(s) + 1);
+}
+
+static void hash_signature(struct Hasher *hs, const Signature *sig);
+
+static void hash_type(struct Hasher *hs, const Type *t)
+{
+    if (!t) {
+        hash_int(hs, -1);
+        return;
+    }
+
+    // Classes can refer to themselves through pointers.
+    for (const Type **seen = hs->seen_types.ptr; seen < End(hs->seen_types); seen++) {
+        if (*seen == t) {
+            hash_int(hs, -2);
+            hash_int(hs, seen - hs->seen_types.ptr);
+            return;
+        }
+    }
+    Append(&hs->seen_types, t);
+
+    hash_int(hs, t->kind);
+    // Other types are described by the kind and what's below.
+    if (t->kind == TYPE_CLASS || t->kind == TYPE_OPAQUE_CLASS || t->kind == TYPE_ENUM)
+        hash_string(hs, t->name);
+
+    switch(t->kind) {
+    case TYPE_SIGNED_INTEGER:
+    case TYPE_UNSIGNED_INTEGER:
+    case TYPE_FLOATING_POINT:
+        hash_int(hs, t->data.width_in_bits);
+        break;
+    case TYPE_POINTER:
+        hash_type(hs, t->data.valuetype);
+        break;
+    case TYPE_ARRAY:
+        hash_int(hs, t->data.array.len);
+        hash_type(hs, t->data.array.membertype);
+        break;
+    case TYPE_CLASS:
+        hash_int(hs, t->data.classdata.fields.len);
+        for (const struct ClassField *f = t->data.classdata.fields.ptr; f < End(t->data.classdata.fields); f++) {
+            hash_string(hs, f->name);
+            hash_type(hs, f->type);
+        }
+        hash_int(hs, t->data.classdata.methods.len);
+        for (const Signature *m = t->data.classdata.methods.ptr; m < End(t->data.classdata.methods); m++)
+            hash_signature(hs, m);
+        break;
+    case TYPE_ENUM:
+        hash_int(hs, t->data.enummembers.count);
+        for (int i = 0; i < t->data.enummembers.count; i++)
+            hash_string(hs, t->data.enummembers.names[i]);
+        break;
+    case TYPE_BOOL:
+    case TYPE_VOID_POINTER:
+    case TYPE_OPAQUE_CLASS:
+        break;
+    }
+}
+
+static void hash_signature(struct Hasher *hs, const Signature *sig)
+{
+    hash_string(hs, sig->name);
+    hash_int(hs, sig->nargs);
+    for (int i = 0; i < sig->nargs; i++) {
+        hash_string(hs, sig->argnames[i]);
+        hash_type(hs, sig->argtypes[i]);
+    }
+    hash_int(hs, sig->takes_varargs);
+    hash_type(hs, sig->returntype);
+}
+
+// Returns false if the file cannot be read.
+static bool hash_file_contents(struct Hasher *hs, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof buf, f)) > 0)
+        hash_bytes(hs, buf, n);
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+/*
+Rebuilding the compiler must invalidate the cache, because it may now
+compile the same code differently.
+*/
+static void hash_compiler(struct Hasher *hs)
+{
+    char *exe = find_current_executable();
+    struct stat st;
+    if (stat(exe, &st) == 0) {
+        hash_int(hs, st.st_size);
+        hash_int(hs, st.st_mtime);
+    }
+    free(exe);
+    hash_int(hs, CACHE_FORMAT_VERSION);
+}
+
+uint64_t get_interface_cache_key(const char *path)
+{
+    struct Hasher hs = { .hash = 0xcbf29ce484222325ULL };
+    hash_compiler(&hs);
+    hash_string(&hs, path);
+    bool ok = hash_file_contents(&hs, path);
+    return (ok && hs.hash) ? hs.hash : 0;
+}
+
+uint64_t get_object_cache_key(const char *path, const FileTypes *ft)
+{
+    struct Hasher hs = { .hash = 0xcbf29ce484222325ULL };
+
+    hash_compiler(&hs);
+    hash_string(&hs, get_target()->triple);
+    hash_string(&hs, get_target()->data_layout);
+    hash_int(&hs, command_line_args.optlevel);
+    hash_string(&hs, path);
+    if (!hash_file_contents(&hs, path)) {
+        free(hs.seen_types.ptr);
+        return 0;
+    }
+
+    for (const struct TypeAndUsedPtr *t = ft->types.ptr; t < End(ft->types); t++)
+        hash_type(&hs, t->type);
+    for (const struct SignatureAndUsedPtr *f = ft->functions.ptr; f < End(ft->functions); f++)
+        hash_signature(&hs, &f->signature);
+    for (GlobalVariable **g = ft->globals.ptr; g < End(ft->globals); g++) {
+        hash_string(&hs, (*g)->name);
+        hash_type(&hs, (*g)->type);
+        hash_int(&hs, (*g)->defined_in_current_file);
+    }
+
+    free(hs.seen_types.ptr);
+    return hs.hash ? hs.hash : 1;  // 0 means "don't cache"
+}
+
+static char *get_cache_file_path(const char *path, const char *suffix)
+{
+    char *objpath = get_object_file_path(path);
+    objpath = realloc(objpath, strlen(objpath) + strlen(suffix) + 1);
+    strcat(objpath, suffix);
+    return objpath;
+}
+
+char *get_interface_file_path(const char *path)
+{
+    return get_cache_file_path(path, ".iface");
+}
+
+// Returns the cache file after the key, or NULL if the object file is not cached.
+static FILE *open_cache_file(const char *path, uint64_t key)
+{
+    if (!key)
+        return NULL;
+
+    char *cachepath = get_cache_file_path(path, ".cache");
+    FILE *f = fopen(cachepath, "r");
+    free(cachepath);
+    if (!f)
+        return NULL;
+
+    unsigned long long cachedkey;
+    char *objpath = get_object_file_path(path);
+    struct stat st;
+    bool ok = fscanf(f, "%llx\n", &cachedkey) == 1 && cachedkey == key && stat(objpath, &st) == 0;
+    free(objpath);
+
+    if (!ok) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+bool object_file_is_cached(const char *path, uint64_t key)
+{
+    FILE *f = open_cache_file(path, key);
+    if (f)
+        fclose(f);
+    return !!f;
+}
+
+char *use_cached_object_file(const char *path, uint64_t key)
+{
+    FILE *f = open_cache_file(path, key);
+    if (!f)
+        return NULL;
+
+    char *objpath = get_object_file_path(path);
+    if (command_line_args.verbosity >= 1)
+        printf("Using cached object file: %s\n", objpath);
+
+    int lineno;
+    char message[2000];
+    while (fscanf(f, "%d ", &lineno) == 1 && fgets(message, sizeof message, f)) {
+        message[strcspn(message, "\n")] = '\0';
+        show_warning((Location){ .filename = path, .lineno = lineno }, "%s", message);
+    }
+
+    fclose(f);
+    return objpath;
+}
+
+FILE *create_object_cache_entry(const char *path, uint64_t key)
+{
+    if (!key)
+        return NULL;
+
+    // The object file is about to be overwritten, so the old cache entry is no longer valid.
+    char *cachepath = get_cache_file_path(path, ".cache");
+    if (remove(cachepath) != 0 && errno != ENOENT) {
+        free(cachepath);
+        return NULL;
+    }
+    free(cachepath);
+
+    char *tmppath = get_cache_file_path(path, ".cache.tmp");
+    FILE *f = fopen(tmppath, "w");
+    free(tmppath);
+    if (f)
+        fprintf(f, "%016llx\n", (unsigned long long)key);
+    return f;
+}
+
+void commit_object_cache_entry(FILE *entry, const char *path)
+{
+    bool ok = !ferror(entry);
+    ok = (fclose(entry) == 0) && ok;
+
+    char *tmppath = get_cache_file_path(path, ".cache.tmp");
+    if (ok) {
+        char *cachepath = get_cache_file_path(path, ".cache");
+        // Unlike on POSIX, rename() on Windows fails if the destination exists.
+        remove(cachepath);
+        if (rename(tmppath, cachepath) != 0)
+            remove(tmppath);
+        free(cachepath);
+    } else {
+        remove(tmppath);
+    }
+    free(tmppath);
+}
@@ -0,0 +1,126 @@
+/*
+Client for the Jou compile server (jou --server SOCKET). See src/server.c
+for how the client and the server talk to each other.
+
+This is a separate program, because the jou executable takes a while to
+start: the dynamic linker must load all of LLVM.
+
+Usage: jou_client SOCKET [arguments for jou...]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool write_all(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    while (n > 0) {
+        ssize_t did = write(fd, p, n);
+        if (did < 0 && errno == EINTR)
+            continue;
+        if (did <= 0)
+            return false;
+        p += did;
+        n -= did;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    while (n > 0) {
+        ssize_t got = read(fd, p, n);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        p += got;
+        n -= got;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argv[1][0] == '-') {
+        fprintf(stderr, "Usage: %s SOCKET [arguments for jou...]\n", argv[0]);
+        return 2;
+    }
+    const char *socketpath = argv[1];
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socketpath) >= sizeof addr.sun_path) {
+        fprintf(stderr, "%s: socket path is too long: %s\n", argv[0], socketpath);
+        return 1;
+    }
+    strcpy(addr.sun_path, socketpath);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        fprintf(stderr, "%s: cannot connect to \"%s\": %s (is \"jou --server %s\" running?)\n",
+            argv[0], socketpath, strerror(errno), socketpath);
+        return 1;
+    }
+
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof cwd)) {
+        fprintf(stderr, "%s: cannot get current working directory: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+
+    size_t datalen = strlen(cwd) + 1;
+    for (int i = 2; i < argc; i++)
+        datalen += strlen(argv[i]) + 1;
+
+    char *data = malloc(datalen);
+    char *p = data;
+    strcpy(p, cwd);
+    p += strlen(p) + 1;
+    for (int i = 2; i < argc; i++) {
+        strcpy(p, argv[i]);
+        p += strlen(p) + 1;
+    }
+
+    // Send the header together with our stdin, stdout and stderr.
+    uint32_t header[2] = { datalen, argc - 2 };
+    struct iovec iov = { .iov_base = header, .iov_len = sizeof header };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof control);
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf,
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+    int32_t ret;
+    if (sendmsg(sock, &msg, 0) != (ssize_t)sizeof header
+        || !write_all(sock, data, datalen)
+        || !read_all(sock, &ret, sizeof ret))
+    {
+        fprintf(stderr, "%s: lost connection to the compile server\n", argv[0]);
+        return 1;
+    }
+
+    free(data);
+    close(sock);
+    return ret;
+}
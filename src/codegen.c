@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,27 +9,38 @@
 #include "jou_compiler.h"
 #include "util.h"
 
-static LLVMTypeRef codegen_type(const Type *type)
+struct State {
+    // Everything is created in this context, so that files can be compiled in parallel.
+    LLVMContextRef context;
+    LLVMModuleRef module;
+    LLVMBuilderRef builder;
+    LocalVariable **cfvars, **cfvars_end;
+    // All local variables are represented as pointers to stack space, even
+    // if they are never reassigned. LLVM will optimize the mess.
+    LLVMValueRef *llvm_locals;
+};
+
+static LLVMTypeRef codegen_type(const struct State *st, const Type *type)
 {
     switch(type->kind) {
     case TYPE_ARRAY:
-        return LLVMArrayType(codegen_type(type->data.array.membertype), type->data.array.len);
+        return LLVMArrayType(codegen_type(st, type->data.array.membertype), type->data.array.len);
     case TYPE_POINTER:
-        return LLVMPointerType(codegen_type(type->data.valuetype), 0);
+        return LLVMPointerType(codegen_type(st, type->data.valuetype), 0);
     case TYPE_FLOATING_POINT:
         switch(type->data.width_in_bits) {
-            case 32: return LLVMFloatType();
-            case 64: return LLVMDoubleType();
+            case 32: return LLVMFloatTypeInContext(st->context);
+            case 64: return LLVMDoubleTypeInContext(st->context);
             default: assert(0);
         }
     case TYPE_VOID_POINTER:
         // just use i8* as here https://stackoverflow.com/q/36724399
-        return LLVMPointerType(LLVMInt8Type(), 0);
+        return LLVMPointerType(LLVMInt8TypeInContext(st->context), 0);
     case TYPE_SIGNED_INTEGER:
     case TYPE_UNSIGNED_INTEGER:
-        return LLVMIntType(type->data.width_in_bits);
+        return LLVMIntTypeInContext(st->context, type->data.width_in_bits);
     case TYPE_BOOL:
-        return LLVMInt1Type();
+        return LLVMInt1TypeInContext(st->context);
     case TYPE_OPAQUE_CLASS:
         assert(0);
     case TYPE_CLASS:
@@ -39,49 +51,49 @@ static LLVMTypeRef codegen_type(const Type *type)
                 // Treat all pointers inside structs as if they were void*.
                 // This allows structs to contain pointers to themselves.
                 if (type->data.classdata.fields.ptr[i].type->kind == TYPE_POINTER)
-                    elems[i] = codegen_type(voidPtrType);
+                    elems[i] = codegen_type(st, voidPtrType);
                 else
-                    elems[i] = codegen_type(type->data.classdata.fields.ptr[i].type);
+                    elems[i] = codegen_type(st, type->data.classdata.fields.ptr[i].type);
             }
-            LLVMTypeRef result = LLVMStructType(elems, n, false);
+            LLVMTypeRef result = LLVMStructTypeInContext(st->context, elems, n, false);
             free(elems);
             return result;
         }
     case TYPE_ENUM:
-        return LLVMInt32Type();
+        return LLVMInt32TypeInContext(st->context);
     }
     assert(0);
 }
 
-struct State {
-    LLVMModuleRef module;
-    LLVMBuilderRef builder;
-    LocalVariable **cfvars, **cfvars_end;
-    // All local variables are represented as pointers to stack space, even
-    // if they are never reassigned. LLVM will optimize the mess.
-    LLVMValueRef *llvm_locals;
-};
+static pthread_mutex_t type_size_lock = PTHREAD_MUTEX_INITIALIZER;
+static LLVMContextRef type_size_context;
 
-static LLVMValueRef get_pointer_to_local_var(const struct State *st, const LocalVariable *cfvar)
+static void free_type_size_context(void)
 {
-    assert(cfvar);
-    /*
-    The loop below looks stupid, but I don't see a better alternative.
+    LLVMContextDispose(type_size_context);
+}
 
-    I want CFG variables to be used as pointers, so that it's easy to refer to a
-    variable's name and type, check if you have the same variable, etc. But I
-    can't make a List of variables when building CFG, because existing variable
-    pointers would become invalid as the list grows. The solution is to allocate
-    each variable separately when building the CFG.
+long long get_type_size(const Type *t)
+{
+    // The types go to a context of their own, because this is called while other threads use their contexts.
+    pthread_mutex_lock(&type_size_lock);
+    if (!type_size_context) {
+        type_size_context = LLVMContextCreate();
+        atexit(free_type_size_context);
+    }
+    struct State st = { .context = type_size_context };
+    // This is what LLVMSizeOf() would give, but as a number.
+    long long result = LLVMABISizeOfType(get_target()->target_data_ref, codegen_type(&st, t));
+    pthread_mutex_unlock(&type_size_lock);
+    return result;
+}
 
-    Another idea I had was to count the number of variables needed beforehand,
-    so I wouldn't need to ever resize the list of variables, but the CFG building
-    is already complicated enough as is.
-    */
-    for (LocalVariable **v = st->cfvars; v < st->cfvars_end; v++)
-        if (*v == cfvar)
-            return st->llvm_locals[v - st->cfvars];
-    assert(0);
+static LLVMValueRef get_pointer_to_local_var(const struct State *st, const LocalVariable *cfvar)
+{
+    assert(cfvar);
+    assert(0 <= cfvar->id && cfvar->id < st->cfvars_end - st->cfvars);
+    assert(st->cfvars[cfvar->id] == cfvar);
+    return st->llvm_locals[cfvar->id];
 }
 
 static LLVMValueRef get_local_var(const struct State *st, const LocalVariable *cfvar)
@@ -92,14 +104,7 @@ static LLVMValueRef get_local_var(const struct State *st, const LocalVariable *c
 
 static void set_local_var(const struct State *st, const LocalVariable *cfvar, LLVMValueRef value)
 {
-    assert(cfvar);
-    for (LocalVariable **v = st->cfvars; v < st->cfvars_end; v++) {
-        if (*v == cfvar) {
-            LLVMBuildStore(st->builder, value, st->llvm_locals[v - st->cfvars]);
-            return;
-        }
-    }
-    assert(0);
+    LLVMBuildStore(st->builder, value, get_pointer_to_local_var(st, cfvar));
 }
 
 static LLVMValueRef codegen_function_or_method_decl(const struct State *st, const Signature *sig)
@@ -117,13 +122,13 @@ static LLVMValueRef codegen_function_or_method_decl(const struct State *st, cons
 
     LLVMTypeRef *argtypes = malloc(sig->nargs * sizeof(argtypes[0]));  // NOLINT
     for (int i = 0; i < sig->nargs; i++)
-        argtypes[i] = codegen_type(sig->argtypes[i]);
+        argtypes[i] = codegen_type(st, sig->argtypes[i]);
 
     LLVMTypeRef returntype;
     if (sig->returntype == NULL)
-        returntype = LLVMVoidType();
+        returntype = LLVMVoidTypeInContext(st->context);
     else
-        returntype = codegen_type(sig->returntype);
+        returntype = codegen_type(st, sig->returntype);
 
     LLVMTypeRef functype = LLVMFunctionType(returntype, argtypes, sig->nargs, sig->takes_varargs);
     free(argtypes);
@@ -140,8 +145,8 @@ static LLVMValueRef codegen_function_or_method_decl(const struct State *st, cons
 #endif
     for (unsigned i = 0; i < sizeof doesnt_exist / sizeof doesnt_exist[0]; i++) {
         if (!strcmp(fullname, doesnt_exist[i])) {
-            LLVMBasicBlockRef block = LLVMAppendBasicBlock(func, "my_block");
-            LLVMBuilderRef b = LLVMCreateBuilder();
+            LLVMBasicBlockRef block = LLVMAppendBasicBlockInContext(st->context, func, "my_block");
+            LLVMBuilderRef b = LLVMCreateBuilderInContext(st->context);
             LLVMPositionBuilderAtEnd(b, block);
             LLVMBuildUnreachable(b);
             LLVMDisposeBuilder(b);
@@ -169,12 +174,12 @@ static LLVMValueRef codegen_call(const struct State *st, const Signature *sig, L
 
 static LLVMValueRef make_a_string_constant(const struct State *st, const char *s)
 {
-    LLVMValueRef array = LLVMConstString(s, strlen(s), false);
+    LLVMValueRef array = LLVMConstStringInContext(st->context, s, strlen(s), false);
     LLVMValueRef global_var = LLVMAddGlobal(st->module, LLVMTypeOf(array), "string_literal");
     LLVMSetLinkage(global_var, LLVMPrivateLinkage);  // This makes it a static global variable
     LLVMSetInitializer(global_var, array);
 
-    LLVMTypeRef string_type = LLVMPointerType(LLVMInt8Type(), 0);
+    LLVMTypeRef string_type = LLVMPointerType(LLVMInt8TypeInContext(st->context), 0);
     return LLVMBuildBitCast(st->builder, global_var, string_type, "string_ptr");
 }
 
@@ -182,18 +187,18 @@ static LLVMValueRef codegen_constant(const struct State *st, const Constant *c)
 {
     switch(c->kind) {
     case CONSTANT_BOOL:
-        return LLVMConstInt(LLVMInt1Type(), c->data.boolean, false);
+        return LLVMConstInt(LLVMInt1TypeInContext(st->context), c->data.boolean, false);
     case CONSTANT_INTEGER:
-        return LLVMConstInt(codegen_type(type_of_constant(c)), c->data.integer.value, c->data.integer.is_signed);
+        return LLVMConstInt(codegen_type(st, type_of_constant(c)), c->data.integer.value, c->data.integer.is_signed);
     case CONSTANT_FLOAT:
     case CONSTANT_DOUBLE:
-        return LLVMConstRealOfString(codegen_type(type_of_constant(c)), c->data.double_or_float_text);
+        return LLVMConstRealOfString(codegen_type(st, type_of_constant(c)), c->data.double_or_float_text);
     case CONSTANT_NULL:
-        return LLVMConstNull(codegen_type(voidPtrType));
+        return LLVMConstNull(codegen_type(st, voidPtrType));
     case CONSTANT_STRING:
         return make_a_string_constant(st, c->data.str);
     case CONSTANT_ENUM_MEMBER:
-        return LLVMConstInt(LLVMInt32Type(), c->data.enum_member.memberidx, false);
+        return LLVMConstInt(LLVMInt32TypeInContext(st->context), c->data.enum_member.memberidx, false);
     }
     assert(0);
 }
@@ -264,40 +269,35 @@ static void codegen_instruction(const struct State *st, const CfInstruction *ins
             }
             break;
         case CF_CONSTANT: setdest(codegen_constant(st, &ins->data.constant)); break;
-        case CF_SIZEOF: setdest(LLVMSizeOf(codegen_type(ins->data.type))); break;
         case CF_ADDRESS_OF_LOCAL_VAR: setdest(get_pointer_to_local_var(st, ins->operands[0])); break;
         case CF_ADDRESS_OF_GLOBAL_VAR: setdest(LLVMGetNamedGlobal(st->module, ins->data.globalname)); break;
         case CF_PTR_LOAD: setdest(LLVMBuildLoad(st->builder, getop(0), "ptr_load")); break;
         case CF_PTR_STORE: LLVMBuildStore(st->builder, getop(1), getop(0)); break;
         case CF_PTR_EQ:
             {
-                LLVMValueRef lhsint = LLVMBuildPtrToInt(st->builder, getop(0), LLVMInt64Type(), "ptreq_lhs");
-                LLVMValueRef rhsint = LLVMBuildPtrToInt(st->builder, getop(1), LLVMInt64Type(), "ptreq_rhs");
+                LLVMValueRef lhsint = LLVMBuildPtrToInt(st->builder, getop(0), LLVMInt64TypeInContext(st->context), "ptreq_lhs");
+                LLVMValueRef rhsint = LLVMBuildPtrToInt(st->builder, getop(1), LLVMInt64TypeInContext(st->context), "ptreq_rhs");
                 setdest(LLVMBuildICmp(st->builder, LLVMIntEQ, lhsint, rhsint, "ptr_eq"));
             }
             break;
         case CF_PTR_CLASS_FIELD:
             {
                 const Type *classtype = ins->operands[0]->type->data.valuetype;
-                const struct ClassField *f = classtype->data.classdata.fields.ptr;
-                int i = 0;
-                while (strcmp(f->name, ins->data.fieldname)) {
-                    f++;
-                    i++;
-                }
+                const struct ClassField *f = find_class_field(classtype, ins->data.fieldname);
+                int i = f - classtype->data.classdata.fields.ptr;
 
-                LLVMValueRef val = LLVMBuildStructGEP2(st->builder, codegen_type(classtype), getop(0), i, ins->data.fieldname);
+                LLVMValueRef val = LLVMBuildStructGEP2(st->builder, codegen_type(st, classtype), getop(0), i, ins->data.fieldname);
                 if (f->type->kind == TYPE_POINTER) {
                     // We lied to LLVM that the struct member is i8*, so that we can do self-referencing types
-                    val = LLVMBuildBitCast(st->builder, val, LLVMPointerType(codegen_type(f->type),0), "struct_member_i8_hack");
+                    val = LLVMBuildBitCast(st->builder, val, LLVMPointerType(codegen_type(st, f->type),0), "struct_member_i8_hack");
                 }
                 setdest(val);
             }
             break;
         case CF_PTR_MEMSET_TO_ZERO:
             {
-                LLVMValueRef size = LLVMSizeOf(codegen_type(ins->operands[0]->type->data.valuetype));
-                LLVMBuildMemSet(st->builder, getop(0), LLVMConstInt(LLVMInt8Type(), 0, false), size, 0);
+                LLVMValueRef size = LLVMSizeOf(codegen_type(st, ins->operands[0]->type->data.valuetype));
+                LLVMBuildMemSet(st->builder, getop(0), LLVMConstInt(LLVMInt8TypeInContext(st->context), 0, false), size, 0);
             }
             break;
         case CF_PTR_ADD_INT:
@@ -306,7 +306,7 @@ static void codegen_instruction(const struct State *st, const CfInstruction *ins
                 if (ins->operands[1]->type->kind == TYPE_UNSIGNED_INTEGER) {
                     // https://github.com/Akuli/jou/issues/48
                     // Apparently the default is to interpret indexes as signed.
-                    index = LLVMBuildZExt(st->builder, index, LLVMInt64Type(), "ptr_add_int_implicit_cast");
+                    index = LLVMBuildZExt(st->builder, index, LLVMInt64TypeInContext(st->context), "ptr_add_int_implicit_cast");
                 }
                 setdest(LLVMBuildGEP(st->builder, getop(0), &index, 1, "ptr_add_int"));
             }
@@ -321,13 +321,13 @@ static void codegen_instruction(const struct State *st, const CfInstruction *ins
                     if (from->data.width_in_bits < to->data.width_in_bits) {
                         if (from->kind == TYPE_SIGNED_INTEGER) {
                             // example: signed 8-bit 0xFF --> 16-bit 0xFFFF
-                            setdest(LLVMBuildSExt(st->builder, getop(0), codegen_type(to), "int_cast"));
+                            setdest(LLVMBuildSExt(st->builder, getop(0), codegen_type(st, to), "int_cast"));
                         } else {
                             // example: unsigned 8-bit 0xFF --> 16-bit 0x00FF
-                            setdest(LLVMBuildZExt(st->builder, getop(0), codegen_type(to), "int_cast"));
+                            setdest(LLVMBuildZExt(st->builder, getop(0), codegen_type(st, to), "int_cast"));
                         }
                     } else if (from->data.width_in_bits > to->data.width_in_bits) {
-                        setdest(LLVMBuildTrunc(st->builder, getop(0), codegen_type(to), "int_cast"));
+                        setdest(LLVMBuildTrunc(st->builder, getop(0), codegen_type(st, to), "int_cast"));
                     } else {
                         // same size, LLVM doesn't distinguish signed and unsigned integer types
                         setdest(getop(0));
@@ -335,24 +335,24 @@ static void codegen_instruction(const struct State *st, const CfInstruction *ins
                 } else if (is_integer_type(from) && to->kind == TYPE_FLOATING_POINT) {
                     // integer --> double / float
                     if (from->kind == TYPE_SIGNED_INTEGER)
-                        setdest(LLVMBuildSIToFP(st->builder, getop(0), codegen_type(to), "cast"));
+                        setdest(LLVMBuildSIToFP(st->builder, getop(0), codegen_type(st, to), "cast"));
                     else
-                        setdest(LLVMBuildUIToFP(st->builder, getop(0), codegen_type(to), "cast"));
+                        setdest(LLVMBuildUIToFP(st->builder, getop(0), codegen_type(st, to), "cast"));
                 } else if (from->kind == TYPE_FLOATING_POINT && is_integer_type(to)) {
                     if (to->kind == TYPE_SIGNED_INTEGER)
-                        setdest(LLVMBuildFPToSI(st->builder, getop(0), codegen_type(to), "cast"));
+                        setdest(LLVMBuildFPToSI(st->builder, getop(0), codegen_type(st, to), "cast"));
                     else
-                        setdest(LLVMBuildFPToUI(st->builder, getop(0), codegen_type(to), "cast"));
+                        setdest(LLVMBuildFPToUI(st->builder, getop(0), codegen_type(st, to), "cast"));
                 } else if (from->kind == TYPE_FLOATING_POINT && to->kind == TYPE_FLOATING_POINT) {
-                    setdest(LLVMBuildFPCast(st->builder, getop(0), codegen_type(to), "cast"));
+                    setdest(LLVMBuildFPCast(st->builder, getop(0), codegen_type(st, to), "cast"));
                 } else {
                     assert(0);
                 }
             }
             break;
 
-        case CF_BOOL_NEGATE: setdest(LLVMBuildXor(st->builder, getop(0), LLVMConstInt(LLVMInt1Type(), 1, false), "bool_negate")); break;
-        case CF_PTR_CAST: setdest(LLVMBuildBitCast(st->builder, getop(0), codegen_type(ins->destvar->type), "ptr_cast")); break;
+        case CF_BOOL_NEGATE: setdest(LLVMBuildXor(st->builder, getop(0), LLVMConstInt(LLVMInt1TypeInContext(st->context), 1, false), "bool_negate")); break;
+        case CF_PTR_CAST: setdest(LLVMBuildBitCast(st->builder, getop(0), codegen_type(st, ins->destvar->type), "ptr_cast")); break;
 
         // various no-ops
         case CF_VARCPY:
@@ -388,18 +388,10 @@ static void codegen_instruction(const struct State *st, const CfInstruction *ins
 #undef getop
 }
 
-static int find_block(const CfGraph *cfg, const CfBlock *b)
-{
-    for (int i = 0; i < cfg->all_blocks.len; i++)
-        if (cfg->all_blocks.ptr[i] == b)
-            return i;
-    assert(0);
-}
-
 #ifdef _WIN32
 static void codegen_call_to_the_special_startup_function(const struct State *st)
 {
-    LLVMTypeRef functype = LLVMFunctionType(LLVMVoidType(), NULL, 0, false);
+    LLVMTypeRef functype = LLVMFunctionType(LLVMVoidTypeInContext(st->context), NULL, 0, false);
     LLVMValueRef func = LLVMAddFunction(st->module, "_jou_windows_startup", functype);
     LLVMBuildCall2(st->builder, functype, func, NULL, 0, "");
 }
@@ -417,7 +409,7 @@ static void codegen_function_or_method_def(struct State *st, const CfGraph *cfg)
     for (int i = 0; i < cfg->all_blocks.len; i++) {
         char name[50];
         sprintf(name, "block%d", i);
-        blocks[i] = LLVMAppendBasicBlock(llvm_func, name);
+        blocks[i] = LLVMAppendBasicBlockInContext(st->context, llvm_func, name);
     }
 
     assert(cfg->all_blocks.ptr[0] == &cfg->start_block);
@@ -432,7 +424,7 @@ static void codegen_function_or_method_def(struct State *st, const CfGraph *cfg)
     LLVMValueRef return_value = NULL;
     for (int i = 0; i < cfg->locals.len; i++) {
         LocalVariable *v = cfg->locals.ptr[i];
-        st->llvm_locals[i] = LLVMBuildAlloca(st->builder, codegen_type(v->type), v->name);
+        st->llvm_locals[i] = LLVMBuildAlloca(st->builder, codegen_type(st, v->type), v->name);
         if (!strcmp(v->name, "return"))
             return_value = st->llvm_locals[i];
     }
@@ -442,7 +434,8 @@ static void codegen_function_or_method_def(struct State *st, const CfGraph *cfg)
         set_local_var(st, cfg->locals.ptr[i], LLVMGetParam(llvm_func, i));
 
     for (CfBlock **b = cfg->all_blocks.ptr; b <End(cfg->all_blocks); b++) {
-        LLVMPositionBuilderAtEnd(st->builder, blocks[b - cfg->all_blocks.ptr]);
+        assert((*b)->index == b - cfg->all_blocks.ptr);
+        LLVMPositionBuilderAtEnd(st->builder, blocks[(*b)->index]);
 
         for (CfInstruction *ins = (*b)->instructions.ptr; ins < End((*b)->instructions); ins++)
             codegen_instruction(st, ins);
@@ -458,14 +451,14 @@ static void codegen_function_or_method_def(struct State *st, const CfGraph *cfg)
         } else {
             assert((*b)->iftrue && (*b)->iffalse);
             if ((*b)->iftrue == (*b)->iffalse) {
-                LLVMBuildBr(st->builder, blocks[find_block(cfg, (*b)->iftrue)]);
+                LLVMBuildBr(st->builder, blocks[(*b)->iftrue->index]);
             } else {
                 assert((*b)->branchvar);
                 LLVMBuildCondBr(
                     st->builder,
                     get_local_var(st, (*b)->branchvar),
-                    blocks[find_block(cfg, (*b)->iftrue)],
-                    blocks[find_block(cfg, (*b)->iffalse)]);
+                    blocks[(*b)->iftrue->index],
+                    blocks[(*b)->iffalse->index]);
             }
         }
     }
@@ -474,18 +467,19 @@ static void codegen_function_or_method_def(struct State *st, const CfGraph *cfg)
     free(st->llvm_locals);
 }
 
-LLVMModuleRef codegen(const CfGraphFile *cfgfile, const FileTypes *ft)
+LLVMModuleRef codegen(const CfGraphFile *cfgfile, const FileTypes *ft, LLVMContextRef context)
 {
     struct State st = {
-        .module = LLVMModuleCreateWithName(cfgfile->filename),
-        .builder = LLVMCreateBuilder(),
+        .context = context,
+        .module = LLVMModuleCreateWithNameInContext(cfgfile->filename, context),
+        .builder = LLVMCreateBuilderInContext(context),
     };
 
     LLVMSetTarget(st.module, get_target()->triple);
     LLVMSetDataLayout(st.module, get_target()->data_layout);
 
     for (GlobalVariable **v = ft->globals.ptr; v < End(ft->globals); v++) {
-        LLVMTypeRef t = codegen_type((*v)->type);
+        LLVMTypeRef t = codegen_type(&st, (*v)->type);
         LLVMValueRef globalptr = LLVMAddGlobal(st.module, t, (*v)->name);
         if ((*v)->defined_in_current_file)
             LLVMSetInitializer(globalptr, LLVMGetUndef(t));
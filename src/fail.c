@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,19 +23,52 @@ static void print_message(Location location, const char *start_fmt, const char *
     fflush(stderr);  // Make sure compiler warnings appear before program output
 }
 
+static FILE *warning_record_file = NULL;
+
+void record_warnings(FILE *f)
+{
+    warning_record_file = f;
+}
+
 void show_warning(Location location, const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
     print_message(location, "compiler warning for file \"%s\"", fmt, ap);
     va_end(ap);
+
+    if (warning_record_file) {
+        fprintf(warning_record_file, "%d ", location.lineno);
+        va_start(ap, fmt);
+        vfprintf(warning_record_file, fmt, ap);
+        va_end(ap);
+        fprintf(warning_record_file, "\n");
+    }
+}
+
+static jmp_buf *error_jump = NULL;
+static _Thread_local jmp_buf *silent_error_jump = NULL;
+
+void jump_on_error(jmp_buf *jb)
+{
+    error_jump = jb;
+}
+
+void jump_silently_on_error(jmp_buf *jb)
+{
+    silent_error_jump = jb;
 }
 
 noreturn void fail_with_error(Location location, const char *fmt, ...)
 {
+    if (silent_error_jump)
+        longjmp(*silent_error_jump, 1);
+
     va_list ap;
     va_start(ap, fmt);
     print_message(location, "compiler error in file \"%s\"", fmt, ap);
     va_end(ap);
+    if (error_jump)
+        longjmp(*error_jump, 1);
     exit(1);
 }
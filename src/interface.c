@@ -0,0 +1,726 @@
+/*
+Interface files. See jou_compiler.h for an overview.
+
+An interface file starts with "JOUIFACE" and the cache key of the source
+file (see get_interface_cache_key()). Then there are five sections, each
+starting with the number of items in it:
+
+    1. imports: path, symbol name, line number
+    2. names defined in the file: kind (enum ExportSymbolKind), name, line number
+    3. types: 'c' and class name, or 'e', enum name, member count and member names
+    4. functions ('f' and signature) and global variables ('g', name, type, defined in this file?)
+    5. class bodies: class name, fields (name and type), methods (signatures)
+
+Sections 3 and 4 are in the same order as the source file, so loading them
+produces the same FileTypes and ExportSymbols as type-checking the source.
+
+Numbers are int32_t in the byte order of the compiler's machine, and strings
+are terminated by '\0'. A type is one byte followed by more data:
+
+    '-'                 void (only return types)
+    'i', 'u', 'f'       signed integer, unsigned integer, floating point (then size in bits)
+    'b', 'v'            bool, void*
+    'p'                 pointer (then value type)
+    'a'                 array (then length and member type)
+    'n'                 class or enum (then name, looked up from the file's types)
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "jou_compiler.h"
+#include "util.h"
+
+#define MAGIC "JOUIFACE"
+#define HEADER_SIZE (sizeof(MAGIC) - 1 + sizeof(uint64_t))
+#define NUM_SECTIONS 5
+
+typedef List(char) Buffer;
+
+struct Interface {
+    const char *path;  // source file
+    char *data;
+    long len;
+    long sections[NUM_SECTIONS];  // where each section starts in data
+    List(void *) enum_member_names;  // used by enum types, so must live as long as the types
+};
+
+
+static void put_int(Buffer *buf, int32_t n)
+{
+    char bytes[sizeof n];
+    memcpy(bytes, &n, sizeof n);
+    for (size_t i = 0; i < sizeof n; i++)
+        Append(buf, bytes[i]);
+}
+
+static void put_string(Buffer *buf, const char *s)
+{
+    AppendStr(buf, s);
+    Append(buf, '\0');
+}
+
+// Sections start with the number of items, which is filled in later.
+static int start_section(Buffer *buf)
+{
+    put_int(buf, 0);
+    return buf->len - sizeof(int32_t);
+}
+
+static void end_section(Buffer *buf, int start, int32_t count)
+{
+    memcpy(&buf->ptr[start], &count, sizeof count);
+}
+
+static void put_type(Buffer *buf, const Type *t)
+{
+    if (!t) {
+        Append(buf, '-');
+        return;
+    }
+
+    switch(t->kind) {
+    case TYPE_SIGNED_INTEGER:
+        Append(buf, 'i');
+        put_int(buf, t->data.width_in_bits);
+        break;
+    case TYPE_UNSIGNED_INTEGER:
+        Append(buf, 'u');
+        put_int(buf, t->data.width_in_bits);
+        break;
+    case TYPE_FLOATING_POINT:
+        Append(buf, 'f');
+        put_int(buf, t->data.width_in_bits);
+        break;
+    case TYPE_BOOL:
+        Append(buf, 'b');
+        break;
+    case TYPE_VOID_POINTER:
+        Append(buf, 'v');
+        break;
+    case TYPE_POINTER:
+        Append(buf, 'p');
+        put_type(buf, t->data.valuetype);
+        break;
+    case TYPE_ARRAY:
+        Append(buf, 'a');
+        put_int(buf, t->data.array.len);
+        put_type(buf, t->data.array.membertype);
+        break;
+    case TYPE_CLASS:
+    case TYPE_OPAQUE_CLASS:
+    case TYPE_ENUM:
+        Append(buf, 'n');
+        put_string(buf, t->name);
+        break;
+    }
+}
+
+static void put_signature(Buffer *buf, const Signature *sig)
+{
+    put_string(buf, sig->name);
+    put_int(buf, sig->nargs);
+    put_int(buf, sig->takes_varargs);
+    for (int i = 0; i < sig->nargs; i++) {
+        put_string(buf, sig->argnames[i]);
+        put_type(buf, sig->argtypes[i]);
+    }
+    put_type(buf, sig->returntype);
+    put_int(buf, sig->returntype_location.lineno);
+}
+
+/*
+Imported types, functions and global variables have a usedptr, things defined
+in the file don't. Importing something with the same name as a thing defined
+in the file is an error, so the first thing with a given name is enough.
+*/
+static const Type *find_owned_type(const FileTypes *ft, const char *name)
+{
+    int i = hashtable_get(&ft->type_indexes, name);
+    return (i == -1 || ft->types.ptr[i].usedptr) ? NULL : ft->types.ptr[i].type;
+}
+
+static const Signature *find_own_function(const FileTypes *ft, const char *name)
+{
+    int i = hashtable_get(&ft->function_indexes, name);
+    return (i == -1 || ft->functions.ptr[i].usedptr) ? NULL : &ft->functions.ptr[i].signature;
+}
+
+static const GlobalVariable *find_own_global(const FileTypes *ft, const char *name)
+{
+    int i = hashtable_get(&ft->global_indexes, name);
+    return (i == -1 || ft->globals.ptr[i]->usedptr) ? NULL : ft->globals.ptr[i];
+}
+
+static void write_to_file(const char *path, const Buffer *buf)
+{
+    char *ifacepath = get_interface_file_path(path);
+    char *tmppath = malloc(strlen(ifacepath) + 10);
+    sprintf(tmppath, "%s.tmp", ifacepath);
+
+    FILE *f = fopen(tmppath, "wb");
+    if (f) {
+        bool ok = fwrite(buf->ptr, 1, buf->len, f) == (size_t)buf->len;
+        ok = (fclose(f) == 0) && ok;
+        // Unlike on POSIX, rename() on Windows fails if the destination exists.
+        if (ok)
+            remove(ifacepath);
+        if (!ok || rename(tmppath, ifacepath) != 0)
+            remove(tmppath);
+    }
+
+    free(tmppath);
+    free(ifacepath);
+}
+
+void write_interface_file(const char *path, const AstToplevelNode *ast, const FileTypes *ft)
+{
+    uint64_t key = get_interface_cache_key(path);
+    if (!key)
+        return;
+
+    Buffer buf = {0};
+    AppendStr(&buf, MAGIC);
+    for (size_t i = 0; i < sizeof key; i++)
+        Append(&buf, ((const char *)&key)[i]);
+
+    int start = start_section(&buf);
+    int n = 0;
+    for (const AstToplevelNode *imp = ast; imp->kind == AST_TOPLEVEL_IMPORT; imp++) {
+        put_string(&buf, imp->data.import.path);
+        put_string(&buf, imp->data.import.symbolname);
+        put_int(&buf, imp->location.lineno);
+        n++;
+    }
+    end_section(&buf, start, n);
+
+    start = start_section(&buf);
+    n = 0;
+    for (const AstToplevelNode *t = ast; t->kind != AST_TOPLEVEL_END_OF_FILE; t++) {
+        switch(t->kind) {
+        case AST_TOPLEVEL_DECLARE_FUNCTION:
+        case AST_TOPLEVEL_DEFINE_FUNCTION:
+            put_int(&buf, EXPSYM_FUNCTION);
+            put_string(&buf, t->data.funcdef.signature.name);
+            break;
+        case AST_TOPLEVEL_DECLARE_GLOBAL_VARIABLE:
+        case AST_TOPLEVEL_DEFINE_GLOBAL_VARIABLE:
+            put_int(&buf, EXPSYM_GLOBAL_VAR);
+            put_string(&buf, t->data.globalvar.name);
+            break;
+        case AST_TOPLEVEL_DEFINE_CLASS:
+            put_int(&buf, EXPSYM_TYPE);
+            put_string(&buf, t->data.classdef.name);
+            break;
+        case AST_TOPLEVEL_DEFINE_ENUM:
+            put_int(&buf, EXPSYM_TYPE);
+            put_string(&buf, t->data.enumdef.name);
+            break;
+        case AST_TOPLEVEL_IMPORT:
+            continue;
+        case AST_TOPLEVEL_END_OF_FILE:
+            assert(0);
+        }
+        put_int(&buf, t->location.lineno);
+        n++;
+    }
+    end_section(&buf, start, n);
+
+    start = start_section(&buf);
+    n = 0;
+    for (const AstToplevelNode *t = ast; t->kind != AST_TOPLEVEL_END_OF_FILE; t++) {
+        if (t->kind == AST_TOPLEVEL_DEFINE_CLASS) {
+            Append(&buf, 'c');
+            put_string(&buf, t->data.classdef.name);
+            n++;
+        } else if (t->kind == AST_TOPLEVEL_DEFINE_ENUM) {
+            const Type *enumtype = find_owned_type(ft, t->data.enumdef.name);
+            assert(enumtype && enumtype->kind == TYPE_ENUM);
+            Append(&buf, 'e');
+            put_string(&buf, enumtype->name);
+            put_int(&buf, enumtype->data.enummembers.count);
+            for (int i = 0; i < enumtype->data.enummembers.count; i++)
+                put_string(&buf, enumtype->data.enummembers.names[i]);
+            n++;
+        }
+    }
+    end_section(&buf, start, n);
+
+    start = start_section(&buf);
+    n = 0;
+    for (const AstToplevelNode *t = ast; t->kind != AST_TOPLEVEL_END_OF_FILE; t++) {
+        if (t->kind == AST_TOPLEVEL_DECLARE_FUNCTION || t->kind == AST_TOPLEVEL_DEFINE_FUNCTION) {
+            const Signature *sig = find_own_function(ft, t->data.funcdef.signature.name);
+            assert(sig);
+            Append(&buf, 'f');
+            put_signature(&buf, sig);
+            n++;
+        } else if (t->kind == AST_TOPLEVEL_DECLARE_GLOBAL_VARIABLE || t->kind == AST_TOPLEVEL_DEFINE_GLOBAL_VARIABLE) {
+            const GlobalVariable *g = find_own_global(ft, t->data.globalvar.name);
+            assert(g);
+            Append(&buf, 'g');
+            put_string(&buf, g->name);
+            put_type(&buf, g->type);
+            put_int(&buf, g->defined_in_current_file);
+            n++;
+        }
+    }
+    end_section(&buf, start, n);
+
+    start = start_section(&buf);
+    n = 0;
+    for (const AstToplevelNode *t = ast; t->kind != AST_TOPLEVEL_END_OF_FILE; t++) {
+        if (t->kind != AST_TOPLEVEL_DEFINE_CLASS)
+            continue;
+        const Type *classtype = find_owned_type(ft, t->data.classdef.name);
+        assert(classtype && classtype->kind == TYPE_CLASS);
+        put_string(&buf, classtype->name);
+        put_int(&buf, classtype->data.classdata.fields.len);
+        for (const struct ClassField *f = classtype->data.classdata.fields.ptr; f < End(classtype->data.classdata.fields); f++) {
+            put_string(&buf, f->name);
+            put_type(&buf, f->type);
+        }
+        put_int(&buf, classtype->data.classdata.methods.len);
+        for (const Signature *m = classtype->data.classdata.methods.ptr; m < End(classtype->data.classdata.methods); m++)
+            put_signature(&buf, m);
+        n++;
+    }
+    end_section(&buf, start, n);
+
+    write_to_file(path, &buf);
+    free(buf.ptr);
+}
+
+
+/*
+Reading is done in three modes:
+  - ft == NULL: only check that the data is valid (in load_interface_file())
+  - ft != NULL, mark_used == false: check that all types can be found
+  - ft != NULL, mark_used == true: actually load things, and mark imports as used
+*/
+struct Reader {
+    const Interface *iface;
+    long pos;
+    const FileTypes *ft;
+    bool mark_used;
+    bool corrupted;  // the interface file is broken, e.g. truncated
+    bool type_not_found;
+};
+
+static struct Reader start_reading(const Interface *iface, int section, const FileTypes *ft, bool mark_used)
+{
+    return (struct Reader){ .iface = iface, .pos = iface->sections[section], .ft = ft, .mark_used = mark_used };
+}
+
+static int32_t get_int(struct Reader *r)
+{
+    int32_t n;
+    if (r->corrupted || r->iface->len - r->pos < (long)sizeof n) {
+        r->corrupted = true;
+        return 0;
+    }
+    memcpy(&n, &r->iface->data[r->pos], sizeof n);
+    r->pos += sizeof n;
+    return n;
+}
+
+// Numbers of things must be checked, so that a broken file doesn't make us allocate a lot of memory.
+static int get_count(struct Reader *r)
+{
+    int32_t n = get_int(r);
+    if (n < 0 || n > r->iface->len) {
+        r->corrupted = true;
+        return 0;
+    }
+    return n;
+}
+
+static char get_byte(struct Reader *r)
+{
+    if (r->corrupted || r->pos >= r->iface->len) {
+        r->corrupted = true;
+        return '\0';
+    }
+    return r->iface->data[r->pos++];
+}
+
+// Result fits into a char[maxsize].
+static const char *get_string(struct Reader *r, size_t maxsize)
+{
+    if (r->corrupted)
+        return "";
+    const char *s = &r->iface->data[r->pos];
+    const char *end = memchr(s, '\0', r->iface->len - r->pos);
+    if (!end || (size_t)(end - s) >= maxsize) {
+        r->corrupted = true;
+        return "";
+    }
+    r->pos += end - s + 1;
+    return s;
+}
+
+static const Type *find_type(struct Reader *r, const char *name)
+{
+    int i = hashtable_get(&r->ft->type_indexes, name);
+    if (i == -1) {
+        r->type_not_found = true;
+        return NULL;
+    }
+    const struct TypeAndUsedPtr *t = &r->ft->types.ptr[i];
+    if (t->usedptr && r->mark_used)
+        atomic_store_explicit(t->usedptr, true, memory_order_relaxed);
+    return t->type;
+}
+
+// Returns NULL for void. Without ft, returns some non-NULL type for non-void.
+static const Type *get_type_or_void(struct Reader *r)
+{
+    const Type *t;
+    int n;
+
+    char kind = get_byte(r);
+    switch(kind) {
+    case '-':
+        return NULL;
+    case 'i':
+    case 'u':
+        n = get_int(r);
+        if (n != 8 && n != 16 && n != 32 && n != 64) {
+            r->corrupted = true;
+            return voidPtrType;
+        }
+        return get_integer_type(n, kind == 'i');
+    case 'f':
+        n = get_int(r);
+        if (n != 32 && n != 64) {
+            r->corrupted = true;
+            return voidPtrType;
+        }
+        return n == 32 ? floatType : doubleType;
+    case 'b':
+        return boolType;
+    case 'v':
+        return voidPtrType;
+    case 'p':
+        t = get_type_or_void(r);
+        if (!t) {
+            r->corrupted = true;
+            return voidPtrType;
+        }
+        return (r->ft && !r->corrupted && !r->type_not_found) ? get_pointer_type(t) : voidPtrType;
+    case 'a':
+        n = get_int(r);
+        t = get_type_or_void(r);
+        if (!t || n <= 0) {
+            r->corrupted = true;
+            return voidPtrType;
+        }
+        return (r->ft && !r->corrupted && !r->type_not_found) ? get_array_type(t, n) : voidPtrType;
+    case 'n':
+        {
+            const char *name = get_string(r, 100);
+            if (!r->ft || r->corrupted)
+                return voidPtrType;
+            t = find_type(r, name);
+            return t ? t : voidPtrType;
+        }
+    default:
+        r->corrupted = true;
+        return voidPtrType;
+    }
+}
+
+static const Type *get_type(struct Reader *r)
+{
+    const Type *t = get_type_or_void(r);
+    if (!t) {
+        r->corrupted = true;
+        return voidPtrType;
+    }
+    return t;
+}
+
+// If sig is NULL, the signature is only checked.
+static void get_signature(struct Reader *r, Signature *sig)
+{
+    Signature tmp;
+    if (!sig)
+        sig = &tmp;
+    memset(sig, 0, sizeof *sig);
+
+    strcpy(sig->name, get_string(r, sizeof sig->name));
+    int nargs = get_count(r);
+    sig->takes_varargs = !!get_int(r);
+
+    if (sig != &tmp) {
+        sig->nargs = nargs;
+        sig->argnames = malloc(sizeof(sig->argnames[0]) * nargs);
+        sig->argtypes = malloc(sizeof(sig->argtypes[0]) * nargs);  // NOLINT
+    }
+    for (int i = 0; i < nargs && !r->corrupted; i++) {
+        const char *argname = get_string(r, sizeof sig->argnames[0]);
+        const Type *argtype = get_type(r);
+        if (sig != &tmp) {
+            strcpy(sig->argnames[i], argname);
+            sig->argtypes[i] = argtype;
+        }
+    }
+
+    sig->returntype = get_type_or_void(r);
+    sig->returntype_location = (Location){ .filename = r->iface->path, .lineno = get_int(r) };
+}
+
+static void skip_section(struct Reader *r, int section)
+{
+    int n = get_count(r);
+    for (int i = 0; i < n && !r->corrupted; i++) {
+        switch(section) {
+        case 0:
+            get_string(r, 4096);
+            get_string(r, 100);
+            get_int(r);
+            break;
+        case 1:
+            if ((unsigned)get_int(r) > EXPSYM_GLOBAL_VAR)
+                r->corrupted = true;
+            get_string(r, 100);
+            get_int(r);
+            break;
+        case 2:
+            switch(get_byte(r)) {
+            case 'c':
+                get_string(r, 100);
+                break;
+            case 'e':
+                get_string(r, 100);
+                for (int k = get_count(r); k > 0 && !r->corrupted; k--)
+                    get_string(r, 100);
+                break;
+            default:
+                r->corrupted = true;
+            }
+            break;
+        case 3:
+            switch(get_byte(r)) {
+            case 'f':
+                get_signature(r, NULL);
+                break;
+            case 'g':
+                get_string(r, sizeof(((GlobalVariable *)NULL)->name));
+                get_type(r);
+                get_int(r);
+                break;
+            default:
+                r->corrupted = true;
+            }
+            break;
+        case 4:
+            get_string(r, 100);
+            for (int k = get_count(r); k > 0 && !r->corrupted; k--) {
+                get_string(r, sizeof(((struct ClassField *)NULL)->name));
+                get_type(r);
+            }
+            for (int k = get_count(r); k > 0 && !r->corrupted; k--)
+                get_signature(r, NULL);
+            break;
+        default:
+            assert(0);
+        }
+    }
+}
+
+static bool read_whole_file(const char *path, char **data, long *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    List(char) result = {0};
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof buf, f)) > 0)
+        for (size_t i = 0; i < n; i++)
+            Append(&result, buf[i]);
+
+    bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) {
+        free(result.ptr);
+        return false;
+    }
+    *data = result.ptr;
+    *len = result.len;
+    return true;
+}
+
+Interface *load_interface_file(const char *path)
+{
+    uint64_t key = get_interface_cache_key(path);
+    if (!key)
+        return NULL;
+
+    Interface *iface = calloc(1, sizeof *iface);
+    iface->path = path;
+
+    char *ifacepath = get_interface_file_path(path);
+    bool ok = read_whole_file(ifacepath, &iface->data, &iface->len);
+    free(ifacepath);
+
+    ok = ok
+        && iface->len >= (long)HEADER_SIZE
+        && !memcmp(iface->data, MAGIC, strlen(MAGIC))
+        && !memcmp(&iface->data[strlen(MAGIC)], &key, sizeof key);
+
+    if (ok) {
+        struct Reader r = { .iface = iface, .pos = HEADER_SIZE };
+        for (int i = 0; i < NUM_SECTIONS; i++) {
+            iface->sections[i] = r.pos;
+            skip_section(&r, i);
+        }
+        ok = !r.corrupted && r.pos == iface->len;
+    }
+
+    if (!ok) {
+        free_interface(iface);
+        return NULL;
+    }
+    return iface;
+}
+
+AstToplevelNode *get_interface_imports(const Interface *iface, Arena *arena)
+{
+    struct Reader r = start_reading(iface, 0, NULL, false);
+    int n = get_count(&r);
+
+    AstToplevelNode *result = arena_alloc(arena, (n + 1) * sizeof result[0]);
+    for (int i = 0; i < n; i++) {
+        result[i].kind = AST_TOPLEVEL_IMPORT;
+        result[i].data.import.path = arena_strdup(arena, get_string(&r, 4096));
+        result[i].data.import.symbolname = get_interned_string(intern_string(get_string(&r, 100)));
+        result[i].location = (Location){ .filename = iface->path, .lineno = get_int(&r) };
+    }
+    result[n].kind = AST_TOPLEVEL_END_OF_FILE;
+
+    assert(!r.corrupted);
+    return result;
+}
+
+void add_interface_toplevel_names(const Interface *iface, HashTable names[3])
+{
+    struct Reader r = start_reading(iface, 1, NULL, false);
+    for (int n = get_count(&r); n > 0; n--) {
+        enum ExportSymbolKind kind = get_int(&r);
+        const char *name = get_string(&r, 100);
+        int lineno = get_int(&r);
+        if (hashtable_get(&names[kind], name) == -1)
+            hashtable_set(&names[kind], name, lineno);
+    }
+    assert(!r.corrupted);
+}
+
+ExportSymbol *interface_stage1_create_types(Interface *iface, FileTypes *ft)
+{
+    List(ExportSymbol) exports = {0};
+    struct Reader r = start_reading(iface, 2, NULL, false);
+
+    for (int n = get_count(&r); n > 0; n--) {
+        Type *t;
+        char name[100];
+
+        if (get_byte(&r) == 'c') {
+            strcpy(name, get_string(&r, sizeof name));
+            t = create_opaque_struct(name);
+        } else {
+            strcpy(name, get_string(&r, sizeof name));
+            int count = get_count(&r);
+            const char **membernames = malloc(sizeof(membernames[0]) * (count ? count : 1));
+            for (int i = 0; i < count; i++)
+                membernames[i] = get_interned_string(intern_string(get_string(&r, 100)));
+            Append(&iface->enum_member_names, membernames);
+            t = create_enum(name, count, membernames);
+        }
+
+        add_type(ft, t, NULL);
+        Append(&ft->owned_types, t);
+
+        struct ExportSymbol es = { .kind = EXPSYM_TYPE, .data.type = t };
+        safe_strcpy(es.name, name);
+        Append(&exports, es);
+    }
+
+    assert(!r.corrupted);
+    Append(&exports, (ExportSymbol){0});
+    return exports.ptr;
+}
+
+static void load_class_bodies(struct Reader *r, FileTypes *ft)
+{
+    for (int n = get_count(r); n > 0; n--) {
+        Type *type = (Type *)find_owned_type(ft, get_string(r, 100));
+        assert(type);
+        assert(type->kind == TYPE_OPAQUE_CLASS);
+        type->kind = TYPE_CLASS;
+        memset(&type->data.classdata, 0, sizeof type->data.classdata);
+
+        for (int k = get_count(r); k > 0; k--) {
+            const char *name = get_string(r, sizeof(((struct ClassField *)NULL)->name));
+            const Type *fieldtype = get_type(r);
+            add_class_field(type, name, fieldtype);
+        }
+        for (int k = get_count(r); k > 0; k--) {
+            Signature sig;
+            get_signature(r, &sig);
+            add_class_method(type, sig);
+        }
+    }
+}
+
+ExportSymbol *interface_stage2_signatures_globals_structbodies(const Interface *iface, FileTypes *ft)
+{
+    // Check first, so that we don't need to undo anything if a type is missing.
+    struct Reader check = start_reading(iface, 3, ft, false);
+    skip_section(&check, 3);
+    skip_section(&check, 4);
+    assert(!check.corrupted);
+    if (check.type_not_found)
+        return NULL;
+
+    List(ExportSymbol) exports = {0};
+    struct Reader r = start_reading(iface, 3, ft, true);
+
+    for (int n = get_count(&r); n > 0; n--) {
+        ExportSymbol es = {0};
+        if (get_byte(&r) == 'f') {
+            es.kind = EXPSYM_FUNCTION;
+            get_signature(&r, &es.data.funcsignature);
+            safe_strcpy(es.name, es.data.funcsignature.name);
+            add_function(ft, copy_signature(&es.data.funcsignature), NULL);
+        } else {
+            GlobalVariable *g = calloc(1, sizeof *g);
+            strcpy(g->name, get_string(&r, sizeof g->name));
+            g->type = get_type(&r);
+            g->defined_in_current_file = !!get_int(&r);
+            add_global_var(ft, g);
+
+            es.kind = EXPSYM_GLOBAL_VAR;
+            es.data.type = g->type;
+            safe_strcpy(es.name, g->name);
+        }
+        Append(&exports, es);
+    }
+
+    load_class_bodies(&r, ft);
+    assert(!r.corrupted && !r.type_not_found);
+    Append(&exports, (ExportSymbol){0});
+    return exports.ptr;
+}
+
+void free_interface(Interface *iface)
+{
+    if (iface) {
+        for (void **names = iface->enum_member_names.ptr; names < End(iface->enum_member_names); names++)
+            free(*names);
+        free(iface->enum_member_names.ptr);
+        free(iface->data);
+        free(iface);
+    }
+}
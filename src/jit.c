@@ -0,0 +1,209 @@
+/*
+Running the program without -o. Instead of emitting object files, linking
+them into an executable and then running the executable, we JIT-compile
+the LLVM IR in memory and call main() directly.
+
+The program runs in a child process created with fork(), so that it can
+crash or call exit() without taking down the compiler. This way a crashing
+program behaves just like it did when we ran an executable with system().
+
+The JIT compiles the whole program at once in one thread, and nothing goes
+to the object file cache. For this reason, main.c doesn't use the JIT with
+-j N, or when all object files are already cached and can just be linked.
+*/
+
+#ifdef _WIN32
+
+#include "jou_compiler.h"
+
+// fork() doesn't exist on Windows, so we always link an executable there.
+bool prepare_jit(void)
+{
+    return false;
+}
+
+int run_with_jit(LLVMModuleRef module)
+{
+    (void)module;
+    assert(0);
+    return 1;
+}
+
+#else  // _WIN32
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "jou_compiler.h"
+#include "util.h"
+#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/Support.h>
+
+// Returns false if the library can't be found.
+static bool load_library(const char *name, const char *const *libdirs, int nlibdirs)
+{
+    char *path = malloc(strlen(name) + 20);
+    sprintf(path, "lib%s.so", name);
+
+    // Same search order as the linker: -L directories first
+    for (const char *const *dir = libdirs; dir < &libdirs[nlibdirs]; dir++) {
+        char *fullpath = malloc(strlen(*dir) + strlen(path) + 2);
+        sprintf(fullpath, "%s/%s", *dir, path);
+        bool ok = !LLVMLoadLibraryPermanently(fullpath);
+        free(fullpath);
+        if (ok) {
+            free(path);
+            return true;
+        }
+    }
+
+    bool ok = !LLVMLoadLibraryPermanently(path);
+    if (!ok && command_line_args.verbosity >= 1)
+        printf("Cannot load %s for JIT, linking an executable instead\n", path);
+    free(path);
+    return ok;
+}
+
+bool prepare_jit(void)
+{
+    // Symbols of the compiler process, including libc and libm.
+    if (LLVMLoadLibraryPermanently(NULL))
+        return false;
+
+    if (!command_line_args.linker_flags)
+        return true;
+
+    /*
+    We only understand -lfoo and -L/some/dir. Anything else, such as object
+    files or -Wl,... flags, must go to a real linker.
+    */
+    char *flags = strdup(command_line_args.linker_flags);
+    List(const char *) libnames = {0};
+    List(const char *) libdirs = {0};
+    bool ok = true;
+
+    for (char *tok = strtok(flags, " \t\n"); tok; tok = strtok(NULL, " \t\n")) {
+        if (!strncmp(tok, "-l", 2) && tok[2])
+            Append(&libnames, &tok[2]);
+        else if (!strncmp(tok, "-L", 2) && tok[2])
+            Append(&libdirs, &tok[2]);
+        else {
+            if (command_line_args.verbosity >= 1)
+                printf("Linker flag \"%s\" cannot be used with JIT, linking an executable instead\n", tok);
+            ok = false;
+        }
+    }
+
+    for (const char **name = libnames.ptr; ok && name < End(libnames); name++)
+        ok = load_library(*name, libdirs.ptr, libdirs.len);
+
+    free(libnames.ptr);
+    free(libdirs.ptr);
+    free(flags);
+    return ok;
+}
+
+/*
+MCJIT aborts the whole process with a fatal error if the program uses a
+function or global variable that it can't find, so we look for them first.
+The linker would show an error in this case, and so do we.
+*/
+static bool find_external_symbols(LLVMModuleRef module)
+{
+    bool ok = true;
+    for (LLVMValueRef f = LLVMGetFirstFunction(module); f; f = LLVMGetNextFunction(f)) {
+        const char *name = LLVMGetValueName(f);
+        if (LLVMIsDeclaration(f) && LLVMGetFirstUse(f) && !LLVMGetIntrinsicID(f) && !LLVMSearchForAddressOfSymbol(name)) {
+            fprintf(stderr, "%s: cannot run the program because function %s() was not found in any library\n", command_line_args.argv0, name);
+            ok = false;
+        }
+    }
+    for (LLVMValueRef g = LLVMGetFirstGlobal(module); g; g = LLVMGetNextGlobal(g)) {
+        const char *name = LLVMGetValueName(g);
+        if (LLVMIsDeclaration(g) && LLVMGetFirstUse(g) && !LLVMSearchForAddressOfSymbol(name)) {
+            fprintf(stderr, "%s: cannot run the program because global variable %s was not found in any library\n", command_line_args.argv0, name);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int run_with_jit(LLVMModuleRef module)
+{
+    struct PhaseTimer t = start_phase();
+
+    if (!LLVMGetNamedFunction(module, "main")) {
+        fprintf(stderr, "%s: cannot run the program because it has no main() function\n", command_line_args.argv0);
+        LLVMDisposeModule(module);
+        return 1;
+    }
+    if (!find_external_symbols(module)) {
+        LLVMDisposeModule(module);
+        return 1;
+    }
+
+    LLVMLinkInMCJIT();
+    struct LLVMMCJITCompilerOptions options;
+    LLVMInitializeMCJITCompilerOptions(&options, sizeof options);
+    options.OptLevel = command_line_args.optlevel;
+
+    LLVMExecutionEngineRef engine;
+    char *error = NULL;
+    // The engine takes ownership of the module.
+    if (LLVMCreateMCJITCompilerForModule(&engine, module, &options, sizeof options, &error)) {
+        fprintf(stderr, "%s: cannot create JIT compiler: %s\n", command_line_args.argv0, error);
+        exit(1);
+    }
+
+    // This compiles everything to machine code.
+    uint64_t mainaddr = LLVMGetFunctionAddress(engine, "main");
+    assert(mainaddr);
+    end_phase(t, NULL, PHASE_JIT);
+    print_time_report();
+
+    if (command_line_args.verbosity >= 1)
+        printf("Run: %s (JIT)\n", command_line_args.infile);
+
+    // Make sure that everything else shows up before the user's prints.
+    // This also prevents the child process from printing our buffered output again.
+    fflush(stdout);
+    fflush(stderr);
+
+    // Same argv as when running the executable that we would otherwise create.
+    char *exepath = get_default_exe_path();
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "%s: fork() failed: %s\n", command_line_args.argv0, strerror(errno));
+        exit(1);
+    }
+
+    if (pid == 0) {
+        // Jou's main() takes (argc, argv) or nothing.
+        char *argv[] = { exepath, NULL };
+        int (*mainfunc)(int, char **) = (int (*)(int, char **))(uintptr_t)mainaddr;
+        exit(mainfunc(1, argv));
+    }
+
+    free(exepath);
+    LLVMDisposeExecutionEngine(engine);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "%s: waitpid() failed: %s\n", command_line_args.argv0, strerror(errno));
+            exit(1);
+        }
+    }
+
+    if (WIFSIGNALED(status)) {
+        // The shell used to print this when we ran the executable with system().
+        fprintf(stderr, "%s\n", strsignal(WTERMSIG(status)));
+        return 1;
+    }
+    return !!WEXITSTATUS(status);
+}
+
+#endif  // _WIN32
@@ -1,6 +1,7 @@
 #ifndef JOU_COMPILER_H
 #define JOU_COMPILER_H
 
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdnoreturn.h>
 #include <llvm-c/Core.h>
@@ -12,6 +13,7 @@ void update_jou_compiler(void);
 // don't like repeating "struct" outside this header file
 typedef struct Location Location;
 typedef struct Token Token;
+typedef struct TokenStream TokenStream;
 typedef struct Type Type;
 typedef struct Signature Signature;
 typedef struct Constant Constant;
@@ -56,7 +58,13 @@ extern struct CommandLineArgs {
     const char *infile;  // The "main" Jou file (can import other files)
     const char *outfile;  // If not NULL, where to output executable
     const char *linker_flags;  // String that is appended to linking command
+    int njobs;  // How many files to compile in parallel (codegen, optimizing, emitting object files)
+    bool whole_program;  // Compile all files into one LLVM module before optimizing
+    bool time_report;  // Display how much time and memory each compilation step takes
+    bool time_report_json;  // Display the time report as JSON (implies time_report)
+    bool no_jit;  // Without -o, link and run an executable instead of JIT-compiling in memory
 } command_line_args;
+void parse_arguments(int argc, char **argv);  // Sets command_line_args, exits if they are wrong
 
 struct Location {
     const char *filename;
@@ -71,6 +79,62 @@ struct Location {
     noreturn void fail_with_error(Location location, const char *fmt, ...);
 #endif
 
+// If f is not NULL, warnings are also written to f, one per line, so that they can be shown again later.
+void record_warnings(FILE *f);
+// If jb is not NULL, fail_with_error() does longjmp(*jb, 1) instead of exiting. Used in the compile server.
+void jump_on_error(jmp_buf *jb);
+// Like jump_on_error(), but only in the calling thread, and the error is not shown.
+void jump_silently_on_error(jmp_buf *jb);
+
+/*
+Keywords and operators are stored in tokens as these numbers, so that the
+parser can compare them without strcmp(). The tokenizer has the lists of
+corresponding strings, see token_text().
+*/
+enum Keyword {
+    KEYWORD_FROM, KEYWORD_IMPORT,
+    KEYWORD_DEF, KEYWORD_DECLARE, KEYWORD_CLASS, KEYWORD_ENUM, KEYWORD_GLOBAL,
+    KEYWORD_RETURN, KEYWORD_IF, KEYWORD_ELIF, KEYWORD_ELSE, KEYWORD_WHILE, KEYWORD_FOR, KEYWORD_BREAK, KEYWORD_CONTINUE,
+    KEYWORD_TRUE, KEYWORD_FALSE, KEYWORD_NULL, KEYWORD_SELF,
+    KEYWORD_AND, KEYWORD_OR, KEYWORD_NOT, KEYWORD_AS, KEYWORD_SIZEOF,
+    KEYWORD_VOID, KEYWORD_BOOL, KEYWORD_BYTE, KEYWORD_INT, KEYWORD_LONG, KEYWORD_FLOAT, KEYWORD_DOUBLE,
+};
+enum Operator {
+    OPERATOR_ELLIPSIS,  // ...
+    OPERATOR_EQ,  // ==
+    OPERATOR_NE,  // !=
+    OPERATOR_ARROW,  // ->
+    OPERATOR_LE,  // <=
+    OPERATOR_GE,  // >=
+    OPERATOR_INCREMENT,  // ++
+    OPERATOR_DECREMENT,  // --
+    OPERATOR_ADD_ASSIGN,  // +=
+    OPERATOR_SUB_ASSIGN,  // -=
+    OPERATOR_MUL_ASSIGN,  // *=
+    OPERATOR_DIV_ASSIGN,  // /=
+    OPERATOR_MOD_ASSIGN,  // %=
+    OPERATOR_DOUBLE_COLON,  // ::
+    OPERATOR_DOT,  // .
+    OPERATOR_COMMA,  // ,
+    OPERATOR_COLON,  // :
+    OPERATOR_SEMICOLON,  // ;
+    OPERATOR_ASSIGN,  // =
+    OPERATOR_LPAREN,  // (
+    OPERATOR_RPAREN,  // )
+    OPERATOR_LBRACE,  // {
+    OPERATOR_RBRACE,  // }
+    OPERATOR_LBRACKET,  // [
+    OPERATOR_RBRACKET,  // ]
+    OPERATOR_AMPERSAND,  // &
+    OPERATOR_MOD,  // %
+    OPERATOR_STAR,  // *
+    OPERATOR_DIV,  // /
+    OPERATOR_ADD,  // +
+    OPERATOR_SUB,  // -
+    OPERATOR_LT,  // <
+    OPERATOR_GT,  // >
+};
+
 struct Token {
     enum TokenType {
         TOKEN_INT,
@@ -87,17 +151,26 @@ struct Token {
         TOKEN_OPERATOR,
         TOKEN_END_OF_FILE,  // Marks the end of an array of Token
     } type;
-    Location location;
+    // Use token_location() to get a Location.
+    uint32_t filename;  // interned, see intern_string()
+    int lineno;
     union {
         int32_t int_value;  // TOKEN_INT
-        int64_t long_value;  // TOKEN_LONG
         char char_value;  // TOKEN_CHAR
-        char *string_value;  // TOKEN_STRING
         int indentation_level;  // TOKEN_NEWLINE, indicates how many spaces after newline
-        char name[100];  // TOKEN_NAME and TOKEN_KEYWORD. Also TOKEN_DOUBLE & TOKEN_FLOAT (LLVM wants a string anyway)
-        char operator[4];  // TOKEN_OPERATOR
+        enum Keyword keyword;  // TOKEN_KEYWORD
+        enum Operator operator;  // TOKEN_OPERATOR
+        /*
+        Everything else is an interned string, see intern_string() and token_text():
+          - TOKEN_NAME: the name
+          - TOKEN_STRING: the content of the string
+          - TOKEN_DOUBLE and TOKEN_FLOAT: the number (LLVM wants a string anyway)
+          - TOKEN_LONG: the value in decimal, because int64_t would double the size of a token
+        */
+        uint32_t text;
     } data;
 };
+static_assert(sizeof(Token) == 16, "tokens should be small, there are many of them");
 
 // Constants can appear in AST and also compilation steps after AST.
 struct Constant {
@@ -113,7 +186,7 @@ struct Constant {
     union {
         struct { int width_in_bits; bool is_signed; long long value; } integer;
         char *str;
-        char double_or_float_text[100];  // convenient because LLVM wants a string anyway
+        const char *double_or_float_text;  // interned or a string literal, convenient because LLVM wants a string anyway
         bool boolean;
         struct { const Type *enumtype; int memberidx; } enum_member;
     } data;
@@ -140,12 +213,16 @@ will eventually need to know a lot more.
 
 AstType can also represent "void" even though that is not a valid type.
 It simply appears as a named type with name "void".
+
+All names in the AST are interned strings (see intern_string()), so two
+names are equal exactly when the pointers are equal. They stay alive
+until the compiler exits, even after the AST is freed.
 */
 struct AstType {
     enum AstTypeKind { AST_TYPE_NAMED, AST_TYPE_POINTER, AST_TYPE_ARRAY } kind;
     Location location;
     union {
-        char name[100];  // AST_TYPE_NAMED;
+        const char *name;  // AST_TYPE_NAMED
         AstType *valuetype;  // AST_TYPE_POINTER
         struct { AstType *membertype; AstExpression *len; } array;  // AST_TYPE_ARRAY
     } data;
@@ -153,15 +230,15 @@ struct AstType {
 
 struct AstSignature {
     Location name_location;
-    char name[100];
+    const char *name;
     List(AstNameTypeValue) args;
     bool takes_varargs;  // true for functions like printf()
     AstType returntype;  // can represent void
 };
 
 struct AstCall {
-    char calledname[100];  // e.g. function name, method name, struct name (instantiation)
-    char (*argnames)[100];  // NULL when arguments are not named, e.g. function calls
+    const char *calledname;  // e.g. function name, method name, struct name (instantiation)
+    const char **argnames;  // NULL when arguments are not named, e.g. function calls
     AstExpression *args;
     int nargs;
 };
@@ -207,15 +284,18 @@ struct AstExpression {
         AST_EXPR_POST_INCREMENT,  // foo++
         AST_EXPR_POST_DECREMENT,  // foo--
     } kind;
+
+    // Set when type-checking: index into expr_types of FunctionOrMethodTypes, or -1 if no value (calling a void function)
+    int types_index;
     union {
         Constant constant;  // AST_EXPR_CONSTANT
-        char varname[100];  // AST_EXPR_GET_VARIABLE
+        const char *varname;  // AST_EXPR_GET_VARIABLE
         AstCall call;       // AST_EXPR_CALL, AST_EXPR_BRACE_INIT
         struct { int count; AstExpression *items; } array;  // AST_EXPR_ARRAY
         struct { AstExpression *obj; AstType type; } as;    // AST_EXPR_AS
         struct { AstExpression *obj; struct AstCall call; } methodcall; // AST_EXPR_CALL_METHOD, AST_EXPR_DEREF_AND_CALL_METHOD
-        struct { AstExpression *obj; char fieldname[100]; } classfield; // AST_EXPR_GET_FIELD, AST_EXPR_DEREF_AND_GET_FIELD
-        struct { char enumname[100]; char membername[100]; } enummember; // AST_EXPR_GET_ENUM_MEMBER
+        struct { AstExpression *obj; const char *fieldname; } classfield; // AST_EXPR_GET_FIELD, AST_EXPR_DEREF_AND_GET_FIELD
+        struct { const char *enumname; const char *membername; } enummember; // AST_EXPR_GET_ENUM_MEMBER
         /*
         The "operands" pointer is an array of 1 to 2 expressions.
         A couple examples to hopefully give you an idea of how it works in general:
@@ -255,7 +335,7 @@ struct AstIfStatement {
 };
 struct AstNameTypeValue {
     // name: type = value
-    char name[100];
+    const char *name;
     Location name_location;
     AstType type;
     AstExpression *value; // can be NULL if value is missing
@@ -301,21 +381,22 @@ struct AstFunctionDef {
 };
 
 struct AstClassDef {
-    char name[100];
+    const char *name;
     List(AstNameTypeValue) fields;
     List(AstFunctionDef) methods;
 };
 
 struct AstEnumDef {
-    char name[100];
-    char (*membernames)[100];
+    const char *name;
+    const char **membernames;
     int nmembers;
 };
 
 struct AstImport {
     char *path;  // Relative to current working directory, so e.g. "blah/stdlib/io.jou"
-    char symbolname[100];
-    bool found, used;    // For errors/warnings
+    const char *symbolname;
+    bool found;    // For errors/warnings
+    _Atomic bool used;  // Set by type checking, which may run in several threads
 };
 
 // Toplevel = outermost in the nested structure i.e. what the file consists of
@@ -344,10 +425,17 @@ struct AstToplevelNode {
 struct ClassData {
     List(struct ClassField { char name[100]; const Type *type; }) fields;
     List(Signature) methods;
+    // Name --> index into fields or methods. Use add_class_field() and add_class_method() to add things.
+    HashTable field_indexes, method_indexes;
 };
 
 struct Type {
-    char name[500];   // All types have a name for error messages and debugging.
+    /*
+    All types have a name for error messages and debugging. Pointer and
+    array types get their name only when something asks for it, so use
+    type_name() unless you know that the type is a class or an enum.
+    */
+    const char *name;
     enum TypeKind {
         TYPE_SIGNED_INTEGER,
         TYPE_UNSIGNED_INTEGER,
@@ -365,7 +453,7 @@ struct Type {
         const Type *valuetype;  // TYPE_POINTER
         struct ClassData classdata;  // TYPE_CLASS
         struct { const Type *membertype; int len; } array;  // TYPE_ARRAY
-        struct { int count; char (*names)[100]; } enummembers;
+        struct { int count; const char **names; } enummembers;
     } data;
 };
 
@@ -396,7 +484,8 @@ const Type *get_pointer_type(const Type *t);  // result lives as long as t
 const Type *get_array_type(const Type *t, int len);  // result lives as long as t
 const Type *type_of_constant(const Constant *c);
 Type *create_opaque_struct(const char *name);
-Type *create_enum(const char *name, int membercount, char (*membernames)[100]);
+Type *create_enum(const char *name, int membercount, const char **membernames);
+const char *type_name(const Type *t);  // e.g. "int*", "byte[100]", result lives as long as the compiler runs
 void free_type(Type *type);
 
 bool is_integer_type(const Type *t);  // includes signed and unsigned
@@ -418,15 +507,21 @@ const Type *get_self_class(const Signature *sig);  // NULL for functions, a clas
 char *signature_to_string(const Signature *sig, bool include_return_type);
 Signature copy_signature(const Signature *sig);
 
+// For class types. The find functions return NULL if there is no field or method with the given name.
+void add_class_field(Type *classtype, const char *name, const Type *fieldtype);
+void add_class_method(Type *classtype, Signature sig);
+const struct ClassField *find_class_field(const Type *classtype, const char *name);
+const Signature *find_class_method(const Type *classtype, const char *name);
+
 
 struct GlobalVariable {
     char name[100];  // Same as in user's code, never empty
     const Type *type;
     bool defined_in_current_file;  // not declare-only (e.g. stdout) or imported
-    bool *usedptr;  // If non-NULL, set to true when the variable is used. This is how we detect unused imports.
+    _Atomic bool *usedptr;  // If non-NULL, set to true when the variable is used. This is how we detect unused imports.
 };
 struct LocalVariable {
-    int id;  // Unique, but you can also compare pointers to Variable.
+    int id;  // Index into CfGraph.locals (or FunctionOrMethodTypes.locals while type-checking)
     char name[100];  // Same name as in user's code, empty for temporary variables created by compiler
     const Type *type;
     bool is_argument;    // First n variables are always the arguments
@@ -436,6 +531,7 @@ struct ExpressionTypes {
     const AstExpression *expr;
     const Type *type;
     const Type *type_after_cast;  // NULL for no implicit cast
+    const Constant *value;  // the value without implicit cast, if known at compile time (e.g. 4*1024), otherwise NULL
 };
 
 struct ExportSymbol {
@@ -450,18 +546,26 @@ struct ExportSymbol {
 // Type information about a function or method defined in the current file.
 struct FunctionOrMethodTypes {
     Signature signature;
-    List(ExpressionTypes *) expr_types;
+    List(ExpressionTypes *) expr_types;  // see AstExpression.types_index
+    Arena expr_types_arena;  // owns the ExpressionTypes
     List(LocalVariable *) locals;
+    HashTable local_indexes;  // name --> index into locals
 };
 
 // Type information about a file.
 struct FileTypes {
-    FunctionOrMethodTypes *current_fom_types;  // conceptually this is internal to typecheck.c
     List(FunctionOrMethodTypes) fomtypes;
+    List(const AstBody *) fombodies;  // same order as fomtypes, conceptually this is internal to typecheck.c
     List(GlobalVariable *) globals;  // TODO: probably doesn't need to has pointers
     List(Type *) owned_types;   // These will be freed later
-    List(struct TypeAndUsedPtr { const Type *type; bool *usedptr; }) types;
-    List(struct SignatureAndUsedPtr { Signature signature; bool *usedptr; }) functions;
+    List(struct TypeAndUsedPtr { const Type *type; _Atomic bool *usedptr; }) types;
+    List(struct SignatureAndUsedPtr { Signature signature; _Atomic bool *usedptr; }) functions;
+    /*
+    Name --> index into types, functions or globals. If there are several
+    things with the same name, this finds the first one. Use add_type(),
+    add_function() and add_global_var() instead of appending directly.
+    */
+    HashTable type_indexes, function_indexes, global_indexes;
 };
 
 /*
@@ -488,6 +592,22 @@ ExportSymbol *typecheck_stage1_create_types(FileTypes *ft, const AstToplevelNode
 ExportSymbol *typecheck_stage2_signatures_globals_structbodies(FileTypes *ft, const AstToplevelNode *ast);
 void typecheck_stage3_function_and_method_bodies(FileTypes *ft, const AstToplevelNode *ast);
 
+/*
+Stage 3 can also be done one function or method at a time. Function bodies
+only read what stages 1 and 2 created, so they can be checked in parallel.
+typecheck_stage3_prepare() returns how many bodies the file has, and then
+typecheck_stage3_check_body() must be called with each index 0,1,...,n-1.
+The order doesn't matter, and different threads can check different bodies
+of the same file at the same time.
+*/
+int typecheck_stage3_prepare(FileTypes *ft, const AstToplevelNode *ast);
+void typecheck_stage3_check_body(FileTypes *ft, int index);
+
+// For imported things, usedptr points at the "used" flag of the import. Things defined in the file have usedptr == NULL.
+void add_type(FileTypes *ft, const Type *t, _Atomic bool *usedptr);
+void add_function(FileTypes *ft, Signature sig, _Atomic bool *usedptr);  // takes ownership of sig
+void add_global_var(FileTypes *ft, GlobalVariable *g);  // takes ownership of g
+
 
 // Control Flow Graph.
 // Struct names not prefixed with Cfg because it looks too much like "config" to me
@@ -498,7 +618,6 @@ struct CfInstruction {
         CF_CALL,  // function or method call, depending on whether self_type is NULL (see below)
         CF_ADDRESS_OF_LOCAL_VAR,
         CF_ADDRESS_OF_GLOBAL_VAR,
-        CF_SIZEOF,
         CF_PTR_MEMSET_TO_ZERO,  // takes one operand, a pointer: memset(ptr, 0, sizeof(*ptr))
         CF_PTR_STORE,  // *op1 = op2 (does not use destvar, takes 2 operands)
         CF_PTR_LOAD,  // aka dereference
@@ -525,7 +644,6 @@ struct CfInstruction {
         Signature signature;    // CF_CALL
         char fieldname[100];    // CF_PTR_CLASS_FIELD
         char globalname[100];   // CF_ADDRESS_OF_GLOBAL_VAR
-        const Type *type;       // CF_SIZEOF
     } data;
     const LocalVariable **operands;  // e.g. numbers to add, function arguments
     int noperands;
@@ -534,16 +652,19 @@ struct CfInstruction {
 };
 
 struct CfBlock {
+    int index;  // Index into CfGraph.all_blocks
     List(CfInstruction) instructions;
     const LocalVariable *branchvar;  // boolean value used to decide where to jump next
     CfBlock *iftrue;
     CfBlock *iffalse;
+    List(CfBlock *) predecessors;  // blocks that jump here, only up to date while simplify_cfg.c uses it
 };
 
 struct CfGraph {
     Signature signature;
     CfBlock start_block;  // First block
     CfBlock end_block;  // Always empty. Return statement jumps here.
+    // When removing items from these lists, update CfBlock.index and LocalVariable.id.
     List(CfBlock *) all_blocks;
     List(LocalVariable *) locals;   // First n variables are the function arguments
 };
@@ -572,36 +693,141 @@ struct Target {
 };
 void init_target(void);
 const struct Target *get_target(void);
+// LLVM target machines must not be shared between threads, so each thread emitting code makes its own.
+LLVMTargetMachineRef create_target_machine(void);
+// What sizeof gives for a value of the given type. Can be called from several threads at once.
+long long get_type_size(const Type *t);
 
 /*
 The compiling functions, i.e. how to go from source code to LLVM IR and
 eventually running the LLVM IR. Each function's result is fed into the next.
 
-Make sure that the filename passed to tokenize() stays alive throughout the
-entire compilation. It is used in error messages.
+The parser reads tokens from a token stream, which tokenizes the file as
+the parser goes. The data passed to open_token_stream() is the entire
+content of the source file, and it can be freed after the stream is opened.
+tokenize() collects all tokens into an array, for --tokenize-only and -vv.
 */
-Token *tokenize(FILE *f, const char *filename);
-AstToplevelNode *parse(const Token *tokens, const char *stdlib_path);
+TokenStream *open_token_stream(const char *data, size_t len, const char *filename);
+const Token *peek_token(TokenStream *ts, int n);  // n=0 is the next token, n=1 after that etc. Valid until next_token().
+Token next_token(TokenStream *ts);  // Returns the next token and moves past it.
+void close_token_stream(TokenStream *ts);
+Token *tokenize(const char *data, size_t len, const char *filename);
+Location token_location(const Token *t);
+const char *token_text(const Token *t);  // see comments in struct Token
+// All memory of the AST is allocated from the arena. Free it with free_arena().
+AstToplevelNode *parse(TokenStream *tokens, const char *stdlib_path, Arena *arena);
 // Type checking happens between parsing and building CFGs.
 CfGraphFile build_control_flow_graphs(AstToplevelNode *ast, FileTypes *ft);
 void simplify_control_flow_graphs(const CfGraphFile *cfgfile);
-LLVMModuleRef codegen(const CfGraphFile *cfgfile, const FileTypes *ft);
-char *compile_to_object_file(LLVMModuleRef module);
+LLVMModuleRef codegen(const CfGraphFile *cfgfile, const FileTypes *ft, LLVMContextRef context);
+char *get_object_file_path(const char *sourcepath);
+void compile_to_object_file(LLVMModuleRef module, LLVMTargetMachineRef target_machine, const char *path);
 char *get_default_exe_path(void);
 void run_linker(const char *const *objpaths, const char *exepath);
 int run_exe(const char *exepath);
+// Returns false if the JIT can't be used, e.g. because of --linker-flags.
+bool prepare_jit(void);
+// Consumes the module. Return value is like run_exe().
+int run_with_jit(LLVMModuleRef module);
+
+/*
+Object files are cached in the jou_compiled folder. The cache key of a file
+is a hash of everything that can affect the resulting object file: the
+source code, the types, functions and global variables that the file can see
+(including those imported from other files), the optimization level, the
+target and the compiler itself.
+
+Warnings are shown while building the CFG, so they are saved into the cache
+entry as well, and shown again when the cached object file is used.
+*/
+uint64_t get_object_cache_key(const char *path, const FileTypes *ft);
+bool object_file_is_cached(const char *path, uint64_t key);  // like use_cached_object_file(), but only checks
+char *use_cached_object_file(const char *path, uint64_t key);  // returns NULL if not cached
+FILE *create_object_cache_entry(const char *path, uint64_t key);  // returns NULL on error
+void commit_object_cache_entry(FILE *entry, const char *path);  // call after emitting the object file
+
+/*
+Interface files are saved next to cached object files. The interface file of
+"foo.jou" contains what other files need for importing from "foo.jou": its
+types, function signatures and global variables, i.e. the results of
+type-checking stages 1 and 2. Loading the interface file replaces
+tokenizing, parsing and the first two type-checking stages.
+
+Types defined in other files are saved by name, and looked up from the
+imports when the interface file is loaded. So an interface file only
+depends on its own source file. If something imported from another file
+changes, the interface file still works, but the object cache key changes,
+and the file is then parsed and compiled as usual.
+*/
+typedef struct Interface Interface;
+uint64_t get_interface_cache_key(const char *path);  // returns 0 if the file cannot be read
+char *get_interface_file_path(const char *path);
+void write_interface_file(const char *path, const AstToplevelNode *ast, const FileTypes *ft);
+Interface *load_interface_file(const char *path);  // returns NULL if missing or out of date, path must stay alive
+AstToplevelNode *get_interface_imports(const Interface *iface, Arena *arena);  // AST with only the imports
+void add_interface_toplevel_names(const Interface *iface, HashTable names[3]);  // indexed by ExportSymbolKind, values are line numbers
+ExportSymbol *interface_stage1_create_types(Interface *iface, FileTypes *ft);
+// Returns NULL without changing anything if a type cannot be found. Then the source file must be type-checked instead.
+ExportSymbol *interface_stage2_signatures_globals_structbodies(const Interface *iface, FileTypes *ft);
+void free_interface(Interface *iface);
+
+/*
+Compile server: "jou --server SOCKET" stays running, and jou_client (see
+src/client/) sends it compile requests. The server keeps parsed and
+type-checked files in memory, so unchanged files, such as the standard
+library, are not parsed and type-checked again for each request.
+*/
+noreturn void run_compile_server(const char *argv0, const char *socketpath);
+void notify_compile_server(void);  // call when all files have been parsed and type-checked
+int compile_and_run(int argc, char **argv);  // everything that main() does
+void update_server_cache(int argc, char **argv);  // call after compile_and_run() succeeded in a child process
+int run_batch(int argc, char **argv, int batchidx);  // argv[batchidx] is "--batch" or "--batch-from"
+
+/*
+For --time-report. Wrap each compilation step like this:
+
+    struct PhaseTimer t = start_phase();
+    ...do the work...
+    end_phase(t, filename, PHASE_FOO);
+
+Use NULL as the filename for steps that don't belong to a file, such as
+linking. These functions do nothing if --time-report wasn't given, and
+end_phase() can be called from multiple threads at once.
+*/
+enum CompilePhase {
+    PHASE_TOKENIZE,
+    PHASE_PARSE,
+    PHASE_TYPECHECK_STAGE1,
+    PHASE_TYPECHECK_STAGE2,
+    PHASE_TYPECHECK_STAGE3,
+    PHASE_BUILD_CFG,
+    PHASE_SIMPLIFY_CFG,
+    PHASE_CODEGEN,
+    PHASE_VERIFY,
+    PHASE_LINK_MODULES,  // --whole-program
+    PHASE_OPTIMIZE,
+    PHASE_EMIT,
+    PHASE_LINK,
+    PHASE_JIT,  // running without -o
+    NUM_PHASES,
+};
+struct PhaseTimer { double start_time; long start_peak_rss_kb; };
+struct PhaseTimer start_phase(void);
+void end_phase(struct PhaseTimer timer, const char *filename, enum CompilePhase phase);
+void print_time_report(void);
 
 /*
 Use these to clean up return values of compiling functions.
 
 Even though arrays are typically allocated with malloc(), you shouldn't simply
-free() them. For example, free(topnodelist) would free the list of AST nodes,
-but not any of the data contained within individual nodes.
+free() them. For example, free(cfgfile->graphs.ptr) would free the list of
+control flow graphs, but not any of the data contained within them.
+
+The AST is different: it lives in an Arena, see parse().
 */
 void free_constant(const Constant *c);
 void free_tokens(Token *tokenlist);
-void free_ast(AstToplevelNode *topnodelist);
-void free_file_types(const FileTypes *ft);
+void free_file_types(FileTypes *ft);
 void free_export_symbol(const ExportSymbol *es);
 void free_control_flow_graphs(const CfGraphFile *cfgfile);
 void free_control_flow_graph_block(const CfGraph *cfg, CfBlock *b);
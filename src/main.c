@@ -4,7 +4,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "jou_compiler.h"
 #include "util.h"
 #include <llvm-c/Analysis.h>
@@ -25,6 +28,9 @@ static void optimize(LLVMModuleRef module, int level)
     */
     LLVMPassManagerBuilderRef pmbuilder = LLVMPassManagerBuilderCreate();
     LLVMPassManagerBuilderSetOptLevel(pmbuilder, level);
+    // Without an inliner, --whole-program and the JIT can't inline functions
+    // from one file to another. These are LLVM's default thresholds.
+    LLVMPassManagerBuilderUseInlinerWithThreshold(pmbuilder, level == 3 ? 250 : 225);
     LLVMPassManagerBuilderPopulateModulePassManager(pmbuilder, pm);
     LLVMPassManagerBuilderDispose(pmbuilder);
 
@@ -34,18 +40,28 @@ static void optimize(LLVMModuleRef module, int level)
 
 static const char help_fmt[] =
     "Usage:\n"
-    "  <argv0> [-o OUTFILE] [-O0|-O1|-O2|-O3] [--verbose] [--linker-flags \"...\"] FILENAME\n"
+    "  <argv0> [-o OUTFILE] [-O0|-O1|-O2|-O3] [-j N] [--verbose] [--linker-flags \"...\"] FILENAME\n"
     "  <argv0> --help       # This message\n"
     "  <argv0> --update     # Download and install the latest Jou\n"
+    "  <argv0> --server SOCKET  # Keep running and compile files for jou_client\n"
+    "  <argv0> [options] --batch FILE1 FILE2 ...  # Compile many files, don't run them\n"
+    "  <argv0> [options] --batch-from LISTFILE    # Same, file names one per line\n"
     "\n"
     "Options:\n"
     "  -o OUTFILE       output an executable file, don't run the code\n"
+    "  --no-jit         without -o, create and run an executable instead of compiling\n"
+    "                   the code in memory (useful with valgrind)\n"
     "  -O0/-O1/-O2/-O3  set optimization level (0 = default, 3 = runs fastest)\n"
+    "  -j N             compile up to N files in parallel (default: 1)\n"
+    "  --whole-program  optimize all files together, so that functions can be inlined\n"
+    "                   from one file to another (-flto does the same thing)\n"
     "  -v / --verbose   display some progress information\n"
     "  -vv              display a lot of information about all compilation steps\n"
     "  --tokenize-only  display only the output of the tokenizer, don't do anything else\n"
     "  --parse-only     display only the AST (parse tree), don't do anything else\n"
     "  --linker-flags   appended to the linker command, so you can use external libraries\n"
+    "  --time-report    display how much time and memory each compilation step uses\n"
+    "                   (--time-report=json displays the same information as JSON)\n"
     ;
 
 struct CommandLineArgs command_line_args;
@@ -57,6 +73,7 @@ void parse_arguments(int argc, char **argv)
     command_line_args.optlevel = 1; /* Set default optimize to O1
                             User sets optimize will overwrite the default flag
                          */
+    command_line_args.njobs = 1;
 
     if (argc == 2 && !strcmp(argv[1], "--help")) {
         // Print help.
@@ -102,6 +119,16 @@ void parse_arguments(int argc, char **argv)
             }
             command_line_args.parse_only = true;
             i++;
+        } else if (!strcmp(argv[i], "--whole-program") || !strcmp(argv[i], "-flto")) {
+            command_line_args.whole_program = true;
+            i++;
+        } else if (!strcmp(argv[i], "--no-jit")) {
+            command_line_args.no_jit = true;
+            i++;
+        } else if (!strcmp(argv[i], "--time-report") || !strcmp(argv[i], "--time-report=json")) {
+            command_line_args.time_report = true;
+            command_line_args.time_report_json = !strcmp(argv[i], "--time-report=json");
+            i++;
         } else if (!strcmp(argv[i], "--linker-flags")) {
             if (command_line_args.linker_flags) {
                 fprintf(stderr, "%s: --linker-flags cannot be given multiple times", argv[0]);
@@ -120,6 +147,19 @@ void parse_arguments(int argc, char **argv)
         {
             command_line_args.optlevel = argv[i][2] - '0';
             i++;
+        } else if (!strcmp(argv[i], "-j")) {
+            if (argc-i < 2) {
+                fprintf(stderr, "%s: there must be a number after -j", argv[0]);
+                goto wrong_usage;
+            }
+            char *end;
+            long n = strtol(argv[i+1], &end, 10);
+            if (argv[i+1][0] < '0' || argv[i+1][0] > '9' || *end != '\0' || n < 1 || n > 1000) {
+                fprintf(stderr, "%s: the number after -j must be between 1 and 1000, not \"%s\"", argv[0], argv[i+1]);
+                goto wrong_usage;
+            }
+            command_line_args.njobs = n;
+            i += 2;
         } else if (!strcmp(argv[i], "-o")) {
             if (argc-i < 2) {
                 fprintf(stderr, "%s: there must be a file name after -o", argv[0]);
@@ -157,9 +197,21 @@ wrong_usage:
 struct FileState {
     char *path;
     AstToplevelNode *ast;
+    Arena ast_arena;  // owns all memory of ast
     FileTypes types;
-    LLVMModuleRef module;
+    CfGraphFile cfgfile;
+    char *objpath;
+    FILE *cache_entry;  // not NULL if the object file will be added to the cache after compiling
     ExportSymbol *pending_exports;
+    HashTable toplevel_names[3];  // indexed by enum ExportSymbolKind, values are line numbers
+    Interface *iface;  // not NULL if the file was loaded from an interface file
+    bool only_imports;  // ast contains only the imports, because the interface file was used
+
+    // For the compile server, see server.c
+    bool typechecked;  // reused from the server's cache, no need to parse or type-check
+    ExportSymbol *kept_exports[2];  // exports of typecheck stages 1 and 2
+    struct stat st;  // to notice when the file changes
+    bool reusable;  // file and all its imports are unchanged
 };
 
 struct ParseQueueItem {
@@ -167,21 +219,76 @@ struct ParseQueueItem {
     Location import_location;
 };
 
+struct PreloadedFile {
+    const char *path;
+    struct FileState fs;
+    bool ok;  // false if loading failed, then parse_file() loads it again to show the error
+};
+typedef List(struct PreloadedFile) PreloadedFileList;
+
 struct CompileState {
     const char *stdlib_path;
     List(struct FileState) files;
+    HashTable file_indexes;  // path --> index into files
     List(struct ParseQueueItem) parse_queue;
+    PreloadedFileList preloaded;  // see preload_files()
+    HashTable preloaded_indexes;  // path --> index into preloaded
+    bool keep_exports;  // true when filling the compile server's cache
+    bool use_interfaces;  // load files from interface files when possible
+    const struct CompileState *reuse_from;  // compile server's cache, or NULL
 };
 
 static struct FileState *find_file(const struct CompileState *compst, const char *path)
 {
-    for (struct FileState *fs = compst->files.ptr; fs < End(compst->files); fs++)
-        if (!strcmp(fs->path, path))
-            return fs;
-    return NULL;
+    int i = hashtable_get(&compst->file_indexes, path);
+    return i == -1 ? NULL : &compst->files.ptr[i];
 }
 
-static FILE *open_the_file(const char *path, const Location *import_location)
+static void add_file(struct CompileState *compst, struct FileState fs)
+{
+    hashtable_set(&compst->file_indexes, fs.path, compst->files.len);
+    Append(&compst->files, fs);
+}
+
+// This is used to check whether an imported symbol conflicts with something defined in the file.
+static void index_toplevel_names(struct FileState *fs)
+{
+    for (int i = 0; fs->ast[i].kind != AST_TOPLEVEL_END_OF_FILE; i++) {
+        const AstToplevelNode *ast = &fs->ast[i];
+        enum ExportSymbolKind kind;
+        const char *name;
+        switch(ast->kind) {
+        case AST_TOPLEVEL_DECLARE_FUNCTION:
+        case AST_TOPLEVEL_DEFINE_FUNCTION:
+            kind = EXPSYM_FUNCTION;
+            name = ast->data.funcdef.signature.name;
+            break;
+        case AST_TOPLEVEL_DECLARE_GLOBAL_VARIABLE:
+        case AST_TOPLEVEL_DEFINE_GLOBAL_VARIABLE:
+            kind = EXPSYM_GLOBAL_VAR;
+            name = ast->data.globalvar.name;
+            break;
+        case AST_TOPLEVEL_DEFINE_CLASS:
+            kind = EXPSYM_TYPE;
+            name = ast->data.classdef.name;
+            break;
+        case AST_TOPLEVEL_DEFINE_ENUM:
+            kind = EXPSYM_TYPE;
+            name = ast->data.enumdef.name;
+            break;
+        case AST_TOPLEVEL_IMPORT:
+            continue;
+        case AST_TOPLEVEL_END_OF_FILE:
+            assert(0);
+        }
+        // If the same name is defined twice, errors should point at the first one.
+        if (hashtable_get(&fs->toplevel_names[kind], name) == -1)
+            hashtable_set(&fs->toplevel_names[kind], name, ast->location.lineno);
+    }
+}
+
+// Reads the whole file with as few read calls as possible. The result must be free()d.
+static char *read_the_file(const char *path, const Location *import_location, size_t *len)
 {
     FILE *f = fopen(path, "rb");
     if (!f) {
@@ -190,39 +297,260 @@ static FILE *open_the_file(const char *path, const Location *import_location)
         else
             fail_with_error((Location){.filename=path}, "cannot open file: %s", strerror(errno));
     }
-    return f;
+
+    // The size is only a hint. If the file changes while we read it, we still read it all.
+    long size = -1;
+    if (fseek(f, 0, SEEK_END) == 0)
+        size = ftell(f);
+    rewind(f);
+
+    size_t cap = size > 0 ? (size_t)size + 1 : 4096;
+    char *data = malloc(cap);
+    *len = 0;
+    while (true) {
+        *len += fread(data + *len, 1, cap - *len, f);
+        if (*len < cap)
+            break;
+        cap *= 2;
+        data = realloc(data, cap);
+    }
+
+    if (ferror(f))
+        fail_with_error((Location){.filename=path}, "cannot read file: %s", strerror(errno));
+    fclose(f);
+    return data;
 }
 
-static void parse_file(struct CompileState *compst, const char *filename, const Location *import_location)
+static void queue_imports(struct CompileState *compst, const struct FileState *fs)
 {
-    if (find_file(compst, filename))
-        return;  // already parsed this file
-
-    struct FileState fs = { .path = strdup(filename) };
+    for (AstToplevelNode *impnode = fs->ast; impnode->kind == AST_TOPLEVEL_IMPORT; impnode++) {
+        Append(&compst->parse_queue, (struct ParseQueueItem){
+            .filename = impnode->data.import.path,
+            .import_location = impnode->location,
+        });
+    }
+}
 
+// path must stay alive, because it ends up in the locations of tokens and AST nodes
+static AstToplevelNode *tokenize_and_parse(const struct CompileState *compst, const char *path, const Location *import_location, Arena *arena)
+{
     if(command_line_args.verbosity >= 2)
-        printf("Tokenizing %s\n", filename);
-    FILE *f = open_the_file(fs.path, import_location);
-    Token *tokens = tokenize(f, fs.path);
-    fclose(f);
-    if(command_line_args.verbosity >= 2)
+        printf("Tokenizing %s\n", path);
+    struct PhaseTimer t = start_phase();
+    size_t len;
+    char *data = read_the_file(path, import_location, &len);
+    if(command_line_args.verbosity >= 2) {
+        // The parser doesn't need all tokens at once, but we want to print them.
+        Token *tokens = tokenize(data, len, path);
         print_tokens(tokens);
+        free_tokens(tokens);
+    }
+    TokenStream *tokens = open_token_stream(data, len, path);
+    free(data);
+    end_phase(t, path, PHASE_TOKENIZE);
 
+    // Most of the tokenizing happens here, as the parser asks for tokens.
     if(command_line_args.verbosity >= 2)
-        printf("Parsing %s\n", filename);
-    fs.ast = parse(tokens, compst->stdlib_path);
-    free_tokens(tokens);
+        printf("Parsing %s\n", path);
+    t = start_phase();
+    AstToplevelNode *ast = parse(tokens, compst->stdlib_path, arena);
+    close_token_stream(tokens);
+    end_phase(t, path, PHASE_PARSE);
     if(command_line_args.verbosity >= 2)
-        print_ast(fs.ast);
+        print_ast(ast);
 
-    for (AstToplevelNode *impnode = fs.ast; impnode->kind == AST_TOPLEVEL_IMPORT; impnode++) {
-        Append(&compst->parse_queue, (struct ParseQueueItem){
-            .filename = impnode->data.import.path,
-            .import_location = impnode->location,
-        });
+    return ast;
+}
+
+/*
+Reads and parses a file, or takes it from the compile server's cache or an
+interface file. This doesn't modify compst, so that several threads can load
+files at once (see preload_files()).
+*/
+static struct FileState load_file(const struct CompileState *compst, const char *filename, const Location *import_location)
+{
+    const struct FileState *cached = compst->reuse_from ? find_file(compst->reuse_from, filename) : NULL;
+    if (cached && cached->reusable) {
+        /*
+        Shallow copy. This is fine, because we are either in a forked process,
+        or adding more files to the cache (see update_server_cache()).
+        */
+        struct FileState fs = *cached;
+        fs.typechecked = true;
+        return fs;
     }
 
-    Append(&compst->files, fs);
+    struct FileState fs = { .path = strdup(filename) };
+
+    if (compst->use_interfaces && (fs.iface = load_interface_file(fs.path))) {
+        fs.ast = get_interface_imports(fs.iface, &fs.ast_arena);
+        fs.only_imports = true;
+        add_interface_toplevel_names(fs.iface, fs.toplevel_names);
+        return fs;
+    }
+
+    // Stat before reading, so that any later change makes the cached file look different.
+    if (compst->keep_exports && stat(filename, &fs.st) != 0)
+        memset(&fs.st, 0, sizeof fs.st);
+
+    fs.ast = tokenize_and_parse(compst, fs.path, import_location, &fs.ast_arena);
+    index_toplevel_names(&fs);
+    return fs;
+}
+
+static void parse_file(struct CompileState *compst, const char *filename, const Location *import_location)
+{
+    if (find_file(compst, filename))
+        return;  // already parsed this file
+
+    struct FileState fs;
+    int i = hashtable_get(&compst->preloaded_indexes, filename);
+    if (i != -1 && compst->preloaded.ptr[i].ok)
+        fs = compst->preloaded.ptr[i].fs;
+    else
+        fs = load_file(compst, filename, import_location);
+
+    if (command_line_args.verbosity >= 1) {
+        if (fs.typechecked)
+            printf("Reusing %s from the compile server's cache\n", filename);
+        else if (fs.iface)
+            printf("Using interface file for %s\n", filename);
+    }
+
+    queue_imports(compst, &fs);
+    add_file(compst, fs);
+}
+
+// Returns false on error. The error is not shown, because it may not be the first error.
+static bool try_to_load_file(const struct CompileState *compst, const char *filename, struct FileState *result)
+{
+    jmp_buf jb;
+    if (setjmp(jb)) {
+        jump_silently_on_error(NULL);
+        return false;
+    }
+    jump_silently_on_error(&jb);
+    *result = load_file(compst, filename, NULL);
+    jump_silently_on_error(NULL);
+    return true;
+}
+
+struct Preloader {
+    const struct CompileState *compst;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;  // signaled when a thread finishes loading a file
+    PreloadedFileList files;
+    HashTable indexes;  // path --> index into files
+    int next;  // files before this index are loaded, or some thread is loading them
+    int nbusy;  // how many threads are loading a file
+};
+
+static void preload_worker(void *data, int i)
+{
+    (void)i;
+    struct Preloader *pl = data;
+    pthread_mutex_lock(&pl->lock);
+
+    while (true) {
+        // Another thread may be about to find more files to load.
+        while (pl->next == pl->files.len && pl->nbusy > 0)
+            pthread_cond_wait(&pl->cond, &pl->lock);
+        if (pl->next == pl->files.len)
+            break;
+
+        int idx = pl->next++;
+        const char *path = pl->files.ptr[idx].path;
+        pl->nbusy++;
+        pthread_mutex_unlock(&pl->lock);
+
+        struct FileState fs = {0};
+        bool ok = try_to_load_file(pl->compst, path, &fs);
+
+        pthread_mutex_lock(&pl->lock);
+        pl->files.ptr[idx].fs = fs;
+        pl->files.ptr[idx].ok = ok;
+        for (AstToplevelNode *imp = fs.ast; ok && imp->kind == AST_TOPLEVEL_IMPORT; imp++) {
+            const char *imppath = imp->data.import.path;
+            if (hashtable_get(&pl->indexes, imppath) == -1) {
+                hashtable_set(&pl->indexes, imppath, pl->files.len);
+                Append(&pl->files, (struct PreloadedFile){ .path = imppath });
+            }
+        }
+        pl->nbusy--;
+        pthread_cond_broadcast(&pl->cond);
+    }
+
+    pthread_mutex_unlock(&pl->lock);
+}
+
+/*
+With -j, files are loaded in several threads before parse_file() is called.
+As soon as a file is parsed, its imports can be loaded by other threads.
+
+Then parse_file() adds the files to compst in the same order as without -j,
+so that the compiler behaves the same either way. For the same reason, a file
+that fails to load is loaded again in parse_file(), which shows the error.
+*/
+static void preload_files(struct CompileState *compst, const char *const *paths, int npaths)
+{
+    struct Preloader pl = { .compst = compst };
+    pthread_mutex_init(&pl.lock, NULL);
+    pthread_cond_init(&pl.cond, NULL);
+
+    for (int i = 0; i < npaths; i++) {
+        hashtable_set(&pl.indexes, paths[i], pl.files.len);
+        Append(&pl.files, (struct PreloadedFile){ .path = paths[i] });
+    }
+
+    int njobs = command_line_args.njobs;
+    run_in_parallel(njobs, njobs, preload_worker, &pl);
+
+    pthread_cond_destroy(&pl.cond);
+    pthread_mutex_destroy(&pl.lock);
+    compst->preloaded = pl.files;
+    compst->preloaded_indexes = pl.indexes;
+}
+
+static _Atomic bool *move_usedptr(_Atomic bool *usedptr, AstToplevelNode *oldimports, AstToplevelNode *newimports, int nimports)
+{
+    for (int i = 0; i < nimports; i++)
+        if (usedptr == &oldimports[i].data.import.used)
+            return &newimports[i].data.import.used;
+    return usedptr;
+}
+
+/*
+Used when a file was loaded from an interface file, but it must be
+type-checked or compiled after all. Because the source file hasn't changed
+since the interface file was written, the imports are the same, and the
+imported symbols already added to fs->types still work.
+*/
+static void parse_instead_of_interface(const struct CompileState *compst, struct FileState *fs)
+{
+    assert(fs->only_imports);
+    Arena arena = {0};
+    AstToplevelNode *ast = tokenize_and_parse(compst, fs->path, NULL, &arena);
+
+    int nimports = 0;
+    while (fs->ast[nimports].kind == AST_TOPLEVEL_IMPORT) {
+        assert(ast[nimports].kind == AST_TOPLEVEL_IMPORT);
+        ast[nimports].data.import.found = fs->ast[nimports].data.import.found;
+        ast[nimports].data.import.used = fs->ast[nimports].data.import.used;
+        nimports++;
+    }
+
+    // Imported symbols point at the old import statements.
+    for (struct TypeAndUsedPtr *t = fs->types.types.ptr; t < End(fs->types.types); t++)
+        t->usedptr = move_usedptr(t->usedptr, fs->ast, ast, nimports);
+    for (struct SignatureAndUsedPtr *f = fs->types.functions.ptr; f < End(fs->types.functions); f++)
+        f->usedptr = move_usedptr(f->usedptr, fs->ast, ast, nimports);
+    for (GlobalVariable **g = fs->types.globals.ptr; g < End(fs->types.globals); g++)
+        (*g)->usedptr = move_usedptr((*g)->usedptr, fs->ast, ast, nimports);
+
+    free_arena(&fs->ast_arena);
+    fs->ast = ast;
+    fs->ast_arena = arena;
+    fs->only_imports = false;
 }
 
 static void parse_all_pending_files(struct CompileState *compst)
@@ -232,9 +560,13 @@ static void parse_all_pending_files(struct CompileState *compst)
         parse_file(compst, it.filename, &it.import_location);
     }
     free(compst->parse_queue.ptr);
+    free(compst->preloaded.ptr);
+    hashtable_free(&compst->preloaded_indexes);
+    memset(&compst->parse_queue, 0, sizeof compst->parse_queue);
+    memset(&compst->preloaded, 0, sizeof compst->preloaded);
 }
 
-static void compile_ast_to_llvm(struct FileState *fs)
+static void build_and_simplify_cfg(struct FileState *fs)
 {
     if (command_line_args.verbosity >= 1)
         printf("Compile to LLVM IR: %s\n", fs->path);
@@ -242,40 +574,152 @@ static void compile_ast_to_llvm(struct FileState *fs)
     if (command_line_args.verbosity >= 2)
         printf("Building CFG: %s\n", fs->path);
 
-    CfGraphFile cfgfile = build_control_flow_graphs(fs->ast, &fs->types);
+    struct PhaseTimer t = start_phase();
+    fs->cfgfile = build_control_flow_graphs(fs->ast, &fs->types);
+    end_phase(t, fs->path, PHASE_BUILD_CFG);
     for (AstToplevelNode *imp = fs->ast; imp->kind == AST_TOPLEVEL_IMPORT; imp++)
         if (!imp->data.import.used)
             show_warning(imp->location, "'%s' imported but not used", imp->data.import.symbolname);
 
     if(command_line_args.verbosity >= 2)
-        print_control_flow_graphs(&cfgfile);
+        print_control_flow_graphs(&fs->cfgfile);
 
-    simplify_control_flow_graphs(&cfgfile);
+    t = start_phase();
+    simplify_control_flow_graphs(&fs->cfgfile);
+    end_phase(t, fs->path, PHASE_SIMPLIFY_CFG);
     if(command_line_args.verbosity >= 2)
-        print_control_flow_graphs(&cfgfile);
+        print_control_flow_graphs(&fs->cfgfile);
+}
 
+static LLVMModuleRef codegen_file(struct FileState *fs, LLVMContextRef context)
+{
     if (command_line_args.verbosity >= 2)
         printf("Build LLVM IR: %s\n", fs->path);
 
-    fs->module = codegen(&cfgfile, &fs->types);
-    free_control_flow_graphs(&cfgfile);
+    struct PhaseTimer t = start_phase();
+    LLVMModuleRef module = codegen(&fs->cfgfile, &fs->types, context);
+    free_control_flow_graphs(&fs->cfgfile);
+    end_phase(t, fs->path, PHASE_CODEGEN);
 
     if (command_line_args.verbosity >= 2)
-        print_llvm_ir(fs->module, false);
+        print_llvm_ir(module, false);
 
     /*
     If this fails, it is not just users writing dumb code, it is a bug in this compiler.
     This compiler should always fail with an error elsewhere, or generate valid LLVM IR.
     */
-    LLVMVerifyModule(fs->module, LLVMAbortProcessAction, NULL);
+    t = start_phase();
+    LLVMVerifyModule(module, LLVMAbortProcessAction, NULL);
+    end_phase(t, fs->path, PHASE_VERIFY);
 
-    if (command_line_args.optlevel) {
-        if (command_line_args.verbosity >= 2)
-            printf("Optimizing %s (level %d)\n", fs->path, command_line_args.optlevel);
-        optimize(fs->module, command_line_args.optlevel);
-        if(command_line_args.verbosity >= 2)
-            print_llvm_ir(fs->module, true);
+    return module;
+}
+
+// path is NULL when optimizing the whole program at once
+static void optimize_and_print(LLVMModuleRef module, const char *path)
+{
+    if (!command_line_args.optlevel)
+        return;
+
+    if (command_line_args.verbosity >= 2)
+        printf("Optimizing %s (level %d)\n", path ? path : "the whole program", command_line_args.optlevel);
+    struct PhaseTimer t = start_phase();
+    optimize(module, command_line_args.optlevel);
+    end_phase(t, path, PHASE_OPTIMIZE);
+    if(command_line_args.verbosity >= 2)
+        print_llvm_ir(module, true);
+}
+
+/*
+With -j, this runs in several threads at once, each thread working on a
+different file. The CFGs were already built (that is where all warnings
+and errors come from), so what remains is pure LLVM work. LLVM is fine with
+threads as long as they don't share a context or a target machine, so each
+file gets its own.
+*/
+static void compile_cfg_to_object_file(void *data, int fileidx)
+{
+    struct FileState *fs = &((struct CompileState *)data)->files.ptr[fileidx];
+    if (fs->objpath)
+        return;  // cached
+
+    LLVMContextRef context = LLVMContextCreate();
+    LLVMTargetMachineRef target_machine = create_target_machine();
+
+    LLVMModuleRef module = codegen_file(fs, context);
+    optimize_and_print(module, fs->path);
+
+    fs->objpath = get_object_file_path(fs->path);
+    struct PhaseTimer t = start_phase();
+    compile_to_object_file(module, target_machine, fs->objpath);
+    end_phase(t, fs->path, PHASE_EMIT);
+    if (fs->cache_entry)
+        commit_object_cache_entry(fs->cache_entry, fs->path);
+
+    LLVMDisposeModule(module);
+    LLVMDisposeTargetMachine(target_machine);
+    LLVMContextDispose(context);
+}
+
+/*
+With --whole-program, all files are compiled into one LLVM module. Then
+everything except main() is made internal to the module, so that LLVM can
+inline functions from one file into another and delete functions that are
+never called.
+*/
+static LLVMModuleRef link_whole_program(struct CompileState *compst, LLVMContextRef context)
+{
+    LLVMModuleRef result = NULL;
+    for (struct FileState *fs = compst->files.ptr; fs < End(compst->files); fs++) {
+        LLVMModuleRef module = codegen_file(fs, context);
+        if (!result) {
+            result = module;
+            continue;
+        }
+
+        struct PhaseTimer t = start_phase();
+        // This destroys the module. LLVM prints an error message if it fails.
+        if (LLVMLinkModules2(result, module)) {
+            fprintf(stderr, "%s: cannot link LLVM IR of \"%s\" with other files\n", command_line_args.argv0, fs->path);
+            exit(1);
+        }
+        end_phase(t, fs->path, PHASE_LINK_MODULES);
+    }
+    LLVMSetSourceFileName(result, command_line_args.infile, strlen(command_line_args.infile));
+
+    for (LLVMValueRef f = LLVMGetFirstFunction(result); f; f = LLVMGetNextFunction(f)) {
+        if (!LLVMIsDeclaration(f) && strcmp(LLVMGetValueName(f), "main"))
+            LLVMSetLinkage(f, LLVMInternalLinkage);
     }
+    for (LLVMValueRef g = LLVMGetFirstGlobal(result); g; g = LLVMGetNextGlobal(g)) {
+        if (!LLVMIsDeclaration(g))
+            LLVMSetLinkage(g, LLVMInternalLinkage);
+    }
+
+    struct PhaseTimer t = start_phase();
+    LLVMVerifyModule(result, LLVMAbortProcessAction, NULL);
+    end_phase(t, NULL, PHASE_VERIFY);
+    return result;
+}
+
+static char *compile_whole_program_to_object_file(struct CompileState *compst)
+{
+    LLVMContextRef context = LLVMContextCreate();
+    LLVMTargetMachineRef target_machine = create_target_machine();
+
+    LLVMModuleRef module = link_whole_program(compst, context);
+    optimize_and_print(module, NULL);
+
+    // Not named after any Jou file, so that it doesn't mess up the object file cache
+    char *objpath = get_object_file_path("_whole_program");
+    struct PhaseTimer t = start_phase();
+    compile_to_object_file(module, target_machine, objpath);
+    end_phase(t, NULL, PHASE_EMIT);
+
+    LLVMDisposeModule(module);
+    LLVMDisposeTargetMachine(target_machine);
+    LLVMContextDispose(context);
+    return objpath;
 }
 
 static char *find_stdlib()
@@ -303,54 +747,27 @@ static char *find_stdlib()
     return path;
 }
 
-static bool astnode_conflicts_with_an_import(const AstToplevelNode *astnode, const ExportSymbol *import)
-{
-    switch(astnode->kind) {
-    case AST_TOPLEVEL_DECLARE_FUNCTION:
-    case AST_TOPLEVEL_DEFINE_FUNCTION:
-        return import->kind == EXPSYM_FUNCTION && !strcmp(import->name, astnode->data.funcdef.signature.name);
-    case AST_TOPLEVEL_DECLARE_GLOBAL_VARIABLE:
-    case AST_TOPLEVEL_DEFINE_GLOBAL_VARIABLE:
-        return import->kind == EXPSYM_GLOBAL_VAR && !strcmp(import->name, astnode->data.globalvar.name);
-    case AST_TOPLEVEL_DEFINE_CLASS:
-        return import->kind == EXPSYM_TYPE && !strcmp(import->name, astnode->data.classdef.name);
-    case AST_TOPLEVEL_DEFINE_ENUM:
-        return import->kind == EXPSYM_TYPE && !strcmp(import->name, astnode->data.enumdef.name);
-    case AST_TOPLEVEL_IMPORT:
-        return false;
-    case AST_TOPLEVEL_END_OF_FILE:
-        assert(0);
-    }
-}
-
 static void add_imported_symbol(struct FileState *fs, const ExportSymbol *es, AstImport *imp)
 {
-    for (AstToplevelNode *ast = fs->ast; ast->kind != AST_TOPLEVEL_END_OF_FILE; ast++) {
-        if (astnode_conflicts_with_an_import(ast, es)) {
-            const char *wat;
-            switch(es->kind) {
-                case EXPSYM_FUNCTION: wat = "function"; break;
-                case EXPSYM_GLOBAL_VAR: wat = "global variable"; break;
-                case EXPSYM_TYPE: wat = "type"; break;
-            }
-            fail_with_error(ast->location, "a %s named '%s' already exists", wat, es->name);
+    int conflict = hashtable_get(&fs->toplevel_names[es->kind], es->name);
+    if (conflict != -1) {
+        const char *wat;
+        switch(es->kind) {
+            case EXPSYM_FUNCTION: wat = "function"; break;
+            case EXPSYM_GLOBAL_VAR: wat = "global variable"; break;
+            case EXPSYM_TYPE: wat = "type"; break;
         }
+        fail_with_error((Location){ .filename = fs->path, .lineno = conflict }, "a %s named '%s' already exists", wat, es->name);
     }
 
     struct GlobalVariable *g;
 
     switch(es->kind) {
     case EXPSYM_FUNCTION:
-        Append(&fs->types.functions, (struct SignatureAndUsedPtr){
-            .signature = copy_signature(&es->data.funcsignature),
-            .usedptr = &imp->used,
-        });
+        add_function(&fs->types, copy_signature(&es->data.funcsignature), &imp->used);
         break;
     case EXPSYM_TYPE:
-        Append(&fs->types.types, (struct TypeAndUsedPtr){
-            .type=es->data.type,
-            .usedptr=&imp->used,
-        });
+        add_type(&fs->types, es->data.type, &imp->used);
         break;
     case EXPSYM_GLOBAL_VAR:
         g = calloc(1, sizeof(*g));
@@ -358,51 +775,89 @@ static void add_imported_symbol(struct FileState *fs, const ExportSymbol *es, As
         g->usedptr = &imp->used;
         assert(strlen(es->name) < sizeof g->name);
         strcpy(g->name, es->name);
-        Append(&fs->types.globals, g);
+        add_global_var(&fs->types, g);
         break;
     }
 }
 
-static bool exportsymbol_matches_import(const ExportSymbol *es, const AstImport *imp)
+/*
+Exports of a file, looked up by the name that is used to import them.
+Method bar in class Foo appears as a function with name "Foo.bar", and it
+must be imported when importing Foo, so the key is the part before '.'.
+*/
+struct ExportIndex {
+    HashTable first;  // key --> index of the first export with that key
+    int *next;  // index of next export with the same key, or -1
+};
+
+static struct ExportIndex build_export_index(const ExportSymbol *exports)
 {
-    // Method bar in struct Foo appears as a function with name "Foo.bar". Match it when importing Foo.
-    return !strcmp(es->name, imp->symbolname) || (strlen(es->name) > strlen(imp->symbolname) && es->name[strlen(imp->symbolname)] == '.');
+    int n = 0;
+    while (exports[n].name[0])
+        n++;
+
+    struct ExportIndex idx = { .next = malloc(sizeof(int) * (n+1)) };
+    // Go backwards, so that exports with the same key end up in their original order.
+    for (int i = n-1; i >= 0; i--) {
+        char key[sizeof exports[i].name];
+        safe_strcpy(key, exports[i].name);
+        key[strcspn(key, ".")] = '\0';
+        idx.next[i] = hashtable_get(&idx.first, key);
+        hashtable_set(&idx.first, key, i);
+    }
+    return idx;
 }
 
-static void add_imported_symbols(struct CompileState *compst)
+static void add_imported_symbols(struct CompileState *compst, int stage)
 {
+    struct ExportIndex *indexes = calloc(compst->files.len, sizeof indexes[0]);
+    for (int i = 0; i < compst->files.len; i++)
+        indexes[i] = build_export_index(compst->files.ptr[i].pending_exports);
+
     // TODO: should it be possible for a file to import from itself?
     // Should fail with error?
     for (struct FileState *to = compst->files.ptr; to < End(compst->files); to++) {
+        if (to->typechecked)
+            continue;  // already has everything it imports
         for (AstToplevelNode *ast = to->ast; ast->kind == AST_TOPLEVEL_IMPORT; ast++) {
             AstImport *imp = &ast->data.import;
-            struct FileState *from = find_file(compst, imp->path);
-            assert(from);
-
-            for (struct ExportSymbol *es = from->pending_exports; es->name[0]; es++) {
-                if (exportsymbol_matches_import(es, imp)) {
-                    if (command_line_args.verbosity >= 2) {
-                        const char *kindstr;
-                        switch(es->kind) {
-                            case EXPSYM_FUNCTION: kindstr="function"; break;
-                            case EXPSYM_GLOBAL_VAR: kindstr="global var"; break;
-                            case EXPSYM_TYPE: kindstr="type"; break;
-                        }
-                        printf("Adding imported %s %s: %s --> %s\n",
-                            kindstr, es->name, from->path, to->path);
+            int fromidx = hashtable_get(&compst->file_indexes, imp->path);
+            assert(fromidx != -1);
+            const struct FileState *from = &compst->files.ptr[fromidx];
+
+            for (int i = hashtable_get(&indexes[fromidx].first, imp->symbolname); i != -1; i = indexes[fromidx].next[i]) {
+                const ExportSymbol *es = &from->pending_exports[i];
+                if (command_line_args.verbosity >= 2) {
+                    const char *kindstr;
+                    switch(es->kind) {
+                        case EXPSYM_FUNCTION: kindstr="function"; break;
+                        case EXPSYM_GLOBAL_VAR: kindstr="global var"; break;
+                        case EXPSYM_TYPE: kindstr="type"; break;
                     }
-                    imp->found = true;
-                    add_imported_symbol(to, es, imp);
+                    printf("Adding imported %s %s: %s --> %s\n",
+                        kindstr, es->name, from->path, to->path);
                 }
+                imp->found = true;
+                add_imported_symbol(to, es, imp);
             }
         }
     }
 
+    for (int i = 0; i < compst->files.len; i++) {
+        hashtable_free(&indexes[i].first);
+        free(indexes[i].next);
+    }
+    free(indexes);
+
     // Mark all exports as no longer pending.
     for (struct FileState *fs = compst->files.ptr; fs < End(compst->files); fs++) {
-        for (struct ExportSymbol *es = fs->pending_exports; es->name[0]; es++)
-            free_export_symbol(es);
-        free(fs->pending_exports);
+        if (compst->keep_exports) {
+            fs->kept_exports[stage-1] = fs->pending_exports;
+        } else if (!fs->typechecked) {
+            for (struct ExportSymbol *es = fs->pending_exports; es->name[0]; es++)
+                free_export_symbol(es);
+            free(fs->pending_exports);
+        }
         fs->pending_exports = NULL;
     }
 }
@@ -426,85 +881,391 @@ static void check_for_404_imports(const struct CompileState *compst)
     }
 }
 
-int main(int argc, char **argv)
+static void parse_all_files(struct CompileState *compst)
 {
-    init_target();
-    init_types();
-    char *stdlib = find_stdlib();
-    parse_arguments(argc, argv);
+    if (command_line_args.verbosity >= 1)
+        printf("Parsing Jou files...\n");
 
-    struct CompileState compst = { .stdlib_path = stdlib };
-    if (command_line_args.verbosity >= 2) {
-        printf("Target triple: %s\n", get_target()->triple);
-        printf("Data layout: %s\n", get_target()->data_layout);
-    }
+    const char *paths[2];
+    int npaths = 0;
+#ifdef _WIN32
+    char *startup_path = malloc(strlen(compst->stdlib_path) + 50);
+    sprintf(startup_path, "%s/_windows_startup.jou", compst->stdlib_path);
+    paths[npaths++] = startup_path;
+#endif
+    paths[npaths++] = command_line_args.infile;
 
-    if (command_line_args.tokenize_only || command_line_args.parse_only) {
-        FILE *f = open_the_file(command_line_args.infile, NULL);
-        Token *tokens = tokenize(f, command_line_args.infile);
-        fclose(f);
-        if (command_line_args.tokenize_only) {
-            print_tokens(tokens);
-        } else {
-            AstToplevelNode *ast = parse(tokens, compst.stdlib_path);
-            print_ast(ast);
-            free_ast(ast);
-        }
-        free_tokens(tokens);
-        return 0;
-    }
+    // With -vv, we print tokens and ASTs while parsing, and they must not get mixed up.
+    if (command_line_args.njobs > 1 && command_line_args.verbosity < 2)
+        preload_files(compst, paths, npaths);
 
-    if (command_line_args.verbosity >= 1)
-        printf("Parsing Jou files...\n");
+    for (int i = 0; i < npaths; i++)
+        parse_file(compst, paths[i], NULL);
+    parse_all_pending_files(compst);
 
 #ifdef _WIN32
-    char *startup_path = malloc(strlen(compst.stdlib_path) + 50);
-    sprintf(startup_path, "%s/_windows_startup.jou", compst.stdlib_path);
-    parse_file(&compst, startup_path, NULL);
     free(startup_path);
 #endif
+}
 
-    parse_file(&compst, command_line_args.infile, NULL);
-    parse_all_pending_files(&compst);
+static void typecheck_stage3(struct FileState *fs)
+{
+    if (command_line_args.verbosity >= 2)
+        printf("Typecheck stage 3: %s\n", fs->path);
+    struct PhaseTimer t = start_phase();
+    typecheck_stage3_function_and_method_bodies(&fs->types, fs->ast);
+    end_phase(t, fs->path, PHASE_TYPECHECK_STAGE3);
+}
 
+// Checking one function or method body in stage 3.
+struct Stage3Task {
+    struct FileState *fs;
+    int index;
+    bool done;
+};
+typedef List(struct Stage3Task) Stage3TaskList;
+
+static void stage3_worker(void *data, int i)
+{
+    struct Stage3Task *task = &((struct Stage3Task *)data)[i];
+    struct PhaseTimer t = start_phase();
+
+    // If there is an error, it is shown later when the same body is checked again in the main thread.
+    jmp_buf jb;
+    if (setjmp(jb)) {
+        jump_silently_on_error(NULL);
+        return;
+    }
+    jump_silently_on_error(&jb);
+    typecheck_stage3_check_body(&task->fs->types, task->index);
+    jump_silently_on_error(NULL);
+
+    task->done = true;
+    end_phase(t, task->fs->path, PHASE_TYPECHECK_STAGE3);
+}
+
+/*
+With -j, function and method bodies of all files are checked in parallel.
+If some of them fail, we check them again one by one in the main thread, so
+the error is always the first one that a sequential compile would show.
+*/
+static void typecheck_stage3_all_files(Stage3TaskList tasks)
+{
+    if (command_line_args.njobs > 1)
+        run_in_parallel(command_line_args.njobs, tasks.len, stage3_worker, tasks.ptr);
+
+    for (struct Stage3Task *task = tasks.ptr; task < End(tasks); task++) {
+        if (!task->done) {
+            struct PhaseTimer t = start_phase();
+            typecheck_stage3_check_body(&task->fs->types, task->index);
+            end_phase(t, task->fs->path, PHASE_TYPECHECK_STAGE3);
+        }
+    }
+}
+
+static void typecheck_all_files(struct CompileState *compst)
+{
     if (command_line_args.verbosity >= 1)
         printf("Type-checking...\n");
 
-    for (struct FileState *fs = compst.files.ptr; fs < End(compst.files); fs++) {
+    for (struct FileState *fs = compst->files.ptr; fs < End(compst->files); fs++) {
+        if (fs->typechecked) {
+            fs->pending_exports = fs->kept_exports[0];
+            continue;
+        }
         if (command_line_args.verbosity >= 2)
             printf("Typecheck stage 1: %s\n", fs->path);
-        fs->pending_exports = typecheck_stage1_create_types(&fs->types, fs->ast);
+        struct PhaseTimer t = start_phase();
+        if (fs->iface)
+            fs->pending_exports = interface_stage1_create_types(fs->iface, &fs->types);
+        else
+            fs->pending_exports = typecheck_stage1_create_types(&fs->types, fs->ast);
+        end_phase(t, fs->path, PHASE_TYPECHECK_STAGE1);
     }
-    add_imported_symbols(&compst);
-    for (struct FileState *fs = compst.files.ptr; fs < End(compst.files); fs++) {
+    add_imported_symbols(compst, 1);
+    for (struct FileState *fs = compst->files.ptr; fs < End(compst->files); fs++) {
+        if (fs->typechecked) {
+            fs->pending_exports = fs->kept_exports[1];
+            continue;
+        }
         if (command_line_args.verbosity >= 2)
             printf("Typecheck stage 2: %s\n", fs->path);
-        fs->pending_exports = typecheck_stage2_signatures_globals_structbodies(&fs->types, fs->ast);
+        struct PhaseTimer t = start_phase();
+        fs->pending_exports = NULL;
+        if (fs->iface)
+            fs->pending_exports = interface_stage2_signatures_globals_structbodies(fs->iface, &fs->types);
+        if (!fs->pending_exports) {
+            // A type used in the file no longer exists. Type-check the file to get the error.
+            if (fs->only_imports)
+                parse_instead_of_interface(compst, fs);
+            fs->pending_exports = typecheck_stage2_signatures_globals_structbodies(&fs->types, fs->ast);
+        }
+        end_phase(t, fs->path, PHASE_TYPECHECK_STAGE2);
     }
-    add_imported_symbols(&compst);
-    for (struct FileState *fs = compst.files.ptr; fs < End(compst.files); fs++) {
+    add_imported_symbols(compst, 2);
+    Stage3TaskList stage3_tasks = {0};
+    for (struct FileState *fs = compst->files.ptr; fs < End(compst->files); fs++) {
+        if (fs->typechecked)
+            continue;
+        /*
+        Function bodies are only needed for compiling the file. If the
+        object file is cached, we don't need to look at them at all.
+        */
+        if (fs->only_imports) {
+            if (object_file_is_cached(fs->path, get_object_cache_key(fs->path, &fs->types)))
+                continue;
+            parse_instead_of_interface(compst, fs);
+        }
         if (command_line_args.verbosity >= 2)
             printf("Typecheck stage 3: %s\n", fs->path);
-        typecheck_stage3_function_and_method_bodies(&fs->types, fs->ast);
+        int n = typecheck_stage3_prepare(&fs->types, fs->ast);
+        for (int i = 0; i < n; i++)
+            Append(&stage3_tasks, (struct Stage3Task){ .fs = fs, .index = i });
     }
+    typecheck_stage3_all_files(stage3_tasks);
+    free(stage3_tasks.ptr);
 
-    check_for_404_imports(&compst);
+    check_for_404_imports(compst);
+}
+
+/*
+The compile server keeps parsed and type-checked files in memory. Each
+compile request is handled in a forked process, which gets a copy of this
+and uses the files that haven't changed.
+*/
+static char *stdlib_path;
+static struct CompileState server_cache;
+static char *server_cache_cwd;
+
+static char *get_current_directory(void)
+{
+    char buf[4096];
+    return strdup(getcwd(buf, sizeof buf) ? buf : "");
+}
+
+static void free_server_cache(void)
+{
+    for (struct FileState *fs = server_cache.files.ptr; fs < End(server_cache.files); fs++) {
+        free_arena(&fs->ast_arena);
+        free(fs->path);
+        free_file_types(&fs->types);
+        for (int i = 0; i < 3; i++)
+            hashtable_free(&fs->toplevel_names[i]);
+        for (int i = 0; i < 2; i++) {
+            for (struct ExportSymbol *es = fs->kept_exports[i]; es->name[0]; es++)
+                free_export_symbol(es);
+            free(fs->kept_exports[i]);
+        }
+    }
+    free(server_cache.files.ptr);
+    hashtable_free(&server_cache.file_indexes);
+    free(server_cache_cwd);
+    memset(&server_cache, 0, sizeof server_cache);
+    server_cache_cwd = NULL;
+}
+
+// A cached file can be used if it hasn't changed, and neither have the files it imports.
+static void find_reusable_files(void)
+{
+    char *cwd = get_current_directory();
+    bool same_cwd = server_cache_cwd && !strcmp(cwd, server_cache_cwd);
+    free(cwd);
+
+    for (struct FileState *fs = server_cache.files.ptr; fs < End(server_cache.files); fs++) {
+        struct stat st;
+        fs->reusable = same_cwd
+            && stat(fs->path, &st) == 0
+            && st.st_ino == fs->st.st_ino
+            && st.st_size == fs->st.st_size
+            && st.st_mtime == fs->st.st_mtime
+#ifdef __linux__
+            && st.st_mtim.tv_nsec == fs->st.st_mtim.tv_nsec
+#endif
+            ;
+    }
+
+    bool changed;
+    do {
+        changed = false;
+        for (struct FileState *fs = server_cache.files.ptr; fs < End(server_cache.files); fs++) {
+            if (!fs->reusable)
+                continue;
+            for (AstToplevelNode *imp = fs->ast; imp->kind == AST_TOPLEVEL_IMPORT; imp++) {
+                const struct FileState *dep = find_file(&server_cache, imp->data.import.path);
+                if (!dep || !dep->reusable) {
+                    fs->reusable = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    } while (changed);
+}
+
+void update_server_cache(int argc, char **argv)
+{
+    parse_arguments(argc, argv);
+    command_line_args.verbosity = 0;
+    command_line_args.time_report = false;
+
+    find_reusable_files();
+    bool all_reusable = true;
+    for (const struct FileState *fs = server_cache.files.ptr; fs < End(server_cache.files); fs++)
+        all_reusable = all_reusable && fs->reusable;
+    if (all_reusable && find_file(&server_cache, command_line_args.infile))
+        return;
+
+    // Errors are unlikely, because the same files were just compiled successfully.
+    // But if a file changed in between, we must not exit.
+    struct CompileState *newcache = calloc(1, sizeof *newcache);
+    newcache->stdlib_path = stdlib_path;
+    newcache->keep_exports = true;
+    // If nothing changed, we only need to add new files. Otherwise start over.
+    if (all_reusable && server_cache.files.len > 0)
+        newcache->reuse_from = &server_cache;
+
+    jmp_buf jb;
+    if (setjmp(jb)) {
+        // Leaks memory, but it doesn't happen often
+        jump_on_error(NULL);
+        return;
+    }
+    jump_on_error(&jb);
+    parse_all_files(newcache);
+    typecheck_all_files(newcache);
+    jump_on_error(NULL);
+
+    if (newcache->reuse_from) {
+        for (struct FileState *fs = newcache->files.ptr; fs < End(newcache->files); fs++)
+            if (!fs->typechecked)
+                add_file(&server_cache, *fs);
+        free(newcache->files.ptr);
+        hashtable_free(&newcache->file_indexes);
+    } else {
+        free_server_cache();
+        server_cache = *newcache;
+        server_cache_cwd = get_current_directory();
+    }
+    free(newcache);
+}
+
+int compile_and_run(int argc, char **argv)
+{
+    parse_arguments(argc, argv);
+
+    struct CompileState compst = { .stdlib_path = stdlib_path };
+    if (server_cache.files.len > 0) {
+        find_reusable_files();
+        compst.reuse_from = &server_cache;
+    }
+
+    if (command_line_args.verbosity >= 2) {
+        printf("Target triple: %s\n", get_target()->triple);
+        printf("Data layout: %s\n", get_target()->data_layout);
+    }
+
+    if (command_line_args.tokenize_only || command_line_args.parse_only) {
+        size_t len;
+        char *data = read_the_file(command_line_args.infile, NULL, &len);
+        if (command_line_args.tokenize_only) {
+            Token *tokens = tokenize(data, len, command_line_args.infile);
+            print_tokens(tokens);
+            free_tokens(tokens);
+        } else {
+            TokenStream *tokens = open_token_stream(data, len, command_line_args.infile);
+            Arena arena = {0};
+            AstToplevelNode *ast = parse(tokens, compst.stdlib_path, &arena);
+            close_token_stream(tokens);
+            print_ast(ast);
+            free_arena(&arena);
+        }
+        free(data);
+        return 0;
+    }
+
+    // The JIT compiles all files in one thread, so -j N means that we link an executable.
+    bool jit = !command_line_args.outfile && !command_line_args.no_jit && command_line_args.njobs == 1 && prepare_jit();
+
+    /*
+    With -vv, we want to see all compilation steps, so the cache is not used.
+    With --whole-program, we need the LLVM IR of every file.
+    */
+    bool use_cache = command_line_args.verbosity < 2 && !command_line_args.whole_program;
+    compst.use_interfaces = use_cache;
+
+    parse_all_files(&compst);
+    typecheck_all_files(&compst);
+    notify_compile_server();
+
+    uint64_t *cache_keys = calloc(sizeof cache_keys[0], compst.files.len);
+    if (use_cache) {
+        bool all_cached = true;
+        for (int i = 0; i < compst.files.len; i++) {
+            struct FileState *fs = &compst.files.ptr[i];
+            if (!fs->iface && !fs->typechecked)
+                write_interface_file(fs->path, fs->ast, &fs->types);
+            cache_keys[i] = get_object_cache_key(fs->path, &fs->types);
+            all_cached = all_cached && object_file_is_cached(fs->path, cache_keys[i]);
+        }
+        // Linking is faster than compiling everything again with the JIT.
+        if (all_cached)
+            jit = false;
+    }
 
-    char **objpaths = calloc(sizeof objpaths[0], compst.files.len + 1);
     for (struct FileState *fs = compst.files.ptr; fs < End(compst.files); fs++) {
-        compile_ast_to_llvm(fs);
-        objpaths[fs - compst.files.ptr] = compile_to_object_file(fs->module);
+        if (use_cache && !jit) {
+            uint64_t key = cache_keys[fs - compst.files.ptr];
+            if ((fs->objpath = use_cached_object_file(fs->path, key)))
+                continue;
+            fs->cache_entry = create_object_cache_entry(fs->path, key);
+        }
+        if (fs->only_imports) {
+            // The JIT needs the file after all, or the cached object file disappeared after type-checking.
+            parse_instead_of_interface(&compst, fs);
+            typecheck_stage3(fs);
+        }
+        record_warnings(fs->cache_entry);
+        build_and_simplify_cfg(fs);
+        record_warnings(NULL);
+    }
+    free(cache_keys);
+
+    LLVMContextRef jit_context = NULL;
+    LLVMModuleRef jit_module = NULL;
+    char **objpaths = calloc(sizeof objpaths[0], compst.files.len + 1);
+    if (jit) {
+        // The JIT always compiles the whole program at once, even without --whole-program.
+        jit_context = LLVMContextCreate();
+        jit_module = link_whole_program(&compst, jit_context);
+        optimize_and_print(jit_module, NULL);
+    } else if (command_line_args.whole_program) {
+        objpaths[0] = compile_whole_program_to_object_file(&compst);
+    } else {
+        // With -vv, each file prints its LLVM IR, and they must not get mixed up.
+        int njobs = command_line_args.verbosity >= 2 ? 1 : command_line_args.njobs;
+        run_in_parallel(njobs, compst.files.len, compile_cfg_to_object_file, &compst);
+        for (int i = 0; i < compst.files.len; i++)
+            objpaths[i] = compst.files.ptr[i].objpath;
     }
 
     for (struct FileState *fs = compst.files.ptr; fs < End(compst.files); fs++) {
-        LLVMDisposeModule(fs->module);
-        free_ast(fs->ast);
+        free_arena(&fs->ast_arena);
         fs->ast = NULL;
         free(fs->path);
         free_file_types(&fs->types);
+        free_interface(fs->iface);
+        for (int i = 0; i < 3; i++)
+            hashtable_free(&fs->toplevel_names[i]);
     }
     free(compst.files.ptr);
-    free(stdlib);
+    hashtable_free(&compst.file_indexes);
+
+    if (jit) {
+        free(objpaths);
+        int ret = run_with_jit(jit_module);
+        LLVMContextDispose(jit_context);
+        return ret;
+    }
 
     char *exepath;
     if (command_line_args.outfile)
@@ -512,7 +1273,10 @@ int main(int argc, char **argv)
     else
         exepath = get_default_exe_path();
 
+    struct PhaseTimer t = start_phase();
     run_linker((const char *const*)objpaths, exepath);
+    end_phase(t, NULL, PHASE_LINK);
+    print_time_report();
     for (int i = 0; objpaths[i]; i++)
         free(objpaths[i]);
     free(objpaths);
@@ -528,3 +1292,32 @@ int main(int argc, char **argv)
 
     return ret;
 }
+
+int main(int argc, char **argv)
+{
+    init_target();
+    init_types();
+    stdlib_path = find_stdlib();
+
+#ifndef _WIN32
+    if (argc == 3 && !strcmp(argv[1], "--server"))
+        run_compile_server(argv[0], argv[2]);
+#endif
+
+    for (int i = 1; i < argc; i++) {
+        // Skip the values of options that take a value, such as --linker-flags "..."
+        if (!strcmp(argv[i], "--linker-flags") || !strcmp(argv[i], "-j") || !strcmp(argv[i], "-o")) {
+            i++;
+            continue;
+        }
+        if (!strcmp(argv[i], "--batch") || !strcmp(argv[i], "--batch-from")) {
+            int ret = run_batch(argc, argv, i);
+            free(stdlib_path);
+            return ret;
+        }
+    }
+
+    int ret = compile_and_run(argc, argv);
+    free(stdlib_path);
+    return ret;
+}
@@ -2,8 +2,13 @@
     #include <direct.h>
     #define jou_mkdir(x) _mkdir((x))
 #else
+    #define _POSIX_C_SOURCE 200809L
     #define jou_mkdir(x) mkdir((x), 0777)  // this is what mkdir in bash does according to strace
+    #include <signal.h>
+    #include <spawn.h>
+    #include <sys/wait.h>
     #include "../config.h"  // specifies path where clang is installed
+    extern char **environ;
 #endif
 
 #include "jou_compiler.h"
@@ -53,6 +58,8 @@ static char *get_filename_without_suffix(const char *path)
     return result;
 }
 
+#ifdef _WIN32
+
 void run_linker(const char *const *objpaths, const char *exepath)
 {
     char *jou_exe = find_current_executable();
@@ -70,17 +77,10 @@ void run_linker(const char *const *objpaths, const char *exepath)
     }
     Append(&quoted_object_files, '\0');
 
-    char *command;
-#ifdef _WIN32
     // Assume mingw with clang has been downloaded with windows_setup.sh.
     // Could also use clang, but gcc has less dependencies so we can make the Windows zips smaller.
     // Windows quoting is weird. The outermost quotes get stripped here.
-    command = malloc_sprintf("\"\"%s\\mingw64\\bin\\gcc.exe\" %s -o \"%s\" %s\"", instdir, quoted_object_files.ptr, exepath, linker_flags);
-#else
-    // Assume clang is installed and use it to link. Could use lld, but clang is needed anyway.
-    (void)instdir;
-    command = malloc_sprintf("'%s' %s -o '%s' %s", JOU_CLANG_PATH, quoted_object_files.ptr, exepath, linker_flags);
-#endif
+    char *command = malloc_sprintf("\"\"%s\\mingw64\\bin\\gcc.exe\" %s -o \"%s\" %s\"", instdir, quoted_object_files.ptr, exepath, linker_flags);
     free(quoted_object_files.ptr);
     free(jou_exe);
     free(linker_flags);
@@ -95,6 +95,130 @@ void run_linker(const char *const *objpaths, const char *exepath)
     free(command);
 }
 
+int run_exe(const char *exepath)
+{
+    char *command = malloc(strlen(exepath) + 50);
+    sprintf(command, "\"%s\"", exepath);
+    char *p;
+    while ((p = strchr(command, '/')))
+        *p = '\\';
+
+    // Make sure that everything else shows up before the user's prints.
+    fflush(stdout);
+    fflush(stderr);
+
+    int ret = system(command);
+    free(command);
+    return !!ret;
+}
+
+#else  // _WIN32
+
+/*
+Runs a program directly, without going through a shell, and waits for it
+to finish. Returns the exit code, or 1 if the program crashed.
+*/
+static int run_program(const char *const *argv)
+{
+    // Make sure that everything else shows up before the program's prints.
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, argv[0], NULL, NULL, (char *const *)argv, environ);
+    if (err) {
+        fprintf(stderr, "%s: cannot run \"%s\": %s\n", command_line_args.argv0, argv[0], strerror(err));
+        return 1;
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "%s: waitpid() failed: %s\n", command_line_args.argv0, strerror(errno));
+            return 1;
+        }
+    }
+
+    if (WIFSIGNALED(status)) {
+        // The shell used to print this when we ran programs with system().
+        fprintf(stderr, "%s\n", strsignal(WTERMSIG(status)));
+        return 1;
+    }
+    return WEXITSTATUS(status);
+}
+
+typedef List(const char *) ArgList;
+
+/*
+Splits --linker-flags into arguments like a shell would, but only
+understands spaces, 'single quotes' and "double quotes".
+*/
+static void append_linker_flags(ArgList *args, const char *flags)
+{
+    const char *p = flags;
+    while (true) {
+        p += strspn(p, " \t\n");
+        if (!*p)
+            break;
+
+        List(char) arg = {0};
+        while (*p && !strchr(" \t\n", *p)) {
+            if (*p == '\'' || *p == '"') {
+                char quote = *p++;
+                while (*p && *p != quote)
+                    Append(&arg, *p++);
+                if (*p)
+                    p++;
+            } else {
+                Append(&arg, *p++);
+            }
+        }
+        Append(&arg, '\0');
+        Append(args, arg.ptr);
+    }
+}
+
+void run_linker(const char *const *objpaths, const char *exepath)
+{
+    // Assume clang is installed and use it to link. Could use lld, but clang is needed anyway.
+    ArgList args = {0};
+    Append(&args, JOU_CLANG_PATH);
+    for (int i = 0; objpaths[i]; i++)
+        Append(&args, objpaths[i]);
+    Append(&args, "-o");
+    Append(&args, exepath);
+    Append(&args, "-lm");
+    int first_flag = args.len;
+    if (command_line_args.linker_flags)
+        append_linker_flags(&args, command_line_args.linker_flags);
+    int end_of_flags = args.len;
+    Append(&args, NULL);
+
+    if (command_line_args.verbosity >= 2) {
+        printf("Running linker:");
+        for (const char **arg = args.ptr; *arg; arg++)
+            printf(" '%s'", *arg);
+        printf("\n");
+    } else if (command_line_args.verbosity >= 1) {
+        printf("Running linker\n");
+    }
+
+    int ret = run_program(args.ptr);
+    for (int i = first_flag; i < end_of_flags; i++)
+        free((char *)args.ptr[i]);
+    free(args.ptr);
+    if (ret)
+        exit(1);
+}
+
+int run_exe(const char *exepath)
+{
+    const char *argv[] = { exepath, NULL };
+    return !!run_program(argv);
+}
+
+#endif  // _WIN32
+
 static void mkdir_exist_ok(const char *p)
 {
     if (jou_mkdir(p) == 0 || errno == EEXIST)
@@ -140,9 +264,9 @@ char *get_default_exe_path(void)
     return path;
 }
 
-char *compile_to_object_file(LLVMModuleRef module)
+char *get_object_file_path(const char *sourcepath)
 {
-    char *objname = get_filename_without_suffix(LLVMGetSourceFileName(module, (size_t[]){0}));
+    char *objname = get_filename_without_suffix(sourcepath);
     objname = realloc(objname, strlen(objname) + 10);
 #ifdef _WIN32
     strcat(objname, ".obj");
@@ -152,39 +276,21 @@ char *compile_to_object_file(LLVMModuleRef module)
 
     char *path = get_path_to_file_in_jou_compiled(objname);
     free(objname);
+    return path;
+}
 
+void compile_to_object_file(LLVMModuleRef module, LLVMTargetMachineRef target_machine, const char *path)
+{
     if (command_line_args.verbosity >= 1)
         printf("Emitting object file: %s\n", path);
 
     char *tmppath = strdup(path);
     char *error = NULL;
-    if (LLVMTargetMachineEmitToFile(get_target()->target_machine_ref, module, tmppath, LLVMObjectFile, &error)) {
+    if (LLVMTargetMachineEmitToFile(target_machine, module, tmppath, LLVMObjectFile, &error)) {
         assert(error);
         fprintf(stderr, "failed to emit object file \"%s\": %s\n", path, error);
         exit(1);
     }
     free(tmppath);
     assert(!error);
-    return path;
-}
-
-int run_exe(const char *exepath)
-{
-    char *command = malloc(strlen(exepath) + 50);
-#ifdef _WIN32
-    sprintf(command, "\"%s\"", exepath);
-    char *p;
-    while ((p = strchr(command, '/')))
-        *p = '\\';
-#else
-    sprintf(command, "'%s'", exepath);
-#endif
-
-    // Make sure that everything else shows up before the user's prints.
-    fflush(stdout);
-    fflush(stderr);
-
-    int ret = system(command);
-    free(command);
-    return !!ret;
 }
@@ -8,10 +8,42 @@
 #include <stdio.h>
 #include <string.h>
 
-static AstExpression parse_expression(const Token **tokens);
+struct State {
+    TokenStream *tokens;
+    Arena *arena;  // all memory of the AST comes from here
+};
 
-static noreturn void fail_with_parse_error(const Token *token, const char *what_was_expected_instead)
+static AstExpression parse_expression(struct State *st);
+
+// Moves the memory of a List to the arena, so that the List doesn't need to be freed.
+static void *move_to_arena(struct State *st, void *ptr, size_t size)
 {
+    void *result = arena_dup(st->arena, ptr, size);
+    free(ptr);
+    return result;
+}
+
+/*
+A parse error is shown only after tokenizing the rest of the file, so that
+tokenizer errors (e.g. a '(' without a matching ')') win, just like when the
+whole file was tokenized before parsing.
+*/
+static noreturn void fail(struct State *st, Location location, const char *fmt, ...)
+{
+    char msg[1000];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof msg, fmt, ap);
+    va_end(ap);
+
+    while (next_token(st->tokens).type != TOKEN_END_OF_FILE)
+        ;
+    fail_with_error(location, "%s", msg);
+}
+
+static noreturn void fail_with_parse_error(struct State *st, const char *what_was_expected_instead)
+{
+    const Token *token = peek_token(st->tokens, 0);
     char got[200];
     switch(token->type) {
         case TOKEN_INT: strcpy(got, "an integer"); break;
@@ -20,64 +52,82 @@ static noreturn void fail_with_parse_error(const Token *token, const char *what_
         case TOKEN_DOUBLE: strcpy(got, "a double constant"); break;
         case TOKEN_CHAR: strcpy(got, "a character"); break;
         case TOKEN_STRING: strcpy(got, "a string"); break;
-        case TOKEN_OPERATOR: snprintf(got, sizeof got, "'%s'", token->data.operator); break;
-        case TOKEN_NAME: snprintf(got, sizeof got, "a variable name '%s'", token->data.name); break;
+        case TOKEN_OPERATOR: snprintf(got, sizeof got, "'%s'", token_text(token)); break;
+        case TOKEN_NAME: snprintf(got, sizeof got, "a variable name '%s'", token_text(token)); break;
         case TOKEN_NEWLINE: strcpy(got, "end of line"); break;
         case TOKEN_END_OF_FILE: strcpy(got, "end of file"); break;
         case TOKEN_INDENT: strcpy(got, "more indentation"); break;
         case TOKEN_DEDENT: strcpy(got, "less indentation"); break;
-        case TOKEN_KEYWORD: snprintf(got, sizeof got, "the '%s' keyword", token->data.name); break;
+        case TOKEN_KEYWORD: snprintf(got, sizeof got, "the '%s' keyword", token_text(token)); break;
     }
-    fail_with_error(token->location, "expected %s, got %s", what_was_expected_instead, got);
+    fail(st, token_location(token), "expected %s, got %s", what_was_expected_instead, got);
+}
+
+// The tokenizer makes sure that names and numbers fit.
+// Returns an interned string, see intern_string()
+static const char *token_name(const Token *t)
+{
+    // Keyword names (e.g. "int" in a type) are string literals, not interned.
+    if (t->type == TOKEN_KEYWORD)
+        return get_interned_string(intern_string(token_text(t)));
+    return token_text(t);
 }
 
-static bool is_keyword(const Token *t, const char *kw)
+static bool is_keyword(const Token *t, enum Keyword kw)
 {
-    return t->type == TOKEN_KEYWORD && !strcmp(t->data.name, kw);
+    return t->type == TOKEN_KEYWORD && t->data.keyword == kw;
 }
 
-static bool is_operator(const Token *t, const char *op)
+static bool is_operator(const Token *t, enum Operator op)
 {
-    return t->type == TOKEN_OPERATOR && !strcmp(t->data.operator, op);
+    return t->type == TOKEN_OPERATOR && t->data.operator == op;
 }
 
-static AstType parse_type(const Token **tokens)
+// Operators such as '(' or ']' have only one byte.
+static bool is_paren(const Token *t, char paren)
 {
-    AstType result = { .kind = AST_TYPE_NAMED, .location = (*tokens)->location };
+    return t->type == TOKEN_OPERATOR && token_text(t)[0] == paren && token_text(t)[1] == '\0';
+}
 
-    if (!is_keyword(*tokens, "void")
-        && !is_keyword(*tokens, "int")
-        && !is_keyword(*tokens, "long")
-        && !is_keyword(*tokens, "byte")
-        && !is_keyword(*tokens, "float")
-        && !is_keyword(*tokens, "double")
-        && !is_keyword(*tokens, "bool")
-        && (*tokens)->type != TOKEN_NAME)
+static AstType parse_type(struct State *st)
+{
+    AstType result = { .kind = AST_TYPE_NAMED, .location = token_location(peek_token(st->tokens, 0)) };
+
+    if (!is_keyword(peek_token(st->tokens, 0), KEYWORD_VOID)
+        && !is_keyword(peek_token(st->tokens, 0), KEYWORD_INT)
+        && !is_keyword(peek_token(st->tokens, 0), KEYWORD_LONG)
+        && !is_keyword(peek_token(st->tokens, 0), KEYWORD_BYTE)
+        && !is_keyword(peek_token(st->tokens, 0), KEYWORD_FLOAT)
+        && !is_keyword(peek_token(st->tokens, 0), KEYWORD_DOUBLE)
+        && !is_keyword(peek_token(st->tokens, 0), KEYWORD_BOOL)
+        && peek_token(st->tokens, 0)->type != TOKEN_NAME)
     {
-        fail_with_parse_error(*tokens, "a type");
+        fail_with_parse_error(st, "a type");
     }
-    safe_strcpy(result.data.name, (*tokens)->data.name);
-    ++*tokens;
+    result.data.name = token_name(peek_token(st->tokens, 0));
+    next_token(st->tokens);
 
-    while(is_operator(*tokens, "*") || is_operator(*tokens, "[")) {
-        AstType *p = malloc(sizeof(*p));
+    while(is_operator(peek_token(st->tokens, 0), OPERATOR_STAR) || is_operator(peek_token(st->tokens, 0), OPERATOR_LBRACKET)) {
+        AstType *p = arena_alloc(st->arena, sizeof(*p));
         *p = result;
 
-        if (is_operator(*tokens, "*")) {
+        Location location = token_location(peek_token(st->tokens, 0));
+        if (is_operator(peek_token(st->tokens, 0), OPERATOR_STAR)) {
+            next_token(st->tokens);
             result = (AstType){
-                .location = (*tokens)++->location,
+                .location = location,
                 .kind = AST_TYPE_POINTER,
                 .data.valuetype = p,
             };
         } else {
-            Location location = (*tokens)++->location;
+            next_token(st->tokens);
 
-            AstExpression *len = malloc(sizeof(*len));
-            *len = parse_expression(tokens);
+            AstExpression *len = arena_alloc(st->arena, sizeof(*len));
+            *len = parse_expression(st);
 
-            if (!is_operator(*tokens, "]"))
-                fail_with_parse_error(*tokens, "a ']' to end the array size");
-            ++*tokens;
+            if (!is_operator(peek_token(st->tokens, 0), OPERATOR_RBRACKET))
+                fail_with_parse_error(st, "a ']' to end the array size");
+            next_token(st->tokens);
 
             result = (AstType){
                 .location = location,
@@ -92,27 +142,27 @@ static AstType parse_type(const Token **tokens)
 
 // name: type = value
 // The value is optional, and will be NULL if missing.
-static AstNameTypeValue parse_name_type_value(const Token **tokens, const char *expected_what_for_name)
+static AstNameTypeValue parse_name_type_value(struct State *st, const char *expected_what_for_name)
 {
     AstNameTypeValue result;
 
-    if ((*tokens)->type != TOKEN_NAME) {
+    if (peek_token(st->tokens, 0)->type != TOKEN_NAME) {
         assert(expected_what_for_name);
-        fail_with_parse_error(*tokens, expected_what_for_name);
+        fail_with_parse_error(st, expected_what_for_name);
     }
-    safe_strcpy(result.name, (*tokens)->data.name);
-    result.name_location = (*tokens)->location;
-    ++*tokens;
-
-    if (!is_operator(*tokens, ":"))
-        fail_with_parse_error(*tokens, "':' and a type after it (example: \"foo: int\")");
-    ++*tokens;
-    result.type = parse_type(tokens);
-
-    if (is_operator(*tokens, "=")) {
-        ++*tokens;
-        AstExpression *p = malloc(sizeof *p);
-        *p = parse_expression(tokens);
+    result.name = token_name(peek_token(st->tokens, 0));
+    result.name_location = token_location(peek_token(st->tokens, 0));
+    next_token(st->tokens);
+
+    if (!is_operator(peek_token(st->tokens, 0), OPERATOR_COLON))
+        fail_with_parse_error(st, "':' and a type after it (example: \"foo: int\")");
+    next_token(st->tokens);
+    result.type = parse_type(st);
+
+    if (is_operator(peek_token(st->tokens, 0), OPERATOR_ASSIGN)) {
+        next_token(st->tokens);
+        AstExpression *p = arena_alloc(st->arena, sizeof *p);
+        *p = parse_expression(st);
         result.value = p;
     } else {
         result.value = NULL;
@@ -121,196 +171,198 @@ static AstNameTypeValue parse_name_type_value(const Token **tokens, const char *
     return result;
 }
 
-static AstSignature parse_function_signature(const Token **tokens, bool accept_self)
+static AstSignature parse_function_signature(struct State *st, bool accept_self)
 {
     AstSignature result = {0};
 
-    if ((*tokens)->type != TOKEN_NAME)
-        fail_with_parse_error(*tokens, "a function name");
-    result.name_location = (*tokens)->location;
-    safe_strcpy(result.name, (*tokens)->data.name);
-    ++*tokens;
+    if (peek_token(st->tokens, 0)->type != TOKEN_NAME)
+        fail_with_parse_error(st, "a function name");
+    result.name_location = token_location(peek_token(st->tokens, 0));
+    result.name = token_name(peek_token(st->tokens, 0));
+    next_token(st->tokens);
 
-    if (!is_operator(*tokens, "("))
-        fail_with_parse_error(*tokens, "a '(' to denote the start of function arguments");
-    ++*tokens;
+    if (!is_operator(peek_token(st->tokens, 0), OPERATOR_LPAREN))
+        fail_with_parse_error(st, "a '(' to denote the start of function arguments");
+    next_token(st->tokens);
 
-    while (!is_operator(*tokens, ")")) {
+    while (!is_operator(peek_token(st->tokens, 0), OPERATOR_RPAREN)) {
         if (result.takes_varargs)
-            fail_with_error((*tokens)->location, "if '...' is used, it must be the last parameter");
+            fail(st, token_location(peek_token(st->tokens, 0)), "if '...' is used, it must be the last parameter");
 
-        if (is_operator(*tokens, "...")) {
+        if (is_operator(peek_token(st->tokens, 0), OPERATOR_ELLIPSIS)) {
             result.takes_varargs = true;
-            ++*tokens;
-        } else if (is_keyword(*tokens, "self")) {
+            next_token(st->tokens);
+        } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_SELF)) {
             if (!accept_self)
-                fail_with_error((*tokens)->location, "'self' cannot be used here");
-            AstNameTypeValue self_arg = { .name="self", .name_location=(*tokens)++->location };
+                fail(st, token_location(peek_token(st->tokens, 0)), "'self' cannot be used here");
+            AstNameTypeValue self_arg = {
+                .name = get_interned_string(intern_string("self")),
+                .name_location = token_location(peek_token(st->tokens, 0)),
+                .type.data.name = get_interned_string(intern_string("")),  // not used, the type of self is known
+            };
             Append(&result.args, self_arg);
+            next_token(st->tokens);
         } else {
-            AstNameTypeValue arg = parse_name_type_value(tokens, "an argument name");
+            AstNameTypeValue arg = parse_name_type_value(st, "an argument name");
 
             if (arg.value)
-                fail_with_error(arg.value->location, "arguments cannot have default values");
+                fail(st, arg.value->location, "arguments cannot have default values");
 
             for (const AstNameTypeValue *prevarg = result.args.ptr; prevarg < End(result.args); prevarg++)
                 if (!strcmp(prevarg->name, arg.name))
-                    fail_with_error(arg.name_location, "there are multiple arguments named '%s'", prevarg->name);
+                    fail(st, arg.name_location, "there are multiple arguments named '%s'", prevarg->name);
             Append(&result.args, arg);
         }
 
-        if (is_operator(*tokens, ","))
-            ++*tokens;
+        if (is_operator(peek_token(st->tokens, 0), OPERATOR_COMMA))
+            next_token(st->tokens);
         else
             break;
     }
 
-    if (!is_operator(*tokens, ")"))
-        fail_with_parse_error(*tokens, "a ')'");
-    ++*tokens;
+    if (!is_operator(peek_token(st->tokens, 0), OPERATOR_RPAREN))
+        fail_with_parse_error(st, "a ')'");
+    next_token(st->tokens);
 
-    if (!is_operator(*tokens, "->")) {
+    if (!is_operator(peek_token(st->tokens, 0), OPERATOR_ARROW)) {
         // Special case for common typo:   def foo():
-        if (is_operator(*tokens, ":")) {
-            fail_with_error(
-                (*tokens)->location,
+        if (is_operator(peek_token(st->tokens, 0), OPERATOR_COLON)) {
+            fail(st,
+                token_location(peek_token(st->tokens, 0)),
                 "return type must be specified with '->',"
                 " or with '-> void' if the function doesn't return anything"
             );
         }
-        fail_with_parse_error(*tokens, "a '->'");
+        fail_with_parse_error(st, "a '->'");
     }
-    ++*tokens;
+    next_token(st->tokens);
+
+    result.returntype = parse_type(st);
 
-    result.returntype = parse_type(tokens);
+    result.args.ptr = move_to_arena(st, result.args.ptr, result.args.len * sizeof result.args.ptr[0]);
+    result.args.alloc = result.args.len;
     return result;
 }
 
-static AstCall parse_call(const Token **tokens, char openparen, char closeparen, bool args_are_named)
+static AstCall parse_call(struct State *st, char openparen, char closeparen, bool args_are_named)
 {
     AstCall result = {0};
 
-    assert((*tokens)->type == TOKEN_NAME);  // must be checked when calling this function
-    safe_strcpy(result.calledname, (*tokens)->data.name);
-    ++*tokens;
+    assert(peek_token(st->tokens, 0)->type == TOKEN_NAME);  // must be checked when calling this function
+    result.calledname = token_name(peek_token(st->tokens, 0));
+    next_token(st->tokens);
 
-    if (!is_operator(*tokens, (char[]){openparen,'\0'})) {
+    if (!is_paren(peek_token(st->tokens, 0), openparen)) {
         char msg[100];
         sprintf(msg, "a '%c' to denote the start of arguments", openparen);
-        fail_with_parse_error(*tokens, msg);
+        fail_with_parse_error(st, msg);
     }
-    ++*tokens;
+    next_token(st->tokens);
 
     List(AstExpression) args = {0};
 
-    // char[100] is wrapped in a struct so we can make a list of it.
-    // You can't do List(char[100]) or similar because C doesn't allow assigning arrays.
-    struct Name { char name[100]; };
-    static_assert(sizeof(struct Name) == 100, "u have weird c compiler...");
-    List(struct Name) argnames = {0};
+    List(const char *) argnames = {0};
 
-    while (!is_operator(*tokens, (char[]){closeparen,'\0'})) {
+    while (!is_paren(peek_token(st->tokens, 0), closeparen)) {
         if (args_are_named) {
             // This code is only for structs, because there are no named function arguments.
 
-            if ((*tokens)->type != TOKEN_NAME)
-                fail_with_parse_error((*tokens),"a field name");
+            if (peek_token(st->tokens, 0)->type != TOKEN_NAME)
+                fail_with_parse_error(st, "a field name");
 
-            for (struct Name *oldname = argnames.ptr; oldname < End(argnames); oldname++) {
-                if (!strcmp(oldname->name, (*tokens)->data.name)) {
-                    fail_with_error(
-                        (*tokens)->location, "there are two arguments named '%s'", oldname->name);
+            const char *name = token_name(peek_token(st->tokens, 0));
+            for (const char **oldname = argnames.ptr; oldname < End(argnames); oldname++) {
+                if (*oldname == name) {
+                    fail(st,
+                        token_location(peek_token(st->tokens, 0)), "there are two arguments named '%s'", name);
                 }
             }
 
-            struct Name n;
-            safe_strcpy(n.name,(*tokens)->data.name);
-            Append(&argnames,n);
-            ++*tokens;
+            Append(&argnames, name);
+            next_token(st->tokens);
 
-            if (!is_operator(*tokens, "=")) {
+            if (!is_operator(peek_token(st->tokens, 0), OPERATOR_ASSIGN)) {
                 char msg[300];
-                snprintf(msg, sizeof msg, "'=' followed by a value for field '%s'", n.name);
-                fail_with_parse_error(*tokens, msg);
+                snprintf(msg, sizeof msg, "'=' followed by a value for field '%s'", name);
+                fail_with_parse_error(st, msg);
             }
-            ++*tokens;
+            next_token(st->tokens);
         }
 
-        Append(&args, parse_expression(tokens));
-        if (is_operator(*tokens, ","))
-            ++*tokens;
+        Append(&args, parse_expression(st));
+        if (is_operator(peek_token(st->tokens, 0), OPERATOR_COMMA))
+            next_token(st->tokens);
         else
             break;
     }
 
-    result.args = args.ptr;
-    result.argnames = (char(*)[100])argnames.ptr;  // can be NULL
+    result.args = move_to_arena(st, args.ptr, args.len * sizeof args.ptr[0]);
+    result.argnames = move_to_arena(st, argnames.ptr, argnames.len * sizeof argnames.ptr[0]);  // can be NULL
     result.nargs = args.len;
 
-    if (!is_operator(*tokens, (char[]){closeparen,'\0'})) {
+    if (!is_paren(peek_token(st->tokens, 0), closeparen)) {
         char msg[100];
         sprintf(msg, "a '%c'", closeparen);
-        fail_with_parse_error(*tokens, "a ')'");
+        fail_with_parse_error(st, "a ')'");
     }
-    ++*tokens;
+    next_token(st->tokens);
 
     return result;
 }
 
 // arity = number of operands, e.g. 2 for a binary operator such as "+"
-static AstExpression build_operator_expression(const Token *t, int arity, const AstExpression *operands)
+static AstExpression build_operator_expression(struct State *st, const Token *t, int arity, const AstExpression *operands)
 {
     assert(arity==1 || arity==2);
     size_t nbytes = arity * sizeof operands[0];
-    AstExpression *ptr = malloc(nbytes);
-    memcpy(ptr, operands, nbytes);
+    AstExpression *ptr = arena_dup(st->arena, operands, nbytes);
 
-    AstExpression result = { .location = t->location, .data.operands = ptr };
+    AstExpression result = { .location = token_location(t), .data.operands = ptr };
 
-    if (is_operator(t, "&")) {
+    if (is_operator(t, OPERATOR_AMPERSAND)) {
         assert(arity == 1);
         result.kind = AST_EXPR_ADDRESS_OF;
-    } else if (is_operator(t, "[")) {
+    } else if (is_operator(t, OPERATOR_LBRACKET)) {
         assert(arity == 2);
         result.kind = AST_EXPR_INDEXING;
-    } else if (is_operator(t, "==")) {
+    } else if (is_operator(t, OPERATOR_EQ)) {
         assert(arity == 2);
         result.kind = AST_EXPR_EQ;
-    } else if (is_operator(t, "!=")) {
+    } else if (is_operator(t, OPERATOR_NE)) {
         assert(arity == 2);
         result.kind = AST_EXPR_NE;
-    } else if (is_operator(t, ">")) {
+    } else if (is_operator(t, OPERATOR_GT)) {
         assert(arity == 2);
         result.kind = AST_EXPR_GT;
-    } else if (is_operator(t, ">=")) {
+    } else if (is_operator(t, OPERATOR_GE)) {
         assert(arity == 2);
         result.kind = AST_EXPR_GE;
-    } else if (is_operator(t, "<")) {
+    } else if (is_operator(t, OPERATOR_LT)) {
         assert(arity == 2);
         result.kind = AST_EXPR_LT;
-    } else if (is_operator(t, "<=")) {
+    } else if (is_operator(t, OPERATOR_LE)) {
         assert(arity == 2);
         result.kind = AST_EXPR_LE;
-    } else if (is_operator(t, "+")) {
+    } else if (is_operator(t, OPERATOR_ADD)) {
         assert(arity == 2);
         result.kind = AST_EXPR_ADD;
-    } else if (is_operator(t, "-")) {
+    } else if (is_operator(t, OPERATOR_SUB)) {
         result.kind = arity==2 ? AST_EXPR_SUB : AST_EXPR_NEG;
-    } else if (is_operator(t, "*")) {
+    } else if (is_operator(t, OPERATOR_STAR)) {
         result.kind = arity==2 ? AST_EXPR_MUL : AST_EXPR_DEREFERENCE;
-    } else if (is_operator(t, "/")) {
+    } else if (is_operator(t, OPERATOR_DIV)) {
         assert(arity == 2);
         result.kind = AST_EXPR_DIV;
-    } else if (is_operator(t, "%")) {
+    } else if (is_operator(t, OPERATOR_MOD)) {
         assert(arity == 2);
         result.kind = AST_EXPR_MOD;
-    } else if (is_keyword(t, "and")) {
+    } else if (is_keyword(t, KEYWORD_AND)) {
         assert(arity == 2);
         result.kind = AST_EXPR_AND;
-    } else if (is_keyword(t, "or")) {
+    } else if (is_keyword(t, KEYWORD_OR)) {
         assert(arity == 2);
         result.kind = AST_EXPR_OR;
-    } else if (is_keyword(t, "not")) {
+    } else if (is_keyword(t, KEYWORD_NOT)) {
         assert(arity == 1);
         result.kind = AST_EXPR_NOT;
     } else {
@@ -322,116 +374,121 @@ static AstExpression build_operator_expression(const Token *t, int arity, const
 
 // If tokens is e.g. [1, '+', 2], this will be used to parse the ['+', 2] part.
 // Callback function cb defines how to parse the expression following the operator token.
-static void add_to_binop(const Token **tokens, AstExpression *result, AstExpression (*cb)(const Token**))
+static void add_to_binop(struct State *st, AstExpression *result, AstExpression (*cb)(struct State*))
 {
-    const Token *t = (*tokens)++;
-    AstExpression rhs = cb(tokens);
-    *result = build_operator_expression(t, 2, (AstExpression[]){*result, rhs});
+    Token t = next_token(st->tokens);
+    AstExpression rhs = cb(st);
+    *result = build_operator_expression(st, &t, 2, (AstExpression[]){*result, rhs});
 }
 
-static AstExpression parse_array(const Token **tokens)
+static AstExpression parse_array(struct State *st)
 {
-    const Token *openbracket = *tokens;
-    assert(is_operator(openbracket, "["));
-    ++*tokens;
+    Location location = token_location(peek_token(st->tokens, 0));
+    assert(is_operator(peek_token(st->tokens, 0), OPERATOR_LBRACKET));
+    next_token(st->tokens);
 
     List(AstExpression) items = {0};
     do {
-        Append(&items, parse_expression(tokens));
-    } while (is_operator(*tokens, ",") && !is_operator(++*tokens, "]"));
+        Append(&items, parse_expression(st));
+        if (!is_operator(peek_token(st->tokens, 0), OPERATOR_COMMA))
+            break;
+        next_token(st->tokens);
+    } while (!is_operator(peek_token(st->tokens, 0), OPERATOR_RBRACKET));
 
-    if (!is_operator(*tokens, "]"))
-        fail_with_parse_error(*tokens, "a ']' to end the array");
-    ++*tokens;
+    if (!is_operator(peek_token(st->tokens, 0), OPERATOR_RBRACKET))
+        fail_with_parse_error(st, "a ']' to end the array");
+    next_token(st->tokens);
 
     return (AstExpression){
         .kind=AST_EXPR_ARRAY,
-        .location = openbracket->location,
-        .data.array = {.count=items.len, .items=items.ptr},
+        .location = location,
+        .data.array = {.count=items.len, .items=move_to_arena(st, items.ptr, items.len * sizeof items.ptr[0])},
     };
 }
 
-static AstExpression parse_elementary_expression(const Token **tokens)
+static AstExpression parse_elementary_expression(struct State *st)
 {
-    AstExpression expr = { .location = (*tokens)->location };
+    AstExpression expr = { .location = token_location(peek_token(st->tokens, 0)) };
 
-    switch((*tokens)->type) {
+    switch(peek_token(st->tokens, 0)->type) {
     case TOKEN_OPERATOR:
-        if (is_operator(*tokens, "[")) {
-            expr = parse_array(tokens);
-        } else if (is_operator(*tokens, "(")) {
-            ++*tokens;
-            expr = parse_expression(tokens);
-            if (!is_operator(*tokens, ")"))
-                fail_with_parse_error(*tokens, "a ')'");
-            ++*tokens;
+        if (is_operator(peek_token(st->tokens, 0), OPERATOR_LBRACKET)) {
+            expr = parse_array(st);
+        } else if (is_operator(peek_token(st->tokens, 0), OPERATOR_LPAREN)) {
+            next_token(st->tokens);
+            expr = parse_expression(st);
+            if (!is_operator(peek_token(st->tokens, 0), OPERATOR_RPAREN))
+                fail_with_parse_error(st, "a ')'");
+            next_token(st->tokens);
         } else {
             goto not_an_expression;
         }
         break;
     case TOKEN_INT:
         expr.kind = AST_EXPR_CONSTANT;
-        expr.data.constant = int_constant(intType, (*tokens)->data.int_value);
-        ++*tokens;
+        expr.data.constant = int_constant(intType, peek_token(st->tokens, 0)->data.int_value);
+        next_token(st->tokens);
         break;
     case TOKEN_LONG:
         expr.kind = AST_EXPR_CONSTANT;
-        expr.data.constant = int_constant(longType, (*tokens)->data.long_value);
-        ++*tokens;
+        expr.data.constant = int_constant(longType, strtoll(token_text(peek_token(st->tokens, 0)), NULL, 10));
+        next_token(st->tokens);
         break;
     case TOKEN_CHAR:
         expr.kind = AST_EXPR_CONSTANT;
-        expr.data.constant = int_constant(byteType, (*tokens)->data.char_value);
-        ++*tokens;
+        expr.data.constant = int_constant(byteType, peek_token(st->tokens, 0)->data.char_value);
+        next_token(st->tokens);
         break;
     case TOKEN_FLOAT:
         expr.kind = AST_EXPR_CONSTANT;
         expr.data.constant = (Constant){ .kind=CONSTANT_FLOAT };
-        safe_strcpy(expr.data.constant.data.double_or_float_text, (*tokens)->data.name);
-        ++*tokens;
+        expr.data.constant.data.double_or_float_text = token_name(peek_token(st->tokens, 0));
+        next_token(st->tokens);
         break;
     case TOKEN_DOUBLE:
         expr.kind = AST_EXPR_CONSTANT;
         expr.data.constant = (Constant){ .kind=CONSTANT_DOUBLE };
-        safe_strcpy(expr.data.constant.data.double_or_float_text, (*tokens)->data.name);
-        ++*tokens;
+        expr.data.constant.data.double_or_float_text = token_name(peek_token(st->tokens, 0));
+        next_token(st->tokens);
         break;
     case TOKEN_STRING:
         expr.kind = AST_EXPR_CONSTANT;
-        expr.data.constant = (Constant){ CONSTANT_STRING, {.str=strdup((*tokens)->data.string_value)} };
-        ++*tokens;
+        expr.data.constant = (Constant){ CONSTANT_STRING, {.str=arena_strdup(st->arena, token_text(peek_token(st->tokens, 0)))} };
+        next_token(st->tokens);
         break;
     case TOKEN_NAME:
-        if (is_operator(&(*tokens)[1], "(")) {
+        if (is_operator(peek_token(st->tokens, 1), OPERATOR_LPAREN)) {
             expr.kind = AST_EXPR_FUNCTION_CALL;
-            expr.data.call = parse_call(tokens, '(', ')', false);
-        } else if (is_operator(&(*tokens)[1], "{")) {
+            expr.data.call = parse_call(st, '(', ')', false);
+        } else if (is_operator(peek_token(st->tokens, 1), OPERATOR_LBRACE)) {
             expr.kind = AST_EXPR_BRACE_INIT;
-            expr.data.call = parse_call(tokens, '{', '}', true);
-        } else if (is_operator(&(*tokens)[1], "::") && (*tokens)[2].type == TOKEN_NAME) {
+            expr.data.call = parse_call(st, '{', '}', true);
+        } else if (is_operator(peek_token(st->tokens, 1), OPERATOR_DOUBLE_COLON) && peek_token(st->tokens, 2)->type == TOKEN_NAME) {
             expr.kind = AST_EXPR_GET_ENUM_MEMBER;
-            safe_strcpy(expr.data.enummember.enumname, (*tokens)[0].data.name);
-            safe_strcpy(expr.data.enummember.membername, (*tokens)[2].data.name);
-            *tokens += 3;
+            expr.data.enummember.enumname = token_name(peek_token(st->tokens, 0));
+            expr.data.enummember.membername = token_name(peek_token(st->tokens, 2));
+            next_token(st->tokens);
+            next_token(st->tokens);
+            next_token(st->tokens);
         } else {
             expr.kind = AST_EXPR_GET_VARIABLE;
-            safe_strcpy(expr.data.varname, (*tokens)->data.name);
-            ++*tokens;
+            expr.data.varname = token_name(peek_token(st->tokens, 0));
+            next_token(st->tokens);
         }
         break;
     case TOKEN_KEYWORD:
-        if (is_keyword(*tokens, "True") || is_keyword(*tokens, "False")) {
+        if (is_keyword(peek_token(st->tokens, 0), KEYWORD_TRUE) || is_keyword(peek_token(st->tokens, 0), KEYWORD_FALSE)) {
             expr.kind = AST_EXPR_CONSTANT;
-            expr.data.constant = (Constant){ CONSTANT_BOOL, {.boolean=is_keyword(*tokens, "True")} };
-            ++*tokens;
-        } else if (is_keyword(*tokens, "NULL")) {
+            expr.data.constant = (Constant){ CONSTANT_BOOL, {.boolean=is_keyword(peek_token(st->tokens, 0), KEYWORD_TRUE)} };
+            next_token(st->tokens);
+        } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_NULL)) {
             expr.kind = AST_EXPR_CONSTANT;
             expr.data.constant = (Constant){ CONSTANT_NULL, {{0}} };
-            ++*tokens;
-        } else if (is_keyword(*tokens, "self")) {
+            next_token(st->tokens);
+        } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_SELF)) {
             expr.kind = AST_EXPR_GET_VARIABLE;
-            strcpy(expr.data.varname, "self");
-            ++*tokens;
+            expr.data.varname = get_interned_string(intern_string("self"));
+            next_token(st->tokens);
         } else {
             goto not_an_expression;
         }
@@ -442,31 +499,31 @@ static AstExpression parse_elementary_expression(const Token **tokens)
     return expr;
 
 not_an_expression:
-    fail_with_parse_error(*tokens, "an expression");
+    fail_with_parse_error(st, "an expression");
 }
 
-static AstExpression parse_expression_with_fields_and_methods_and_indexing(const Token **tokens)
+static AstExpression parse_expression_with_fields_and_methods_and_indexing(struct State *st)
 {
-    AstExpression result = parse_elementary_expression(tokens);
-    while (is_operator(*tokens, ".") || is_operator(*tokens, "->") || is_operator(*tokens, "["))
+    AstExpression result = parse_elementary_expression(st);
+    while (is_operator(peek_token(st->tokens, 0), OPERATOR_DOT) || is_operator(peek_token(st->tokens, 0), OPERATOR_ARROW) || is_operator(peek_token(st->tokens, 0), OPERATOR_LBRACKET))
     {
-        if (is_operator(*tokens, "[")) {
-            add_to_binop(tokens, &result, parse_expression);  // eats [ token
-            if (!is_operator(*tokens, "]"))
-                fail_with_parse_error(*tokens, "a ']'");
-            ++*tokens;
+        if (is_operator(peek_token(st->tokens, 0), OPERATOR_LBRACKET)) {
+            add_to_binop(st, &result, parse_expression);  // eats [ token
+            if (!is_operator(peek_token(st->tokens, 0), OPERATOR_RBRACKET))
+                fail_with_parse_error(st, "a ']'");
+            next_token(st->tokens);
         } else {
-            AstExpression *obj = malloc(sizeof *obj);
+            AstExpression *obj = arena_alloc(st->arena, sizeof *obj);
             *obj = result;
             memset(&result, 0, sizeof result);
 
-            const Token *startop = (*tokens)++;
-            if ((*tokens)->type != TOKEN_NAME)
-                fail_with_parse_error(*tokens, "a field or method name");
-            result.location = (*tokens)->location;
+            bool is_deref = is_operator(peek_token(st->tokens, 0), OPERATOR_ARROW);
+            next_token(st->tokens);
+            if (peek_token(st->tokens, 0)->type != TOKEN_NAME)
+                fail_with_parse_error(st, "a field or method name");
+            result.location = token_location(peek_token(st->tokens, 0));
 
-            bool is_deref = is_operator(startop, "->");
-            bool is_call = is_operator(&(*tokens)[1], "(");
+            bool is_call = is_operator(peek_token(st->tokens, 1), OPERATOR_LPAREN);
             if (is_deref && is_call) result.kind = AST_EXPR_DEREF_AND_CALL_METHOD;
             if (is_deref && !is_call) result.kind = AST_EXPR_DEREF_AND_GET_FIELD;
             if (!is_deref && is_call) result.kind = AST_EXPR_CALL_METHOD;
@@ -474,11 +531,11 @@ static AstExpression parse_expression_with_fields_and_methods_and_indexing(const
 
             if (is_call) {
                 result.data.methodcall.obj = obj;
-                result.data.methodcall.call = parse_call(tokens, '(', ')', false);
+                result.data.methodcall.call = parse_call(st, '(', ')', false);
             } else {
                 result.data.classfield.obj = obj;
-                safe_strcpy(result.data.classfield.fieldname, (*tokens)->data.name);
-                ++*tokens;
+                result.data.classfield.fieldname = token_name(peek_token(st->tokens, 0));
+                next_token(st->tokens);
             }
         }
     }
@@ -486,149 +543,157 @@ static AstExpression parse_expression_with_fields_and_methods_and_indexing(const
 }
 
 // Unary operators: foo++, foo--, ++foo, --foo, &foo, *foo, sizeof foo
-static AstExpression parse_expression_with_unary_operators(const Token **tokens)
+static AstExpression parse_expression_with_unary_operators(struct State *st)
 {
-    // sequneces of 0 or more unary operator tokens: start,start+1,...,end-1
-    const Token *prefixstart = *tokens;
-    while(is_operator(*tokens,"++")||is_operator(*tokens,"--")||is_operator(*tokens,"&")||is_operator(*tokens,"*")||is_keyword(*tokens,"sizeof")) ++*tokens;
-    const Token *prefixend = *tokens;
+    // sequneces of 0 or more unary operator tokens
+    List(Token) prefix = {0};
+    const Token *t;
+    while(t = peek_token(st->tokens, 0), is_operator(t,OPERATOR_INCREMENT)||is_operator(t,OPERATOR_DECREMENT)||is_operator(t,OPERATOR_AMPERSAND)||is_operator(t,OPERATOR_STAR)||is_keyword(t,KEYWORD_SIZEOF))
+        Append(&prefix, next_token(st->tokens));
+
+    AstExpression result = parse_expression_with_fields_and_methods_and_indexing(st);
 
-    AstExpression result = parse_expression_with_fields_and_methods_and_indexing(tokens);
+    List(Token) suffix = {0};
+    while(is_operator(peek_token(st->tokens, 0),OPERATOR_INCREMENT)||is_operator(peek_token(st->tokens, 0),OPERATOR_DECREMENT))
+        Append(&suffix, next_token(st->tokens));
 
-    const Token *suffixstart = *tokens;
-    while(is_operator(*tokens,"++")||is_operator(*tokens,"--")) ++*tokens;
-    const Token *suffixend = *tokens;
+    const Token *prefixstart = prefix.ptr, *prefixend = End(prefix);
+    const Token *suffixstart = suffix.ptr, *suffixend = End(suffix);
 
     while (prefixstart<prefixend || suffixstart<suffixend) {
         // ++ and -- "bind tighter", so *foo++ is equivalent to *(foo++)
         // It is implemented by always consuming ++/-- prefixes and suffixes when they exist.
         Location loc;
         enum AstExpressionKind k;
-        if (prefixstart<prefixend && is_operator(prefixend-1, "++")) {
+        if (prefixstart<prefixend && is_operator(prefixend-1, OPERATOR_INCREMENT)) {
             k = AST_EXPR_PRE_INCREMENT;
-            loc = (--prefixend)->location;
-        } else if (prefixstart<prefixend && is_operator(prefixend-1, "--")) {
+            loc = token_location(--prefixend);
+        } else if (prefixstart<prefixend && is_operator(prefixend-1, OPERATOR_DECREMENT)) {
             k = AST_EXPR_PRE_DECREMENT;
-            loc = (--prefixend)->location;
-        } else if (suffixstart<suffixend && is_operator(suffixstart, "++")) {
+            loc = token_location(--prefixend);
+        } else if (suffixstart<suffixend && is_operator(suffixstart, OPERATOR_INCREMENT)) {
             k = AST_EXPR_POST_INCREMENT;
-            loc = suffixstart++->location;
-        } else if (suffixstart<suffixend && is_operator(suffixstart, "--")) {
+            loc = token_location(suffixstart++);
+        } else if (suffixstart<suffixend && is_operator(suffixstart, OPERATOR_DECREMENT)) {
             k = AST_EXPR_POST_DECREMENT;
-            loc = suffixstart++->location;
+            loc = token_location(suffixstart++);
         } else {
             assert(prefixstart<prefixend && suffixstart==suffixend);
-            if (is_operator(prefixend-1, "*"))
+            if (is_operator(prefixend-1, OPERATOR_STAR))
                 k = AST_EXPR_DEREFERENCE;
-            else if (is_operator(prefixend-1, "&"))
+            else if (is_operator(prefixend-1, OPERATOR_AMPERSAND))
                 k = AST_EXPR_ADDRESS_OF;
-            else if (is_keyword(prefixend-1, "sizeof"))
+            else if (is_keyword(prefixend-1, KEYWORD_SIZEOF))
                 k = AST_EXPR_SIZEOF;
             else
                 assert(0);
-            loc = (--prefixend)->location;
+            loc = token_location(--prefixend);
         }
 
-        AstExpression *p = malloc(sizeof(*p));
+        AstExpression *p = arena_alloc(st->arena, sizeof(*p));
         *p = result;
         result = (AstExpression){ .location=loc, .kind=k, .data.operands=p };
     }
 
+    free(prefix.ptr);
+    free(suffix.ptr);
     return result;
 }
 
-static AstExpression parse_expression_with_mul_and_div(const Token **tokens)
+static AstExpression parse_expression_with_mul_and_div(struct State *st)
 {
-    AstExpression result = parse_expression_with_unary_operators(tokens);
-    while (is_operator(*tokens, "*") || is_operator(*tokens, "/") || is_operator(*tokens, "%"))
-        add_to_binop(tokens, &result, parse_expression_with_unary_operators);
+    AstExpression result = parse_expression_with_unary_operators(st);
+    while (is_operator(peek_token(st->tokens, 0), OPERATOR_STAR) || is_operator(peek_token(st->tokens, 0), OPERATOR_DIV) || is_operator(peek_token(st->tokens, 0), OPERATOR_MOD))
+        add_to_binop(st, &result, parse_expression_with_unary_operators);
     return result;
 }
 
-static AstExpression parse_expression_with_add(const Token **tokens)
+static AstExpression parse_expression_with_add(struct State *st)
 {
-    const Token *minus = is_operator(*tokens, "-") ? (*tokens)++ : NULL;
-    AstExpression result = parse_expression_with_mul_and_div(tokens);
-    if (minus)
-        result = build_operator_expression(minus, 1, &result);
-
-    while (is_operator(*tokens, "+") || is_operator(*tokens, "-"))
-        add_to_binop(tokens, &result, parse_expression_with_mul_and_div);
+    bool negate = is_operator(peek_token(st->tokens, 0), OPERATOR_SUB);
+    Token minus = negate ? next_token(st->tokens) : (Token){0};
+    AstExpression result = parse_expression_with_mul_and_div(st);
+    if (negate)
+        result = build_operator_expression(st, &minus, 1, &result);
+
+    while (is_operator(peek_token(st->tokens, 0), OPERATOR_ADD) || is_operator(peek_token(st->tokens, 0), OPERATOR_SUB))
+        add_to_binop(st, &result, parse_expression_with_mul_and_div);
     return result;
 }
 
 // "as" operator has somewhat low precedence, so that "1+2 as float" works as expected
-static AstExpression parse_expression_with_as(const Token **tokens)
+static AstExpression parse_expression_with_as(struct State *st)
 {
-    AstExpression result = parse_expression_with_add(tokens);
-    while (is_keyword(*tokens, "as")) {
-        AstExpression *p = malloc(sizeof(*p));
+    AstExpression result = parse_expression_with_add(st);
+    while (is_keyword(peek_token(st->tokens, 0), KEYWORD_AS)) {
+        AstExpression *p = arena_alloc(st->arena, sizeof(*p));
         *p = result;
-        Location as_location = (*tokens)++->location;
-        AstType t = parse_type(tokens);
+        Location as_location = token_location(peek_token(st->tokens, 0));
+        next_token(st->tokens);
+        AstType t = parse_type(st);
         result = (AstExpression){ .location=as_location, .kind=AST_EXPR_AS, .data.as = { .obj=p, .type=t } };
     }
     return result;
 }
 
-static AstExpression parse_expression_with_comparisons(const Token **tokens)
+static AstExpression parse_expression_with_comparisons(struct State *st)
 {
-    AstExpression result = parse_expression_with_as(tokens);
-#define IsComparator(x) (is_operator((x),"<") || is_operator((x),">") || is_operator((x),"<=") || is_operator((x),">=") || is_operator((x),"==") || is_operator((x),"!="))
-    if (IsComparator(*tokens))
-        add_to_binop(tokens, &result, parse_expression_with_as);
-    if (IsComparator(*tokens))
-        fail_with_error((*tokens)->location, "comparisons cannot be chained");
+    AstExpression result = parse_expression_with_as(st);
+#define IsComparator(x) (is_operator((x),OPERATOR_LT) || is_operator((x),OPERATOR_GT) || is_operator((x),OPERATOR_LE) || is_operator((x),OPERATOR_GE) || is_operator((x),OPERATOR_EQ) || is_operator((x),OPERATOR_NE))
+    const Token *t = peek_token(st->tokens, 0);
+    if (IsComparator(t)) {
+        add_to_binop(st, &result, parse_expression_with_as);
+        t = peek_token(st->tokens, 0);
+    }
+    if (IsComparator(t))
+        fail(st, token_location(peek_token(st->tokens, 0)), "comparisons cannot be chained");
 #undef IsComparator
     return result;
 }
 
-static AstExpression parse_expression_with_not(const Token **tokens)
+static AstExpression parse_expression_with_not(struct State *st)
 {
-    const Token *nottoken = NULL;
-    if (is_keyword(*tokens, "not")) {
-        nottoken = *tokens;
-        ++*tokens;
-    }
-    if (is_keyword(*tokens, "not"))
-        fail_with_error((*tokens)->location, "'not' cannot be repeated");
-
-    AstExpression result = parse_expression_with_comparisons(tokens);
-    if (nottoken)
-        result = build_operator_expression(nottoken, 1, &result);
+    bool negate = is_keyword(peek_token(st->tokens, 0), KEYWORD_NOT);
+    Token nottoken = negate ? next_token(st->tokens) : (Token){0};
+    if (is_keyword(peek_token(st->tokens, 0), KEYWORD_NOT))
+        fail(st, token_location(peek_token(st->tokens, 0)), "'not' cannot be repeated");
+
+    AstExpression result = parse_expression_with_comparisons(st);
+    if (negate)
+        result = build_operator_expression(st, &nottoken, 1, &result);
     return result;
 }
 
-static AstExpression parse_expression_with_and_or(const Token **tokens)
+static AstExpression parse_expression_with_and_or(struct State *st)
 {
-    AstExpression result = parse_expression_with_not(tokens);
+    AstExpression result = parse_expression_with_not(st);
     bool got_and = false, got_or = false;
 
-    while (is_keyword(*tokens, "and") || is_keyword(*tokens, "or")) {
-        got_and = got_and || is_keyword(*tokens, "and");
-        got_or = got_or || is_keyword(*tokens, "or");
+    while (is_keyword(peek_token(st->tokens, 0), KEYWORD_AND) || is_keyword(peek_token(st->tokens, 0), KEYWORD_OR)) {
+        got_and = got_and || is_keyword(peek_token(st->tokens, 0), KEYWORD_AND);
+        got_or = got_or || is_keyword(peek_token(st->tokens, 0), KEYWORD_OR);
         if (got_and && got_or)
-            fail_with_error((*tokens)->location, "'and' cannot be chained with 'or', you need more parentheses");
+            fail(st, token_location(peek_token(st->tokens, 0)), "'and' cannot be chained with 'or', you need more parentheses");
 
-        add_to_binop(tokens, &result, parse_expression_with_not);
+        add_to_binop(st, &result, parse_expression_with_not);
     }
 
     return result;
 }
 
-static AstExpression parse_expression(const Token **tokens)
+static AstExpression parse_expression(struct State *st)
 {
-    return parse_expression_with_and_or(tokens);
+    return parse_expression_with_and_or(st);
 }
 
-static void eat_newline(const Token **tokens)
+static void eat_newline(struct State *st)
 {
-    if ((*tokens)->type != TOKEN_NEWLINE)
-        fail_with_parse_error(*tokens, "end of line");
-    ++*tokens;
+    if (peek_token(st->tokens, 0)->type != TOKEN_NEWLINE)
+        fail_with_parse_error(st, "end of line");
+    next_token(st->tokens);
 }
 
-static void validate_expression_statement(const AstExpression *expr)
+static void validate_expression_statement(struct State *st, const AstExpression *expr)
 {
     switch(expr->kind) {
     case AST_EXPR_FUNCTION_CALL:
@@ -640,33 +705,33 @@ static void validate_expression_statement(const AstExpression *expr)
     case AST_EXPR_POST_DECREMENT:
         break;
     default:
-        fail_with_error(expr->location, "not a valid statement");
+        fail(st, expr->location, "not a valid statement");
         break;
     }
 }
 
-static AstBody parse_body(const Token **tokens);
+static AstBody parse_body(struct State *st);
 
-static AstIfStatement parse_if_statement(const Token **tokens)
+static AstIfStatement parse_if_statement(struct State *st)
 {
     List(AstConditionAndBody) if_elifs = {0};
 
-    assert(is_keyword(*tokens, "if"));
+    assert(is_keyword(peek_token(st->tokens, 0), KEYWORD_IF));
     do {
-        ++*tokens;
-        AstExpression cond = parse_expression(tokens);
-        AstBody body = parse_body(tokens);
+        next_token(st->tokens);
+        AstExpression cond = parse_expression(st);
+        AstBody body = parse_body(st);
         Append(&if_elifs, (AstConditionAndBody){cond,body});
-    } while (is_keyword(*tokens, "elif"));
+    } while (is_keyword(peek_token(st->tokens, 0), KEYWORD_ELIF));
 
     AstBody elsebody = {0};
-    if (is_keyword(*tokens, "else")) {
-        ++*tokens;
-        elsebody = parse_body(tokens);
+    if (is_keyword(peek_token(st->tokens, 0), KEYWORD_ELSE)) {
+        next_token(st->tokens);
+        elsebody = parse_body(st);
     }
 
     return (AstIfStatement){
-        .if_and_elifs = if_elifs.ptr,
+        .if_and_elifs = move_to_arena(st, if_elifs.ptr, if_elifs.len * sizeof if_elifs.ptr[0]),
         .n_if_and_elifs = if_elifs.len,
         .elsebody = elsebody,
     };
@@ -676,216 +741,219 @@ static AstIfStatement parse_if_statement(const Token **tokens)
 static enum AstStatementKind determine_the_kind_of_a_statement_that_starts_with_an_expression(
     const Token *this_token_is_after_that_initial_expression)
 {
-    if (is_operator(this_token_is_after_that_initial_expression, "="))
+    if (is_operator(this_token_is_after_that_initial_expression, OPERATOR_ASSIGN))
         return AST_STMT_ASSIGN;
-    if (is_operator(this_token_is_after_that_initial_expression, "+="))
+    if (is_operator(this_token_is_after_that_initial_expression, OPERATOR_ADD_ASSIGN))
         return AST_STMT_INPLACE_ADD;
-    if (is_operator(this_token_is_after_that_initial_expression, "-="))
+    if (is_operator(this_token_is_after_that_initial_expression, OPERATOR_SUB_ASSIGN))
         return AST_STMT_INPLACE_SUB;
-    if (is_operator(this_token_is_after_that_initial_expression, "*="))
+    if (is_operator(this_token_is_after_that_initial_expression, OPERATOR_MUL_ASSIGN))
         return AST_STMT_INPLACE_MUL;
-    if (is_operator(this_token_is_after_that_initial_expression, "/="))
+    if (is_operator(this_token_is_after_that_initial_expression, OPERATOR_DIV_ASSIGN))
         return AST_STMT_INPLACE_DIV;
-    if (is_operator(this_token_is_after_that_initial_expression, "%="))
+    if (is_operator(this_token_is_after_that_initial_expression, OPERATOR_MOD_ASSIGN))
         return AST_STMT_INPLACE_MOD;
     return AST_STMT_EXPRESSION_STATEMENT;
 }
 
 // does not eat a trailing newline
-static AstStatement parse_oneline_statement(const Token **tokens)
+static AstStatement parse_oneline_statement(struct State *st)
 {
-    AstStatement result = { .location = (*tokens)->location };
-    if (is_keyword(*tokens, "return")) {
-        ++*tokens;
-        if ((*tokens)->type == TOKEN_NEWLINE) {
+    AstStatement result = { .location = token_location(peek_token(st->tokens, 0)) };
+    if (is_keyword(peek_token(st->tokens, 0), KEYWORD_RETURN)) {
+        next_token(st->tokens);
+        if (peek_token(st->tokens, 0)->type == TOKEN_NEWLINE) {
             result.kind = AST_STMT_RETURN_WITHOUT_VALUE;
         } else {
             result.kind = AST_STMT_RETURN_VALUE;
-            result.data.expression = parse_expression(tokens);
+            result.data.expression = parse_expression(st);
         }
-    } else if (is_keyword(*tokens, "break")) {
-        ++*tokens;
+    } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_BREAK)) {
+        next_token(st->tokens);
         result.kind = AST_STMT_BREAK;
-    } else if (is_keyword(*tokens, "continue")) {
-        ++*tokens;
+    } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_CONTINUE)) {
+        next_token(st->tokens);
         result.kind = AST_STMT_CONTINUE;
-    } else if ((*tokens)->type == TOKEN_NAME && is_operator(&(*tokens)[1], ":")) {
+    } else if (peek_token(st->tokens, 0)->type == TOKEN_NAME && is_operator(peek_token(st->tokens, 1), OPERATOR_COLON)) {
         // "foo: int" creates a variable "foo" of type "int"
         result.kind = AST_STMT_DECLARE_LOCAL_VAR;
-        result.data.vardecl = parse_name_type_value(tokens, NULL);
+        result.data.vardecl = parse_name_type_value(st, NULL);
     } else {
-        AstExpression expr = parse_expression(tokens);
-        result.kind = determine_the_kind_of_a_statement_that_starts_with_an_expression(*tokens);
+        AstExpression expr = parse_expression(st);
+        result.kind = determine_the_kind_of_a_statement_that_starts_with_an_expression(peek_token(st->tokens, 0));
         if (result.kind == AST_STMT_EXPRESSION_STATEMENT) {
-            validate_expression_statement(&expr);
+            validate_expression_statement(st, &expr);
             result.data.expression = expr;
         } else {
-            ++*tokens;
-            result.data.assignment = (AstAssignment){.target=expr, .value=parse_expression(tokens)};
-            if (is_operator(*tokens, "="))
-                fail_with_error((*tokens)->location, "only one variable can be assigned at a time");
+            next_token(st->tokens);
+            result.data.assignment = (AstAssignment){.target=expr, .value=parse_expression(st)};
+            if (is_operator(peek_token(st->tokens, 0), OPERATOR_ASSIGN))
+                fail(st, token_location(peek_token(st->tokens, 0)), "only one variable can be assigned at a time");
         }
     }
     return result;
 }
 
-static AstStatement parse_statement(const Token **tokens)
+static AstStatement parse_statement(struct State *st)
 {
-    AstStatement result = { .location = (*tokens)->location };
-    if (is_keyword(*tokens, "if")) {
+    AstStatement result = { .location = token_location(peek_token(st->tokens, 0)) };
+    if (is_keyword(peek_token(st->tokens, 0), KEYWORD_IF)) {
         result.kind = AST_STMT_IF;
-        result.data.ifstatement = parse_if_statement(tokens);
-    } else if (is_keyword(*tokens, "while")) {
-        ++*tokens;
+        result.data.ifstatement = parse_if_statement(st);
+    } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_WHILE)) {
+        next_token(st->tokens);
         result.kind = AST_STMT_WHILE;
-        result.data.whileloop.condition = parse_expression(tokens);
-        result.data.whileloop.body = parse_body(tokens);
-    } else if (is_keyword(*tokens, "for")) {
-        ++*tokens;
+        result.data.whileloop.condition = parse_expression(st);
+        result.data.whileloop.body = parse_body(st);
+    } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_FOR)) {
+        next_token(st->tokens);
         result.kind = AST_STMT_FOR;
-        result.data.forloop.init = malloc(sizeof *result.data.forloop.init);
-        result.data.forloop.incr = malloc(sizeof *result.data.forloop.incr);
+        result.data.forloop.init = arena_alloc(st->arena, sizeof *result.data.forloop.init);
+        result.data.forloop.incr = arena_alloc(st->arena, sizeof *result.data.forloop.incr);
         // TODO: improve error messages
-        *result.data.forloop.init = parse_oneline_statement(tokens);
-        if (!is_operator(*tokens, ";"))
-            fail_with_parse_error(*tokens, "a ';'");
-        ++*tokens;
-        result.data.forloop.cond = parse_expression(tokens);
-        if (!is_operator(*tokens, ";"))
-            fail_with_parse_error(*tokens, "a ';'");
-        ++*tokens;
-        *result.data.forloop.incr = parse_oneline_statement(tokens);
-        result.data.forloop.body = parse_body(tokens);
+        *result.data.forloop.init = parse_oneline_statement(st);
+        if (!is_operator(peek_token(st->tokens, 0), OPERATOR_SEMICOLON))
+            fail_with_parse_error(st, "a ';'");
+        next_token(st->tokens);
+        result.data.forloop.cond = parse_expression(st);
+        if (!is_operator(peek_token(st->tokens, 0), OPERATOR_SEMICOLON))
+            fail_with_parse_error(st, "a ';'");
+        next_token(st->tokens);
+        *result.data.forloop.incr = parse_oneline_statement(st);
+        result.data.forloop.body = parse_body(st);
     } else {
-        result = parse_oneline_statement(tokens);
-        eat_newline(tokens);
+        result = parse_oneline_statement(st);
+        eat_newline(st);
     }
     return result;
 }
 
-static void parse_start_of_body(const Token **tokens)
+static void parse_start_of_body(struct State *st)
 {
-    if (!is_operator(*tokens, ":"))
-        fail_with_parse_error(*tokens, "':' followed by a new line with more indentation");
-    ++*tokens;
+    if (!is_operator(peek_token(st->tokens, 0), OPERATOR_COLON))
+        fail_with_parse_error(st, "':' followed by a new line with more indentation");
+    next_token(st->tokens);
 
-    if ((*tokens)->type != TOKEN_NEWLINE)
-        fail_with_parse_error(*tokens, "a new line with more indentation after ':'");
-    ++*tokens;
+    if (peek_token(st->tokens, 0)->type != TOKEN_NEWLINE)
+        fail_with_parse_error(st, "a new line with more indentation after ':'");
+    next_token(st->tokens);
 
-    if ((*tokens)->type != TOKEN_INDENT)
-        fail_with_parse_error(*tokens, "more indentation after ':'");
-    ++*tokens;
+    if (peek_token(st->tokens, 0)->type != TOKEN_INDENT)
+        fail_with_parse_error(st, "more indentation after ':'");
+    next_token(st->tokens);
 }
 
-static AstBody parse_body(const Token **tokens)
+static AstBody parse_body(struct State *st)
 {
-    parse_start_of_body(tokens);
+    parse_start_of_body(st);
 
     List(AstStatement) result = {0};
-    while ((*tokens)->type != TOKEN_DEDENT)
-        Append(&result, parse_statement(tokens));
-    ++*tokens;
+    while (peek_token(st->tokens, 0)->type != TOKEN_DEDENT)
+        Append(&result, parse_statement(st));
+    next_token(st->tokens);
 
-    return (AstBody){ .statements=result.ptr, .nstatements=result.len };
+    return (AstBody){ .statements=move_to_arena(st, result.ptr, result.len * sizeof result.ptr[0]), .nstatements=result.len };
 }
 
-static AstFunctionDef parse_funcdef(const Token **tokens, bool is_method)
+static AstFunctionDef parse_funcdef(struct State *st, bool is_method)
 {
-    assert(is_keyword(*tokens, "def"));
-    ++*tokens;
+    assert(is_keyword(peek_token(st->tokens, 0), KEYWORD_DEF));
+    next_token(st->tokens);
 
     struct AstFunctionDef funcdef = {0};
-    funcdef.signature = parse_function_signature(tokens, is_method);
+    funcdef.signature = parse_function_signature(st, is_method);
     if (funcdef.signature.takes_varargs) {
         // TODO: support "def foo(x: str, ...)" in some way
-        fail_with_error((*tokens)->location, "functions with variadic arguments cannot be defined yet");
+        fail(st, token_location(peek_token(st->tokens, 0)), "functions with variadic arguments cannot be defined yet");
     }
-    funcdef.body = parse_body(tokens);
+    funcdef.body = parse_body(st);
 
     return funcdef;
 }
 
-static AstClassDef parse_classdef(const Token **tokens)
+static AstClassDef parse_classdef(struct State *st)
 {
     AstClassDef result = {0};
-    if ((*tokens)->type != TOKEN_NAME)
-        fail_with_parse_error(*tokens, "a name for the class");
-    safe_strcpy(result.name, (*tokens)->data.name);
-    ++*tokens;
-
-    parse_start_of_body(tokens);
-    while ((*tokens)->type != TOKEN_DEDENT) {
-        if (is_keyword(*tokens, "def")) {
-            Append(&result.methods, parse_funcdef(tokens, true));
+    if (peek_token(st->tokens, 0)->type != TOKEN_NAME)
+        fail_with_parse_error(st, "a name for the class");
+    result.name = token_name(peek_token(st->tokens, 0));
+    next_token(st->tokens);
+
+    parse_start_of_body(st);
+    while (peek_token(st->tokens, 0)->type != TOKEN_DEDENT) {
+        if (is_keyword(peek_token(st->tokens, 0), KEYWORD_DEF)) {
+            Append(&result.methods, parse_funcdef(st, true));
         } else {
-            AstNameTypeValue field = parse_name_type_value(tokens, "a method or a class field");
+            AstNameTypeValue field = parse_name_type_value(st, "a method or a class field");
 
             if (field.value)
-                fail_with_error(field.value->location, "class fields cannot have default values");
+                fail(st, field.value->location, "class fields cannot have default values");
 
             for (const AstNameTypeValue *prevfield = result.fields.ptr; prevfield < End(result.fields); prevfield++)
                 if (!strcmp(prevfield->name, field.name))
-                    fail_with_error(field.name_location, "there are multiple fields named '%s'", field.name);
+                    fail(st, field.name_location, "there are multiple fields named '%s'", field.name);
             Append(&result.fields, field);
-            eat_newline(tokens);
+            eat_newline(st);
         }
     }
 
-    ++*tokens;
+    next_token(st->tokens);
+
+    result.fields.ptr = move_to_arena(st, result.fields.ptr, result.fields.len * sizeof result.fields.ptr[0]);
+    result.fields.alloc = result.fields.len;
+    result.methods.ptr = move_to_arena(st, result.methods.ptr, result.methods.len * sizeof result.methods.ptr[0]);
+    result.methods.alloc = result.methods.len;
     return result;
 }
 
-static AstEnumDef parse_enumdef(const Token **tokens)
+static AstEnumDef parse_enumdef(struct State *st)
 {
     AstEnumDef result = {0};
-    if ((*tokens)->type != TOKEN_NAME)
-        fail_with_parse_error(*tokens, "a name for the enum");
-    safe_strcpy(result.name, (*tokens)->data.name);
-    ++*tokens;
+    if (peek_token(st->tokens, 0)->type != TOKEN_NAME)
+        fail_with_parse_error(st, "a name for the enum");
+    result.name = token_name(peek_token(st->tokens, 0));
+    next_token(st->tokens);
 
-    parse_start_of_body(tokens);
+    parse_start_of_body(st);
     List(const char*) membernames = {0};
 
-    while ((*tokens)->type != TOKEN_DEDENT) {
+    while (peek_token(st->tokens, 0)->type != TOKEN_DEDENT) {
+        const char *name = token_name(peek_token(st->tokens, 0));
         for (const char **old = membernames.ptr; old < End(membernames); old++)
-            if (!strcmp(*old, (*tokens)->data.name))
-                fail_with_error((*tokens)->location, "the enum has two members named '%s'", (*tokens)->data.name);
+            if (*old == name)
+                fail(st, token_location(peek_token(st->tokens, 0)), "the enum has two members named '%s'", name);
 
-        Append(&membernames, (*tokens)->data.name);
-        ++*tokens;
-        eat_newline(tokens);
+        Append(&membernames, name);
+        next_token(st->tokens);
+        eat_newline(st);
     }
 
     result.nmembers = membernames.len;
-    result.membernames = malloc(sizeof(result.membernames[0]) * result.nmembers);
-    for (int i = 0; i < result.nmembers; i++)
-        strcpy(result.membernames[i], membernames.ptr[i]);
-
-    free(membernames.ptr);
-    ++*tokens;
+    result.membernames = move_to_arena(st, membernames.ptr, membernames.len * sizeof membernames.ptr[0]);
+    next_token(st->tokens);
     return result;
 }
 
-static char *get_actual_import_path(const Token *pathtoken, const char *stdlib_path)
+static char *get_actual_import_path(struct State *st, const char *stdlib_path)
 {
+    const Token *pathtoken = peek_token(st->tokens, 0);
     if (pathtoken->type != TOKEN_STRING)
-        fail_with_parse_error(pathtoken, "a string to specify the file name");
+        fail_with_parse_error(st, "a string to specify the file name");
 
     const char *part1, *part2;
     char *tmp = NULL;
-    if (!strncmp(pathtoken->data.string_value, "stdlib/", 7)) {
+    if (!strncmp(token_text(pathtoken), "stdlib/", 7)) {
         // Starts with stdlib --> import from where stdlib actually is
         part1 = stdlib_path;
-        part2 = pathtoken->data.string_value + 7;
-    } else if (pathtoken->data.string_value[0] == '.') {
+        part2 = token_text(pathtoken) + 7;
+    } else if (token_text(pathtoken)[0] == '.') {
         // Relative to directory where the file is
-        tmp = strdup(pathtoken->location.filename);
+        tmp = strdup(token_location(pathtoken).filename);
         part1 = dirname(tmp);
-        part2 = pathtoken->data.string_value;
+        part2 = token_text(pathtoken);
     } else {
-        fail_with_error(
-            pathtoken->location,
+        fail(st,
+            token_location(pathtoken),
             "import path must start with 'stdlib/' (standard-library import) or a dot (relative import)");
     }
 
@@ -900,118 +968,120 @@ static char *get_actual_import_path(const Token *pathtoken, const char *stdlib_p
 
 typedef List(AstToplevelNode) ToplevelNodeList;
 
-static void parse_import(const Token **tokens, const char *stdlib_path, ToplevelNodeList *dest)
+static void parse_import(struct State *st, const char *stdlib_path, ToplevelNodeList *dest)
 {
     // This simplifies the compiler: it's easy to loop through all imports of the file.
     if (dest->len > 0 && dest->ptr[dest->len - 1].kind != AST_TOPLEVEL_IMPORT)
-        fail_with_error((*tokens)->location, "imports must be in the beginning of the file");
+        fail(st, token_location(peek_token(st->tokens, 0)), "imports must be in the beginning of the file");
 
-    assert(is_keyword(*tokens, "from"));
-    ++*tokens;
+    assert(is_keyword(peek_token(st->tokens, 0), KEYWORD_FROM));
+    next_token(st->tokens);
 
-    char *path = get_actual_import_path(*tokens, stdlib_path);
-    ++*tokens;
+    char *path = get_actual_import_path(st, stdlib_path);
+    next_token(st->tokens);
 
-    if (!is_keyword(*tokens, "import"))
-        fail_with_parse_error(*tokens, "the 'import' keyword");
-    ++*tokens;
+    if (!is_keyword(peek_token(st->tokens, 0), KEYWORD_IMPORT))
+        fail_with_parse_error(st, "the 'import' keyword");
+    next_token(st->tokens);
 
-    bool parens = is_operator(*tokens, "(");
-    if(parens) ++*tokens;
+    bool parens = is_operator(peek_token(st->tokens, 0), OPERATOR_LPAREN);
+    if(parens) next_token(st->tokens);
 
     do {
-        if ((*tokens)->type != TOKEN_NAME)
-            fail_with_parse_error(*tokens, "the name of a symbol to import");
+        if (peek_token(st->tokens, 0)->type != TOKEN_NAME)
+            fail_with_parse_error(st, "the name of a symbol to import");
 
         struct AstImport imp = {0};
-        imp.path = strdup(path);
-        safe_strcpy(imp.symbolname, (*tokens)->data.name);
+        imp.path = arena_strdup(st->arena, path);
+        imp.symbolname = token_name(peek_token(st->tokens, 0));
 
         Append(dest, (struct AstToplevelNode){
-            .location = (*tokens)->location,
+            .location = token_location(peek_token(st->tokens, 0)),
             .kind = AST_TOPLEVEL_IMPORT,
             .data.import = imp,
         });
-        ++*tokens;
+        next_token(st->tokens);
 
-        if (is_operator(*tokens, ","))
-            ++*tokens;
+        if (is_operator(peek_token(st->tokens, 0), OPERATOR_COMMA))
+            next_token(st->tokens);
         else
             break;
-    } while (!is_operator(*tokens, ")") && (*tokens)->type != TOKEN_NEWLINE);
+    } while (!is_operator(peek_token(st->tokens, 0), OPERATOR_RPAREN) && peek_token(st->tokens, 0)->type != TOKEN_NEWLINE);
     free(path);
 
     if (parens) {
-        if (!is_operator(*tokens, ")"))
-            fail_with_parse_error(*tokens, "a ')'");
-        ++*tokens;
+        if (!is_operator(peek_token(st->tokens, 0), OPERATOR_RPAREN))
+            fail_with_parse_error(st, "a ')'");
+        next_token(st->tokens);
     }
 
-    if ((*tokens)->type != TOKEN_NEWLINE)
-        fail_with_parse_error(*tokens, "a comma or end of line");
-    ++*tokens;
+    if (peek_token(st->tokens, 0)->type != TOKEN_NEWLINE)
+        fail_with_parse_error(st, "a comma or end of line");
+    next_token(st->tokens);
 }
 
-static AstToplevelNode parse_toplevel_node(const Token **tokens)
+static AstToplevelNode parse_toplevel_node(struct State *st)
 {
-    AstToplevelNode result = { .location = (*tokens)->location };
+    AstToplevelNode result = { .location = token_location(peek_token(st->tokens, 0)) };
 
-    if ((*tokens)->type == TOKEN_END_OF_FILE) {
+    if (peek_token(st->tokens, 0)->type == TOKEN_END_OF_FILE) {
         result.kind = AST_TOPLEVEL_END_OF_FILE;
-    } else if (is_keyword(*tokens, "def")) {
-        ++*tokens;  // skip 'def' keyword
+    } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_DEF)) {
+        next_token(st->tokens);  // skip 'def' keyword
         result.kind = AST_TOPLEVEL_DEFINE_FUNCTION;
-        result.data.funcdef.signature = parse_function_signature(tokens, false);
+        result.data.funcdef.signature = parse_function_signature(st, false);
         if (result.data.funcdef.signature.takes_varargs) {
             // TODO: support "def foo(x: str, ...)" in some way
-            fail_with_error((*tokens)->location, "functions with variadic arguments cannot be defined yet");
+            fail(st, token_location(peek_token(st->tokens, 0)), "functions with variadic arguments cannot be defined yet");
         }
-        result.data.funcdef.body = parse_body(tokens);
-    } else if (is_keyword(*tokens, "declare")) {
-        ++*tokens;
-        if (is_keyword(*tokens, "global")) {
-            ++*tokens;
+        result.data.funcdef.body = parse_body(st);
+    } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_DECLARE)) {
+        next_token(st->tokens);
+        if (is_keyword(peek_token(st->tokens, 0), KEYWORD_GLOBAL)) {
+            next_token(st->tokens);
             result.kind = AST_TOPLEVEL_DECLARE_GLOBAL_VARIABLE;
-            result.data.globalvar = parse_name_type_value(tokens, "a variable name");
+            result.data.globalvar = parse_name_type_value(st, "a variable name");
             if (result.data.globalvar.value) {
-                fail_with_error(
+                fail(st,
                     result.data.globalvar.value->location,
                     "a value cannot be given when declaring a global variable");
             }
         } else {
             result.kind = AST_TOPLEVEL_DECLARE_FUNCTION;
-            result.data.funcdef.signature = parse_function_signature(tokens, false);
+            result.data.funcdef.signature = parse_function_signature(st, false);
         }
-        eat_newline(tokens);
-    } else if (is_keyword(*tokens, "global")) {
-        ++*tokens;
+        eat_newline(st);
+    } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_GLOBAL)) {
+        next_token(st->tokens);
         result.kind = AST_TOPLEVEL_DEFINE_GLOBAL_VARIABLE;
-        result.data.globalvar = parse_name_type_value(tokens, "a variable name");
-        eat_newline(tokens);
-    } else if (is_keyword(*tokens, "class")) {
-        ++*tokens;
+        result.data.globalvar = parse_name_type_value(st, "a variable name");
+        eat_newline(st);
+    } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_CLASS)) {
+        next_token(st->tokens);
         result.kind = AST_TOPLEVEL_DEFINE_CLASS;
-        result.data.classdef = parse_classdef(tokens);
-    } else if (is_keyword(*tokens, "enum")) {
-        ++*tokens;
+        result.data.classdef = parse_classdef(st);
+    } else if (is_keyword(peek_token(st->tokens, 0), KEYWORD_ENUM)) {
+        next_token(st->tokens);
         result.kind = AST_TOPLEVEL_DEFINE_ENUM;
-        result.data.enumdef = parse_enumdef(tokens);
+        result.data.enumdef = parse_enumdef(st);
     } else {
-        fail_with_parse_error(*tokens, "a definition or declaration");
+        fail_with_parse_error(st, "a definition or declaration");
     }
 
     return result;
 }
 
-AstToplevelNode *parse(const Token *tokens, const char *stdlib_path)
+AstToplevelNode *parse(TokenStream *tokens, const char *stdlib_path, Arena *arena)
 {
+    struct State st = { .tokens = tokens, .arena = arena };
+
     ToplevelNodeList result = {0};
     do {
         // Imports are separate because one import statement can become multiple ast nodes.
-        if (is_keyword(tokens, "from"))
-            parse_import(&tokens, stdlib_path, &result);
+        if (is_keyword(peek_token(tokens, 0), KEYWORD_FROM))
+            parse_import(&st, stdlib_path, &result);
         else
-            Append(&result, parse_toplevel_node(&tokens));
+            Append(&result, parse_toplevel_node(&st));
     } while (result.ptr[result.len - 1].kind != AST_TOPLEVEL_END_OF_FILE);
-    return result.ptr;
+    return move_to_arena(&st, result.ptr, result.len * sizeof result.ptr[0]);
 }
@@ -62,13 +62,13 @@ void print_token(const Token *token)
         printf("integer %d\n", (int)token->data.int_value);
         break;
     case TOKEN_LONG:
-        printf("long %lld\n", (long long)token->data.long_value);
+        printf("long %s\n", token_text(token));
         break;
     case TOKEN_FLOAT:
-        printf("float %s\n", token->data.name);
+        printf("float %s\n", token_text(token));
         break;
     case TOKEN_DOUBLE:
-        printf("double %s\n", token->data.name);
+        printf("double %s\n", token_text(token));
         break;
     case TOKEN_CHAR:
         printf("character ");
@@ -77,14 +77,14 @@ void print_token(const Token *token)
         break;
     case TOKEN_STRING:
         printf("string ");
-        print_string(token->data.string_value);
+        print_string(token_text(token));
         printf("\n");
         break;
     case TOKEN_NAME:
-        printf("name \"%s\"\n", token->data.name);
+        printf("name \"%s\"\n", token_text(token));
         break;
     case TOKEN_KEYWORD:
-        printf("keyword \"%s\"\n", token->data.name);
+        printf("keyword \"%s\"\n", token_text(token));
         break;
     case TOKEN_NEWLINE:
         printf("newline token (next line has %d spaces of indentation)\n", token->data.indentation_level);
@@ -99,19 +99,19 @@ void print_token(const Token *token)
         printf("dedent (-4 spaces)\n");
         break;
     case TOKEN_OPERATOR:
-        printf("operator '%s'\n", token->data.operator);
+        printf("operator '%s'\n", token_text(token));
         break;
     }
 }
 
 void print_tokens(const Token *tokens)
 {
-    printf("===== Tokens for file \"%s\" =====\n", tokens->location.filename);
+    printf("===== Tokens for file \"%s\" =====\n", get_interned_string(tokens->filename));
     int lastlineno = -1;
     do {
-        if (tokens->location.lineno != lastlineno) {
-            printf("\nLine %d:\n", tokens->location.lineno);
-            lastlineno = tokens->location.lineno;
+        if (tokens->lineno != lastlineno) {
+            printf("\nLine %d:\n", tokens->lineno);
+            lastlineno = tokens->lineno;
         }
         printf("  ");
         print_token(tokens);
@@ -489,9 +489,6 @@ static void print_cf_instruction(const CfInstruction *ins)
     case CF_ADDRESS_OF_GLOBAL_VAR:
         printf("address of %s (global variable)", ins->data.globalname);
         break;
-    case CF_SIZEOF:
-        printf("sizeof %s", ins->data.type->name);
-        break;
     case CF_BOOL_NEGATE:
         printf("boolean negation of %s", varname(ins->operands[0]));
         break;
@@ -581,7 +578,7 @@ void print_control_flow_graph(const CfGraph *cfg)
 
     printf("  Variables:\n");
     for (LocalVariable **var = cfg->locals.ptr; var < End(cfg->locals); var++) {
-        printf("    %-20s  %s\n", varname(*var), (*var)->type->name);
+        printf("    %-20s  %s\n", varname(*var), type_name((*var)->type));
     }
 
     for (CfBlock **b = cfg->all_blocks.ptr; b < End(cfg->all_blocks); b++) {
@@ -601,13 +598,10 @@ void print_control_flow_graph(const CfGraph *cfg)
             assert((*b)->iftrue == NULL);
             assert((*b)->iffalse == NULL);
         } else {
-            int trueidx=-1, falseidx=-1;
-            for (int i = 0; i < cfg->all_blocks.len; i++) {
-                if (cfg->all_blocks.ptr[i]==(*b)->iftrue) trueidx=i;
-                if (cfg->all_blocks.ptr[i]==(*b)->iffalse) falseidx=i;
-            }
-            assert(trueidx!=-1);
-            assert(falseidx!=-1);
+            int trueidx = (*b)->iftrue->index;
+            int falseidx = (*b)->iffalse->index;
+            assert(cfg->all_blocks.ptr[trueidx] == (*b)->iftrue);
+            assert(cfg->all_blocks.ptr[falseidx] == (*b)->iffalse);
             if (trueidx==falseidx)
                 printf("    Jump to block %d.\n", trueidx);
             else {
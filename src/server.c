@@ -0,0 +1,415 @@
+/*
+Compile server. See jou_compiler.h for an overview.
+
+The client connects to a UNIX socket and sends a header (two uint32_t: size
+of the data that follows, number of arguments) along with its stdin, stdout
+and stderr (SCM_RIGHTS). Then it sends its current working directory and
+the command line arguments, each terminated by '\0'. The server sends back
+the exit code as an int32_t and closes the connection.
+
+Each request is compiled in a forked process, so that fail_with_error() and
+everything else in the compiler works as usual. Requests are handled one at
+a time.
+
+Batch mode (jou --batch FILE1 FILE2 ...) works the same way without a socket:
+each file is compiled in a forked process, and the server cache is shared.
+*/
+
+#ifdef _WIN32
+
+#include "jou_compiler.h"
+
+noreturn void run_compile_server(const char *argv0, const char *socketpath)
+{
+    (void)argv0;
+    (void)socketpath;
+    assert(0);
+    exit(1);
+}
+
+int run_batch(int argc, char **argv, int batchidx)
+{
+    (void)argc;
+    fprintf(stderr, "%s: %s is not supported on Windows\n", argv[0], argv[batchidx]);
+    return 2;
+}
+
+void notify_compile_server(void)
+{
+}
+
+#else  // _WIN32
+
+#define _POSIX_C_SOURCE 200809L
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // struct ucred for SO_PEERCRED on Linux
+#endif
+#define _DARWIN_C_SOURCE  // getpeereid() on macOS
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "jou_compiler.h"
+#include "util.h"
+
+// In the forked process, this is where we tell the server that parsing and type-checking succeeded.
+static int notify_fd = -1;
+
+void notify_compile_server(void)
+{
+    if (notify_fd >= 0) {
+        char c = 1;
+        (void)!write(notify_fd, &c, 1);
+        close(notify_fd);
+        notify_fd = -1;
+    }
+}
+
+static bool read_all(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    while (n > 0) {
+        ssize_t got = read(fd, p, n);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        p += got;
+        n -= got;
+    }
+    return true;
+}
+
+// Returns the number of arguments, or -1 on error. On success, fds and *data must be closed/freed.
+static int receive_request(int conn, int fds[3], char **data, uint32_t *datalen)
+{
+    uint32_t header[2];
+    struct iovec iov = { .iov_base = header, .iov_len = sizeof header };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof control.buf,
+    };
+
+    ssize_t got = recvmsg(conn, &msg, 0);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (got <= 0
+        || !cmsg
+        || cmsg->cmsg_level != SOL_SOCKET
+        || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+    {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    // The header may arrive in pieces, but the file descriptors come with the first piece.
+    if ((size_t)got < sizeof header && !read_all(conn, (char *)header + got, sizeof header - got))
+        goto error;
+    if (header[0] > 1000*1000 || header[1] > 1000)
+        goto error;
+
+    *datalen = header[0];
+    *data = malloc(*datalen + 1);
+    if (!read_all(conn, *data, *datalen)) {
+        free(*data);
+        goto error;
+    }
+    (*data)[*datalen] = '\0';
+    return header[1];
+
+error:
+    for (int i = 0; i < 3; i++)
+        close(fds[i]);
+    return -1;
+}
+
+// Not inherited by forked processes
+static int listen_fd = -1;
+static int conn_fd = -1;
+
+/*
+Runs compile_and_run() in a forked process and returns its exit code. If
+stdio_fds is not NULL, it contains stdin, stdout and stderr for the forked
+process. Then the cache is updated, if parsing and type-checking succeeded.
+*/
+static int compile_in_child(int argc, char **argv, const int *stdio_fds)
+{
+    int errfd = stdio_fds ? stdio_fds[2] : STDERR_FILENO;
+
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+        dprintf(errfd, "%s: pipe() failed: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (listen_fd >= 0)
+            close(listen_fd);
+        if (conn_fd >= 0)
+            close(conn_fd);
+        close(pipefd[0]);
+        notify_fd = pipefd[1];
+        signal(SIGPIPE, SIG_DFL);
+        if (stdio_fds) {
+            for (int i = 0; i < 3; i++) {
+                dup2(stdio_fds[i], i);
+                if (stdio_fds[i] > 2)
+                    close(stdio_fds[i]);
+            }
+        }
+        exit(compile_and_run(argc, argv));
+    }
+
+    close(pipefd[1]);
+    int ret = 1;
+    bool frontend_ok = false;
+    if (pid < 0) {
+        dprintf(errfd, "%s: fork() failed: %s\n", argv[0], strerror(errno));
+    } else {
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (WIFSIGNALED(status))
+            dprintf(errfd, "%s\n", strsignal(WTERMSIG(status)));
+        else
+            ret = WEXITSTATUS(status);
+
+        char c;
+        frontend_ok = (read(pipefd[0], &c, 1) == 1);
+    }
+    close(pipefd[0]);
+
+    if (conn_fd >= 0) {
+        // Reply before updating the cache, so that the client doesn't wait for it.
+        int32_t ret32 = ret;
+        (void)!write(conn_fd, &ret32, sizeof ret32);
+    }
+    if (frontend_ok) {
+        // The forked process already showed the warnings, don't show them again.
+        fflush(stderr);
+        int saved_stderr = dup(STDERR_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+        update_server_cache(argc, argv);
+        fflush(stderr);
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+    }
+    return ret;
+}
+
+/*
+Anyone who can connect can run any code as us, with the -o and --linker-flags
+of their choice. The socket is only accessible by our user (see below), but
+some systems ignore permissions of UNIX sockets, so we also check the user.
+*/
+static bool client_is_same_user(int conn)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof cred;
+    return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(conn, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
+
+static void handle_request(const char *argv0)
+{
+    if (!client_is_same_user(conn_fd)) {
+        fprintf(stderr, "%s: ignoring a request from another user\n", argv0);
+        return;
+    }
+
+    int fds[3];
+    char *data;
+    uint32_t datalen;
+    int nargs = receive_request(conn_fd, fds, &data, &datalen);
+    if (nargs < 0)
+        return;
+
+    // data is "cwd\0arg1\0arg2\0...", and we add our argv0 in front of the arguments.
+    const char *cwd = data;
+    char **argv = calloc(nargs + 2, sizeof argv[0]);
+    argv[0] = (char *)argv0;
+    char *p = data + strlen(data) + 1;
+    for (int i = 1; i <= nargs; i++) {
+        if (p >= data + datalen)
+            goto done;
+        argv[i] = p;
+        p += strlen(p) + 1;
+    }
+
+    if (chdir(cwd) == 0) {
+        compile_in_child(nargs + 1, argv, fds);
+    } else {
+        dprintf(fds[2], "%s: cannot change directory to \"%s\": %s\n", argv0, cwd, strerror(errno));
+        int32_t ret = 1;
+        (void)!write(conn_fd, &ret, sizeof ret);
+    }
+
+done:
+    for (int i = 0; i < 3; i++)
+        close(fds[i]);
+    free(argv);
+    free(data);
+}
+
+noreturn void run_compile_server(const char *argv0, const char *socketpath)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socketpath) >= sizeof addr.sun_path) {
+        fprintf(stderr, "%s: socket path is too long: %s\n", argv0, socketpath);
+        exit(1);
+    }
+    strcpy(addr.sun_path, socketpath);
+
+    // Remove a socket left behind by a previous server, but don't delete other files.
+    struct stat st;
+    if (stat(socketpath, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socketpath);
+
+    // Other users must not be able to connect. The socket gets its permissions when it is created in bind().
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t old_umask = umask(077);
+    bool bound = listen_fd >= 0 && bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) == 0;
+    umask(old_umask);
+    if (!bound || listen(listen_fd, 16) != 0) {
+        fprintf(stderr, "%s: cannot listen on \"%s\": %s\n", argv0, socketpath, strerror(errno));
+        exit(1);
+    }
+
+    // Clients may disconnect at any time. That must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Compile server listening on %s\n", socketpath);
+    fflush(stdout);
+
+    while (true) {
+        conn_fd = accept(listen_fd, NULL, NULL);
+        if (conn_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "%s: accept() failed: %s\n", argv0, strerror(errno));
+            exit(1);
+        }
+        handle_request(argv0);
+        close(conn_fd);
+        conn_fd = -1;
+    }
+}
+
+typedef List(char *) FileNameList;
+
+// Returns the file names listed in a --batch-from file, one per line.
+static FileNameList read_batch_file(const char *argv0, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "%s: cannot open \"%s\": %s\n", argv0, path, strerror(errno));
+        exit(1);
+    }
+
+    FileNameList result = {0};
+    char line[4096];
+    while (fgets(line, sizeof line, f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0])
+            Append(&result, strdup(line));
+    }
+    fclose(f);
+    return result;
+}
+
+int run_batch(int argc, char **argv, int batchidx)
+{
+    const char *argv0 = argv[0];
+    int ncommon = batchidx - 1;  // options before --batch are used for every file
+
+    for (int i = 1; i < batchidx; i++) {
+        if (!strcmp(argv[i], "-o")) {
+            fprintf(stderr, "%s: -o cannot be used with %s, each file goes to its default location (try \"%s --help\")\n",
+                argv0, argv[batchidx], argv0);
+            return 2;
+        }
+    }
+
+    FileNameList files = {0};
+    if (!strcmp(argv[batchidx], "--batch-from")) {
+        if (argc - batchidx != 2) {
+            fprintf(stderr, "%s: there must be one file name after --batch-from (try \"%s --help\")\n", argv0, argv0);
+            return 2;
+        }
+        files = read_batch_file(argv0, argv[batchidx + 1]);
+    } else {
+        for (int i = batchidx + 1; i < argc; i++)
+            Append(&files, strdup(argv[i]));
+    }
+
+    if (files.len == 0) {
+        fprintf(stderr, "%s: no Jou files given for %s (try \"%s --help\")\n", argv0, argv[batchidx], argv0);
+        return 2;
+    }
+
+    // Check the options once, so that a typo doesn't fail every file separately.
+    char **childargv = calloc(ncommon + 5, sizeof childargv[0]);
+    childargv[0] = (char *)argv0;
+    memcpy(&childargv[1], &argv[1], ncommon * sizeof argv[0]);
+    childargv[ncommon + 1] = files.ptr[0];
+    parse_arguments(ncommon + 2, childargv);
+
+    int nfailed = 0;
+    for (char **file = files.ptr; file < End(files); file++) {
+        int ret;
+        struct stat st;
+        if (stat(*file, &st) != 0) {
+            fprintf(stderr, "compiler error in file \"%s\": cannot open file: %s\n", *file, strerror(errno));
+            ret = 1;
+        } else {
+            command_line_args.infile = *file;
+            char *exepath = get_default_exe_path();
+            childargv[ncommon + 1] = "-o";
+            childargv[ncommon + 2] = exepath;
+            childargv[ncommon + 3] = *file;
+            ret = compile_in_child(ncommon + 4, childargv, NULL);
+            free(exepath);
+        }
+
+        if (ret == 0)
+            printf("Compiled %s\n", *file);
+        else
+            printf("Failed to compile %s\n", *file);
+        fflush(stdout);
+        nfailed += !!ret;
+    }
+
+    printf("%d of %d files compiled successfully\n", files.len - nfailed, files.len);
+
+    for (char **file = files.ptr; file < End(files); file++)
+        free(*file);
+    free(files.ptr);
+    free(childargv);
+    return !!nfailed;
+}
+
+#endif  // _WIN32
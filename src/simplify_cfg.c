@@ -1,22 +1,170 @@
 #include "jou_compiler.h"
 #include <limits.h>
 
-static int find_block_index(const CfGraph *cfg, const CfBlock *b)
+/*
+Forward dataflow analysis. The state of a block is a bitset of nwords words,
+and each block has a state at its start and at its end. The state at the
+start of a block is the bitwise OR of the states at the end of blocks that
+jump to it, and for the start block, also the given initial state. The
+transfer function turns the state at the start of a block into the state at
+the end.
+
+Blocks are visited in reverse postorder, so that every block is usually
+visited after the blocks that jump to it. Only loops need to be visited more
+than once. Blocks that cannot be reached from the start block are never
+visited, and their states stay all zero.
+*/
+typedef void (*TransferFunction)(const CfGraph *cfg, const CfBlock *block, uint64_t *state);
+
+struct DataflowResult {
+    int nwords;
+    uint64_t *start_states;  // start_states[block->index * nwords + i]
+    uint64_t *end_states;
+};
+
+static void compute_predecessors(CfGraph *cfg)
 {
-    for (int i = 0; i < cfg->all_blocks.len; i++)
-        if (cfg->all_blocks.ptr[i] == b)
-            return i;
-    assert(0);
+    for (CfBlock **b = cfg->all_blocks.ptr; b < End(cfg->all_blocks); b++)
+        (*b)->predecessors.len = 0;
+
+    for (CfBlock **b = cfg->all_blocks.ptr; b < End(cfg->all_blocks); b++) {
+        if (*b == &cfg->end_block)
+            continue;
+        Append(&(*b)->iftrue->predecessors, *b);
+        if ((*b)->iffalse != (*b)->iftrue)
+            Append(&(*b)->iffalse->predecessors, *b);
+    }
+}
+
+typedef List(CfBlock *) BlockList;
+
+struct DfsStackItem {
+    CfBlock *block;
+    int nsuccessors_done;  // 0 = none, 1 = iftrue, 2 = iftrue and iffalse
+};
+
+// Returns reachable blocks in reverse postorder. The start block is always first.
+static BlockList reverse_postorder(CfGraph *cfg)
+{
+    BlockList postorder = {0};
+    char *seen = calloc(1, cfg->all_blocks.len);
+    struct DfsStackItem *stack = malloc(sizeof(stack[0]) * cfg->all_blocks.len);  // NOLINT
+    int depth = 0;
+
+    stack[depth++] = (struct DfsStackItem){ &cfg->start_block, 0 };
+    seen[cfg->start_block.index] = true;
+
+    while (depth > 0) {
+        CfBlock *b = stack[depth-1].block;
+        CfBlock *next = NULL;
+        if (b != &cfg->end_block) {
+            while (!next && stack[depth-1].nsuccessors_done < 2) {
+                CfBlock *succ = stack[depth-1].nsuccessors_done++ ? b->iffalse : b->iftrue;
+                if (!seen[succ->index])
+                    next = succ;
+            }
+        }
+
+        if (next) {
+            seen[next->index] = true;
+            stack[depth++] = (struct DfsStackItem){ next, 0 };
+        } else {
+            Append(&postorder, b);
+            depth--;
+        }
+    }
+
+    free(seen);
+    free(stack);
+
+    for (int i = 0, k = postorder.len - 1; i < k; i++, k--) {
+        CfBlock *tmp = postorder.ptr[i];
+        postorder.ptr[i] = postorder.ptr[k];
+        postorder.ptr[k] = tmp;
+    }
+    return postorder;
 }
 
-static int find_var_index(const CfGraph *cfg, const LocalVariable *v)
+static struct DataflowResult run_forward_dataflow(CfGraph *cfg, int nwords, const uint64_t *initial_state, TransferFunction transfer)
 {
-    for (int i = 0; i < cfg->locals.len; i++)
-        if (cfg->locals.ptr[i] == v)
-            return i;
-    assert(0);
+    compute_predecessors(cfg);
+    BlockList order = reverse_postorder(cfg);
+
+    int nblocks = cfg->all_blocks.len;
+    struct DataflowResult result = {
+        .nwords = nwords,
+        .start_states = calloc(sizeof(uint64_t), (size_t)nblocks * nwords),
+        .end_states = calloc(sizeof(uint64_t), (size_t)nblocks * nwords),
+    };
+
+    // Position of each block in the visiting order, -1 if unreachable
+    int *position = malloc(sizeof(position[0]) * nblocks);  // NOLINT
+    for (int i = 0; i < nblocks; i++)
+        position[i] = -1;
+    for (int i = 0; i < order.len; i++)
+        position[order.ptr[i]->index] = i;
+
+    char *pending = calloc(1, order.len);
+    pending[0] = true;  // start block
+    uint64_t *temp = malloc(sizeof(temp[0]) * nwords);
+
+    int pos = 0;
+    while (pos < order.len) {
+        if (!pending[pos]) {
+            pos++;
+            continue;
+        }
+        pending[pos] = false;
+
+        const CfBlock *b = order.ptr[pos];
+        uint64_t *start = &result.start_states[(size_t)b->index * nwords];
+        uint64_t *end = &result.end_states[(size_t)b->index * nwords];
+
+        if (b == &cfg->start_block)
+            memcpy(start, initial_state, sizeof(start[0]) * nwords);
+        for (CfBlock **pred = b->predecessors.ptr; pred < End(b->predecessors); pred++) {
+            const uint64_t *predend = &result.end_states[(size_t)(*pred)->index * nwords];
+            for (int i = 0; i < nwords; i++)
+                start[i] |= predend[i];
+        }
+
+        memcpy(temp, start, sizeof(temp[0]) * nwords);
+        transfer(cfg, b, temp);
+
+        bool changed = false;
+        for (int i = 0; i < nwords; i++) {
+            if ((end[i] | temp[i]) != end[i]) {
+                end[i] |= temp[i];
+                changed = true;
+            }
+        }
+
+        pos++;
+        if (changed && b != &cfg->end_block) {
+            // Blocks that come earlier in the order are loops. Go back to them.
+            for (int m = 0; m < 2; m++) {
+                int p = position[(m ? b->iffalse : b->iftrue)->index];
+                pending[p] = true;
+                if (p < pos)
+                    pos = p;
+            }
+        }
+    }
+
+    free(temp);
+    free(pending);
+    free(position);
+    free(order.ptr);
+    return result;
 }
 
+static void free_dataflow_result(const struct DataflowResult *r)
+{
+    free(r->start_states);
+    free(r->end_states);
+}
+
+
 enum VarStatus {
     VS_UNVISITED = 0,  // Don't know anything about this variable yet.
     VS_TRUE,  // This is a boolean variable that is set to True.
@@ -34,253 +182,151 @@ enum VarStatus {
 };
 
 /*
-a and b are statuses from different branches that both jump to the same block.
-Should have these properties:
-
-    merge(a, VS_UNVISITED) == a
-    merge(a, a) == a
-    merge(a, b) == merge(b, a)
-    merge(a, merge(b, c)) == merge(merge(a, b), c)
-
-In other words:
-- It makes sense to merge an unordered collection of statuses.
-- VS_UNVISITED corresponds with merging an empty set of statuses.
-- Having the same status several times doesn't affect anything.
+In the dataflow state, the status of a variable is a set of things it may
+hold. Each element of the set is a separate bitset over all variables, so
+a state is NUM_VAR_BITS bitsets of words_per_bitset(cfg) words each.
+
+When two branches jump to the same block, the statuses are merged with
+bitwise OR. Because it is a set union, merging an unordered collection of
+statuses makes sense, VS_UNVISITED (the empty set) corresponds with merging
+nothing, and having the same status several times doesn't affect anything.
 */
-static enum VarStatus merge(enum VarStatus a, enum VarStatus b)
+enum VarBit {
+    VB_GARBAGE,  // may be undefined
+    VB_TRUE,
+    VB_FALSE,
+    VB_OTHER_VALUE,  // may be some value other than True or False
+    VB_UNPREDICTABLE,
+    NUM_VAR_BITS,
+};
+
+static int words_per_bitset(const CfGraph *cfg)
 {
-    // Unvisited --> use the other status
-    if (a == VS_UNVISITED) return b;
-    if (b == VS_UNVISITED) return a;
+    return (cfg->locals.len + 63) / 64;
+}
 
-    // If any value in a merge is unpredictable or undefined, then the result is also
-    // unpredictable/undefined.
-    // If there are unpredictable and undefined values, the merge is unpredictable.
-    if (a == VS_UNPREDICTABLE || b == VS_UNPREDICTABLE) return VS_UNPREDICTABLE;
-    if (a == VS_UNDEFINED && b == VS_UNDEFINED) return VS_UNDEFINED;
-    if (a == VS_UNDEFINED || b == VS_UNDEFINED || a == VS_POSSIBLY_UNDEFINED || b == VS_POSSIBLY_UNDEFINED) return VS_POSSIBLY_UNDEFINED;
+static enum VarStatus get_status(const CfGraph *cfg, const uint64_t *state, const LocalVariable *v)
+{
+    int n = words_per_bitset(cfg);
+    bool bits[NUM_VAR_BITS];
+    for (int i = 0; i < NUM_VAR_BITS; i++)
+        bits[i] = (state[i*n + v->id/64] >> (v->id % 64)) & 1;
+
+    // If any merged status is unpredictable or undefined, then the result is also
+    // unpredictable/undefined. Unpredictable wins over undefined.
+    if (bits[VB_UNPREDICTABLE])
+        return VS_UNPREDICTABLE;
+    bool defined = bits[VB_TRUE] || bits[VB_FALSE] || bits[VB_OTHER_VALUE];
+    if (bits[VB_GARBAGE])
+        return defined ? VS_POSSIBLY_UNDEFINED : VS_UNDEFINED;
+    if (!defined)
+        return VS_UNVISITED;
 
     // At this point we know that the value is set to something. We may or may not know
     // what it is set to.
-    assert(a == VS_TRUE || a == VS_FALSE || a == VS_DEFINED);
-    assert(b == VS_TRUE || b == VS_FALSE || b == VS_DEFINED);
-    if (a == VS_TRUE && b == VS_TRUE) return VS_TRUE;
-    if (a == VS_FALSE && b == VS_FALSE) return VS_FALSE;
+    if (bits[VB_TRUE] && !bits[VB_FALSE] && !bits[VB_OTHER_VALUE])
+        return VS_TRUE;
+    if (bits[VB_FALSE] && !bits[VB_TRUE] && !bits[VB_OTHER_VALUE])
+        return VS_FALSE;
     return VS_DEFINED;
 }
 
-static bool merge_arrays_in_place(enum VarStatus *dest, const enum VarStatus *src, int n)
+static void set_status(const CfGraph *cfg, uint64_t *state, const LocalVariable *v, enum VarStatus status)
 {
-    bool did_something = false;
-    for (int i = 0; i < n; i++) {
-        enum VarStatus m = merge(src[i], dest[i]);
-        if (dest[i] != m) {
-            dest[i] = m;
-            did_something = true;
-        }
+    unsigned bits;
+    switch(status) {
+        case VS_UNVISITED: bits = 0; break;
+        case VS_TRUE: bits = 1 << VB_TRUE; break;
+        case VS_FALSE: bits = 1 << VB_FALSE; break;
+        case VS_DEFINED: bits = 1 << VB_OTHER_VALUE; break;
+        case VS_POSSIBLY_UNDEFINED: bits = (1 << VB_GARBAGE) | (1 << VB_OTHER_VALUE); break;
+        case VS_UNDEFINED: bits = 1 << VB_GARBAGE; break;
+        case VS_UNPREDICTABLE: bits = 1 << VB_UNPREDICTABLE; break;
+        default: assert(0);
     }
 
-    return did_something;
+    int n = words_per_bitset(cfg);
+    uint64_t mask = 1ULL << (v->id % 64);
+    for (int i = 0; i < NUM_VAR_BITS; i++) {
+        if (bits & (1 << i))
+            state[i*n + v->id/64] |= mask;
+        else
+            state[i*n + v->id/64] &= ~mask;
+    }
 }
 
 // Figure out how an instruction affects variables when it runs.
-static void update_statuses_with_instruction(const CfGraph *cfg, enum VarStatus *statuses, const CfInstruction *ins)
+static void update_statuses_with_instruction(const CfGraph *cfg, uint64_t *state, const CfInstruction *ins)
 {
-    for (int i = 0; i < cfg->locals.len; i++)
-        assert(statuses[i] != VS_UNVISITED);
-
     if (!ins->destvar)
         return;
 
-    int destidx = find_var_index(cfg, ins->destvar);
-    if (statuses[destidx] == VS_UNPREDICTABLE)
+    assert(get_status(cfg, state, ins->destvar) != VS_UNVISITED);
+    if (get_status(cfg, state, ins->destvar) == VS_UNPREDICTABLE)
         return;
 
+    enum VarStatus s;
     switch(ins->kind) {
     case CF_VARCPY:
-        statuses[destidx] = statuses[find_var_index(cfg, ins->operands[0])];
-        if (statuses[destidx] == VS_UNPREDICTABLE) {
+        s = get_status(cfg, state, ins->operands[0]);
+        if (s == VS_UNPREDICTABLE) {
             // Assume that unpredictable variables always yield non-garbage values.
             // Otherwise using functions like scanf() would be annoying.
-            statuses[destidx] = VS_DEFINED;
+            s = VS_DEFINED;
         }
+        set_status(cfg, state, ins->destvar, s);
         break;
     case CF_ADDRESS_OF_LOCAL_VAR:
-        statuses[find_var_index(cfg, ins->operands[0])] = VS_UNPREDICTABLE;
-        statuses[destidx] = VS_DEFINED;
+        set_status(cfg, state, ins->operands[0], VS_UNPREDICTABLE);
+        set_status(cfg, state, ins->destvar, VS_DEFINED);
         break;
     case CF_CONSTANT:
         if (ins->data.constant.kind == CONSTANT_BOOL)
-            statuses[destidx] = ins->data.constant.data.boolean ? VS_TRUE : VS_FALSE;
+            set_status(cfg, state, ins->destvar, ins->data.constant.data.boolean ? VS_TRUE : VS_FALSE);
         else
-            statuses[destidx] = VS_DEFINED;
+            set_status(cfg, state, ins->destvar, VS_DEFINED);
         break;
     default:
-        statuses[destidx] = VS_DEFINED;
+        set_status(cfg, state, ins->destvar, VS_DEFINED);
         break;
     }
 }
 
-#define DebugPrint 0  // change to 1 to see VarStatuses
-
-#if DebugPrint
-static const char * vs_to_string(enum VarStatus vs)
+static void update_statuses_with_block(const CfGraph *cfg, const CfBlock *block, uint64_t *state)
 {
-    switch(vs){
-        case VS_UNVISITED: return "unvisited";
-        case VS_TRUE: return "true";
-        case VS_FALSE: return "false";
-        case VS_DEFINED: return "defined";
-        case VS_POSSIBLY_UNDEFINED: return "possibly undef";
-        case VS_UNDEFINED: return "undef";
-        case VS_UNPREDICTABLE: return "unpredictable";
-    }
-    assert(0);
-}
-static void print_var_statuses(const CfGraph *cfg, enum VarStatus **statuses, const enum VarStatus *temp, const char *description)
-{
-    int nblocks = cfg->all_blocks.len;
-    int nvars = cfg->variables.len;
-
-    puts(description);
-    for (int blockidx = 0; blockidx < nblocks; blockidx++) {
-        printf("  block %d:\n", blockidx);
-        for (int i = 0; i < nvars; i++)
-            printf("    %-15s  %s\n", cfg->variables.ptr[i]->name, vs_to_string(statuses[blockidx][i]));
-    }
-    if(temp) {
-        printf("  temp:\n");
-        for (int i = 0; i < nvars; i++)
-            printf("    %-15s  %s\n", cfg->variables.ptr[i]->name, vs_to_string(temp[i]));
-    }
-    printf("\n");
-}
-#endif  // DebugPrint
-
-static bool all_zero(const char *ptr, int n)
-{
-    for (int i = 0; i < n; i++)
-        if (ptr[i])
-            return false;
-    return true;
+    for (const CfInstruction *ins = block->instructions.ptr; ins < End(block->instructions); ins++)
+        update_statuses_with_instruction(cfg, state, ins);
 }
 
 /*
-Figure out whether boolean variables are true or false.
-return_value[block_index][variable_index] = status of variable at END of block
-variable_index must be so that the variable has type bool.
-
-Idea: Initially mark everything as possible, so all variables can be true or false.
-Loop through instructions of start block, filtering out impossible options: for
-example, if a variable is set to True, then it can be True and cannot be False.
-Repeat for blocks where execution jumps from the current block, unless we got same
-result as last time, then we know that we don't have to reanalyze blocks where
-execution jumps from the current block.
+Figure out the status of each variable at the start and end of each block.
+Initially arguments are defined and other variables are undefined. Then
+each instruction changes the statuses: for example, if a variable is set to
+True, then it can be True and cannot be False.
 */
-static enum VarStatus **determine_var_statuses(const CfGraph *cfg)
+static struct DataflowResult determine_var_statuses(CfGraph *cfg)
 {
-#if DebugPrint
-    print_control_flow_graph(cfg);
-    printf("\n");
-#endif
-
-    int nblocks = cfg->all_blocks.len;
-    int nvars = cfg->locals.len;
-
-    enum VarStatus **result = malloc(sizeof(result[0]) * nblocks);  // NOLINT
-    for (int i = 0; i < nblocks; i++)
-        result[i] = calloc(sizeof(result[i][0]), nvars);
-
-    char *blocks_to_visit = calloc(1, nblocks);
-    blocks_to_visit[0] = true;  // visit initial block
-
-    enum VarStatus *tempstatus = malloc(nvars*sizeof(tempstatus[0]));
-
-    while(!all_zero(blocks_to_visit, nblocks)){
-        // Find a block to visit.
-        int visiting = 0;
-        while (!blocks_to_visit[visiting]) visiting++;
-#if DebugPrint
-        printf("=== Visit block %d ===\n", visiting);
-#endif
-        blocks_to_visit[visiting] = false;
-        const CfBlock *visitingblock = cfg->all_blocks.ptr[visiting];
-
-        // Determine initial values based on other blocks that jump here.
-        for (int i = 0; i < nvars; i++) {
-            if (visiting == 0) {
-                // start block
-                tempstatus[i] = cfg->locals.ptr[i]->is_argument ? VS_DEFINED : VS_UNDEFINED;
-            } else {
-                // What is possible in other blocks is determined based on only how
-                // they are jumped into.
-                tempstatus[i] = VS_UNVISITED;
-            }
-        }
+    int nwords = NUM_VAR_BITS * words_per_bitset(cfg);
+    uint64_t *initial = calloc(sizeof(initial[0]), nwords);
+    for (LocalVariable **v = cfg->locals.ptr; v < End(cfg->locals); v++)
+        set_status(cfg, initial, *v, (*v)->is_argument ? VS_DEFINED : VS_UNDEFINED);
 
-#if DebugPrint
-        print_var_statuses(cfg, result, tempstatus, "Initial");
-#endif
-
-        for (int i = 0; i < nblocks; i++) {
-            if (cfg->all_blocks.ptr[i]->iftrue == visitingblock
-                || cfg->all_blocks.ptr[i]->iffalse == visitingblock)
-            {
-                // TODO: If we only get here from the true jump, or only from false
-                // jump, we could assume that the variable used in the jump was true/false.
-                merge_arrays_in_place(tempstatus, result[i], nvars);
-            }
-        }
-
-#if DebugPrint
-        print_var_statuses(cfg, result, tempstatus, "After adding from other blocks to temp");
-#endif
-
-        // Turn the initial status into status at end of the block.
-        const CfInstruction *ins;
-        for (ins = visitingblock->instructions.ptr; ins < End(visitingblock->instructions); ins++)
-        {
-            update_statuses_with_instruction(cfg, tempstatus, ins);
-        }
-
-        // Update what we learned about variable status at end of this block.
-        bool result_affected = merge_arrays_in_place(result[visiting], tempstatus, nvars);
-#if DebugPrint
-        print_var_statuses(cfg, result, NULL, "At end");
-#endif
-
-        if (result_affected && visitingblock != &cfg->end_block) {
-            // Also need to update blocks where we jump from here.
-#if DebugPrint
-            printf("  Will visit %d and %d\n", find_block_index(cfg, visitingblock->iftrue), find_block_index(cfg, visitingblock->iffalse));
-#endif
-            blocks_to_visit[find_block_index(cfg, visitingblock->iftrue)] = true;
-            blocks_to_visit[find_block_index(cfg, visitingblock->iffalse)] = true;
-        }
-    }
-
-    free(blocks_to_visit);
-    free(tempstatus);
+    struct DataflowResult result = run_forward_dataflow(cfg, nwords, initial, update_statuses_with_block);
+    free(initial);
     return result;
 }
 
-static void free_var_statuses(const CfGraph *cfg, enum VarStatus** statuses)
-{
-    for (int i = 0; i < cfg->all_blocks.len; i++)
-        free(statuses[i]);
-    free(statuses);
-}
-
 static void clean_jumps_where_condition_always_true_or_always_false(CfGraph *cfg)
 {
-    enum VarStatus **statuses = determine_var_statuses(cfg);
+    struct DataflowResult statuses = determine_var_statuses(cfg);
 
-    for (int blockidx = 0; blockidx < cfg->all_blocks.len; blockidx++) {
-        CfBlock *block = cfg->all_blocks.ptr[blockidx];
+    for (CfBlock **b = cfg->all_blocks.ptr; b < End(cfg->all_blocks); b++) {
+        CfBlock *block = *b;
         if (block == &cfg->end_block || block->iftrue == block->iffalse)
             continue;
 
-        switch(statuses[blockidx][find_var_index(cfg, block->branchvar)]) {
+        const uint64_t *end = &statuses.end_states[(size_t)block->index * statuses.nwords];
+        switch(get_status(cfg, end, block->branchvar)) {
         case VS_TRUE:
             // Always jump to true case.
             block->iffalse = block->iftrue;
@@ -293,7 +339,7 @@ static void clean_jumps_where_condition_always_true_or_always_false(CfGraph *cfg
             break;
         }
     }
-    free_var_statuses(cfg, statuses);
+    free_dataflow_result(&statuses);
 }
 
 /*
@@ -383,20 +429,22 @@ static void show_unreachable_warnings(CfBlock **unreachable_blocks, int n_unreac
 
 static void remove_given_blocks(CfGraph *cfg, CfBlock **blocks_to_remove, int n_blocks_to_remove)
 {
+    char *shouldgo = calloc(1, cfg->all_blocks.len);
+    for (CfBlock **b = blocks_to_remove; b < &blocks_to_remove[n_blocks_to_remove]; b++)
+        shouldgo[(*b)->index] = true;
+
     for (int i = cfg->all_blocks.len - 1; i >= 0; i--) {
-        bool shouldgo = false;
-        for (CfBlock **b = blocks_to_remove; b < &blocks_to_remove[n_blocks_to_remove]; b++) {
-            if(*b==cfg->all_blocks.ptr[i]){
-                shouldgo=true;
-                break;
-            }
-        }
-        if(shouldgo)
-        {
+        if (shouldgo[i]) {
             free_control_flow_graph_block(cfg, cfg->all_blocks.ptr[i]);
-            cfg->all_blocks.ptr[i]=Pop(&cfg->all_blocks);
+            CfBlock *last = Pop(&cfg->all_blocks);
+            if (i < cfg->all_blocks.len) {
+                cfg->all_blocks.ptr[i] = last;
+                last->index = i;
+            }
         }
     }
+
+    free(shouldgo);
 }
 
 static void remove_unreachable_blocks(CfGraph *cfg)
@@ -412,8 +460,8 @@ static void remove_unreachable_blocks(CfGraph *cfg)
         reachable[i] = true;
 
         if (cfg->all_blocks.ptr[i] != &cfg->end_block) {
-            Append(&todo, find_block_index(cfg, cfg->all_blocks.ptr[i]->iftrue));
-            Append(&todo, find_block_index(cfg, cfg->all_blocks.ptr[i]->iffalse));
+            Append(&todo, cfg->all_blocks.ptr[i]->iftrue->index);
+            Append(&todo, cfg->all_blocks.ptr[i]->iffalse->index);
         }
     }
     free(todo.ptr);
@@ -436,16 +484,20 @@ static void remove_unused_variables(CfGraph *cfg)
     for (CfBlock **b = cfg->all_blocks.ptr; b < End(cfg->all_blocks); b++) {
         for (CfInstruction *ins = (*b)->instructions.ptr; ins < End((*b)->instructions); ins++) {
             if (ins->destvar)
-                used[find_var_index(cfg, ins->destvar)] = true;
+                used[ins->destvar->id] = true;
             for (int i = 0; i < ins->noperands; i++)
-                used[find_var_index(cfg, ins->operands[i])] = true;
+                used[ins->operands[i]->id] = true;
         }
     }
 
     for (int i = cfg->locals.len - 1; i>=0; i--) {
         if (!used[i] && !cfg->locals.ptr[i]->is_argument) {
             free(cfg->locals.ptr[i]);
-            cfg->locals.ptr[i] = Pop(&cfg->locals);
+            LocalVariable *last = Pop(&cfg->locals);
+            if (i < cfg->locals.len) {
+                cfg->locals.ptr[i] = last;
+                last->id = i;
+            }
         }
     }
 
@@ -454,14 +506,16 @@ static void remove_unused_variables(CfGraph *cfg)
 
 static void warn_about_undefined_variables(CfGraph *cfg)
 {
-    enum VarStatus **statuses = determine_var_statuses(cfg);
-
-    for (int blockidx = 0; blockidx < cfg->all_blocks.len; blockidx++) {
-        const CfBlock *b = cfg->all_blocks.ptr[blockidx];
-        enum VarStatus *status = statuses[blockidx];
-        for (CfInstruction *ins = b->instructions.ptr; ins < End(b->instructions); ins++) {
-            for (int i = 0; i < ins->noperands; i++) {
-                switch(status[find_var_index(cfg, ins->operands[i])]) {
+    struct DataflowResult statuses = determine_var_statuses(cfg);
+    uint64_t *state = malloc(sizeof(state[0]) * statuses.nwords);
+
+    for (CfBlock **b = cfg->all_blocks.ptr; b < End(cfg->all_blocks); b++) {
+        memcpy(state, &statuses.start_states[(size_t)(*b)->index * statuses.nwords], sizeof(state[0]) * statuses.nwords);
+        for (CfInstruction *ins = (*b)->instructions.ptr; ins < End((*b)->instructions); ins++) {
+            // Taking the address of a variable doesn't use its value, e.g. scanf("%d", &x)
+            int noperands = (ins->kind == CF_ADDRESS_OF_LOCAL_VAR) ? 0 : ins->noperands;
+            for (int i = 0; i < noperands; i++) {
+                switch(get_status(cfg, state, ins->operands[i])) {
                 case VS_UNVISITED:
                     assert(0);
                 case VS_TRUE:
@@ -484,11 +538,12 @@ static void warn_about_undefined_variables(CfGraph *cfg)
                     break;
                 }
             }
-            update_statuses_with_instruction(cfg, status, ins);
+            update_statuses_with_instruction(cfg, state, ins);
         }
     }
 
-    free_var_statuses(cfg, statuses);
+    free(state);
+    free_dataflow_result(&statuses);
 }
 
 static void error_about_missing_return(CfGraph *cfg)
@@ -496,19 +551,19 @@ static void error_about_missing_return(CfGraph *cfg)
     if (!cfg->signature.returntype)
         return;
 
-    enum VarStatus **statuses = determine_var_statuses(cfg);
+    struct DataflowResult statuses = determine_var_statuses(cfg);
 
     // When a function returns a value, it is stored in a variable named "return".
-    int varidx = -1;
-    for (int i = 0; i < cfg->locals.len; i++) {
-        if (!strcmp(cfg->locals.ptr[i]->name, "return")) {
-            varidx = i;
+    const LocalVariable *var = NULL;
+    for (LocalVariable **v = cfg->locals.ptr; v < End(cfg->locals); v++) {
+        if (!strcmp((*v)->name, "return")) {
+            var = *v;
             break;
         }
     }
-    assert(varidx != -1);
+    assert(var);
 
-    enum VarStatus s = statuses[find_block_index(cfg, &cfg->end_block)][varidx];
+    enum VarStatus s = get_status(cfg, &statuses.end_states[(size_t)cfg->end_block.index * statuses.nwords], var);
     if (s == VS_POSSIBLY_UNDEFINED) {
         show_warning(
             cfg->signature.returntype_location,
@@ -518,10 +573,10 @@ static void error_about_missing_return(CfGraph *cfg)
         fail_with_error(
             cfg->signature.returntype_location,
             "function '%s' must return a value, because it is defined with '-> %s'",
-            cfg->signature.name, cfg->signature.returntype->name);
+            cfg->signature.name, type_name(cfg->signature.returntype));
     }
 
-    free_var_statuses(cfg, statuses);
+    free_dataflow_result(&statuses);
 }
 
 static void simplify_cfg(CfGraph *cfg)
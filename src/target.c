@@ -36,9 +36,7 @@ void init_target(void)
     assert(!error);
     assert(target.target_ref);
 
-    target.target_machine_ref = LLVMCreateTargetMachine(
-        target.target_ref, target.triple, "x86-64", "", LLVMCodeGenLevelDefault, LLVMRelocDefault, LLVMCodeModelDefault);
-    assert(target.target_machine_ref);
+    target.target_machine_ref = create_target_machine();
 
     target.target_data_ref = LLVMCreateTargetDataLayout(target.target_machine_ref);
     assert(target.target_data_ref);
@@ -51,6 +49,15 @@ void init_target(void)
     atexit(cleanup);
 }
 
+LLVMTargetMachineRef create_target_machine(void)
+{
+    assert(target.target_ref);
+    LLVMTargetMachineRef result = LLVMCreateTargetMachine(
+        target.target_ref, target.triple, "x86-64", "", LLVMCodeGenLevelDefault, LLVMRelocDefault, LLVMCodeModelDefault);
+    assert(result);
+    return result;
+}
+
 const struct Target *get_target(void)
 {
     return &target;
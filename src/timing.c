@@ -0,0 +1,214 @@
+// Implementation of --time-report.
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #define _POSIX_C_SOURCE 200112L
+    #include <sys/resource.h>
+    #include <time.h>
+#endif
+
+#include <ctype.h>
+#include <pthread.h>
+#include "jou_compiler.h"
+#include "util.h"
+
+static const char *phase_names[] = {
+    [PHASE_TOKENIZE] = "tokenize",
+    [PHASE_PARSE] = "parse",
+    [PHASE_TYPECHECK_STAGE1] = "typecheck stage 1",
+    [PHASE_TYPECHECK_STAGE2] = "typecheck stage 2",
+    [PHASE_TYPECHECK_STAGE3] = "typecheck stage 3",
+    [PHASE_BUILD_CFG] = "build CFG",
+    [PHASE_SIMPLIFY_CFG] = "simplify CFG",
+    [PHASE_CODEGEN] = "codegen",
+    [PHASE_VERIFY] = "verify LLVM IR",
+    [PHASE_LINK_MODULES] = "link LLVM modules",
+    [PHASE_OPTIMIZE] = "optimize",
+    [PHASE_EMIT] = "emit object file",
+    [PHASE_LINK] = "link",
+    [PHASE_JIT] = "JIT compile",
+};
+static_assert(sizeof phase_names / sizeof phase_names[0] == NUM_PHASES, "phase_names is missing something");
+
+struct PhaseStats {
+    double seconds;
+    long peak_rss_delta_kb;
+};
+
+struct FileStats {
+    char *filename;  // NULL for things that don't belong to a file, such as linking
+    struct PhaseStats phases[NUM_PHASES];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static List(struct FileStats) stats;
+
+static double get_time(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, freq;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&freq);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+#endif
+}
+
+// Largest amount of memory the process has used so far, in kilobytes.
+static long get_peak_rss_kb(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc))
+        return 0;
+    return pmc.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;  // bytes on macos
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+struct PhaseTimer start_phase(void)
+{
+    if (!command_line_args.time_report)
+        return (struct PhaseTimer){0};
+    return (struct PhaseTimer){ .start_time = get_time(), .start_peak_rss_kb = get_peak_rss_kb() };
+}
+
+static struct FileStats *find_or_add_file(const char *filename)
+{
+    for (struct FileStats *fs = stats.ptr; fs < End(stats); fs++) {
+        if (fs->filename == NULL ? filename == NULL : filename && !strcmp(fs->filename, filename))
+            return fs;
+    }
+    Append(&stats, (struct FileStats){ .filename = filename ? strdup(filename) : NULL });
+    return End(stats) - 1;
+}
+
+void end_phase(struct PhaseTimer timer, const char *filename, enum CompilePhase phase)
+{
+    if (!command_line_args.time_report)
+        return;
+
+    double seconds = get_time() - timer.start_time;
+    long rss_delta = get_peak_rss_kb() - timer.start_peak_rss_kb;
+
+    pthread_mutex_lock(&lock);
+    struct FileStats *fs = find_or_add_file(filename);
+    fs->phases[phase].seconds += seconds;
+    fs->phases[phase].peak_rss_delta_kb += rss_delta;
+    pthread_mutex_unlock(&lock);
+}
+
+static struct FileStats compute_total(void)
+{
+    struct FileStats total = {0};
+    for (const struct FileStats *fs = stats.ptr; fs < End(stats); fs++) {
+        for (int p = 0; p < NUM_PHASES; p++) {
+            total.phases[p].seconds += fs->phases[p].seconds;
+            total.phases[p].peak_rss_delta_kb += fs->phases[p].peak_rss_delta_kb;
+        }
+    }
+    return total;
+}
+
+static void print_text_stats(const char *title, const struct FileStats *fs)
+{
+    printf("%s:\n", title);
+    double total_seconds = 0;
+    for (int p = 0; p < NUM_PHASES; p++) {
+        if (fs->phases[p].seconds == 0 && fs->phases[p].peak_rss_delta_kb == 0)
+            continue;
+        printf("  %-20s %10.3f ms %+10ld KB\n", phase_names[p], fs->phases[p].seconds*1000, fs->phases[p].peak_rss_delta_kb);
+        total_seconds += fs->phases[p].seconds;
+    }
+    printf("  %-20s %10.3f ms\n", "(all phases)", total_seconds*1000);
+}
+
+static void print_json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+static void print_json_stats(const struct FileStats *fs)
+{
+    printf("{");
+    for (int p = 0; p < NUM_PHASES; p++) {
+        // e.g. "typecheck stage 1" --> "typecheck_stage_1"
+        printf("%s\"", p ? ", " : "");
+        for (const char *c = phase_names[p]; *c; c++)
+            putchar(*c == ' ' ? '_' : tolower(*c));
+        printf("\": {\"seconds\": %.6f, \"peak_rss_delta_kb\": %ld}", fs->phases[p].seconds, fs->phases[p].peak_rss_delta_kb);
+    }
+    printf("}");
+}
+
+void print_time_report(void)
+{
+    if (!command_line_args.time_report)
+        return;
+
+    struct FileStats total = compute_total();
+    const struct FileStats *other = NULL;
+
+    if (command_line_args.time_report_json) {
+        printf("{\"files\": [");
+        bool first = true;
+        for (const struct FileStats *fs = stats.ptr; fs < End(stats); fs++) {
+            if (!fs->filename) {
+                other = fs;
+                continue;
+            }
+            printf("%s\n  {\"path\": ", first ? "" : ",");
+            print_json_string(fs->filename);
+            printf(", \"phases\": ");
+            print_json_stats(fs);
+            printf("}");
+            first = false;
+        }
+        printf("],\n \"other\": ");
+        print_json_stats(other ? other : &(struct FileStats){0});
+        printf(",\n \"total\": ");
+        print_json_stats(&total);
+        printf("}\n");
+    } else {
+        printf("===== Time report (wall time, growth of peak memory usage) =====\n");
+        for (const struct FileStats *fs = stats.ptr; fs < End(stats); fs++) {
+            if (fs->filename)
+                print_text_stats(fs->filename, fs);
+            else
+                other = fs;
+        }
+        if (other)
+            print_text_stats("Not specific to a file", other);
+        print_text_stats("Total", &total);
+        if (command_line_args.njobs > 1)
+            printf("Note: with -j, files are compiled in parallel, so the total is more than the elapsed time.\n");
+    }
+
+    for (struct FileStats *fs = stats.ptr; fs < End(stats); fs++)
+        free(fs->filename);
+    free(stats.ptr);
+    memset(&stats, 0, sizeof stats);
+    fflush(stdout);
+}
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -12,58 +13,56 @@
 #include "jou_compiler.h"
 #include "util.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 struct State {
-    FILE *f;
+    const char *pos;  // next byte to read, the source ends with '\0'
+    const char *bad_byte;  // where the source was cut at a zero byte or a lone '\r', or NULL
+    char bad_byte_value;
     Location location;
-    List(char) pushback;
+    uint32_t filename;  // interned location.filename
     // Not dynamic, so that you can't make the compiler crash due to
     // too much recursion by feeding it lots of parentheses.
     Token parens[50];
     int nparens;
 };
 
-static char read_byte(struct State *st) {
-    int c;
-    if (st->pushback.len != 0) {
-        c = Pop(&st->pushback);
-        goto got_char;
-    }
-
-    c = fgetc(st->f);
-    if (c == EOF && ferror(st->f))
-        fail_with_error(st->location, "cannot read file: %s", strerror(errno));
-
-    // For Windows: \r\n in source file is treated same as \n
-    if (c == '\r') {
-        c = fgetc(st->f);
-        if (c == EOF && ferror(st->f))
-            fail_with_error(st->location, "cannot read file: %s", strerror(errno));
-        if (c != '\n')
+/*
+Bad bytes are reported when the tokenizer gets to them, so that errors come
+in the same order as they are in the file. Everything that stops at the end
+of the source must call this before complaining about what it has read.
+*/
+static void check_for_bad_byte(const struct State *st, const char *p)
+{
+    if (p == st->bad_byte) {
+        if (st->bad_byte_value == '\0')
+            fail_with_error(st->location, "source file contains a zero byte");
+        else
             fail_with_error(st->location, "source file contains a CR byte ('\\r') that isn't a part of a CRLF line ending");
     }
+}
 
-    // Use the zero byte to represent end of file.
-    if (c == '\0')
-        fail_with_error(st->location, "source file contains a zero byte");  // TODO: test this
-    if (c == EOF) {
-        assert(!ferror(st->f));
-        return '\0';
+static char read_byte(struct State *st) {
+    char c = *st->pos;
+    if (c == '\0') {
+        check_for_bad_byte(st, st->pos);
+        return '\0';  // end of file, don't move past it
     }
-
-got_char:
+    st->pos++;
     if (c == '\n')
         st->location.lineno++;
     return c;
 }
 
-// Can't use ungetc() because it is only guaranteed to work for one byte.
 static void unread_byte(struct State *st, char c)
 {
     if (c == '\0')
         return;
-    assert(c!='\r');  // c should be from read_byte()
-    Append(&st->pushback, c);
+    st->pos--;
+    assert(*st->pos == c);  // c should be from read_byte()
     if (c == '\n')
         st->location.lineno--;
 }
@@ -73,41 +72,163 @@ static bool is_identifier_or_number_byte(char c)
     return ('A'<=c && c<='Z') || ('a'<=c && c<='z') || c=='_' || ('0'<=c && c<='9');
 }
 
-static void read_identifier_or_number(struct State *st, char firstbyte, char (*dest)[100])
+/*
+The functions below find the end of a run of similar bytes, such as an
+identifier or a comment. They are where the tokenizer spends most of its
+time, so with SSE2 (always available on x86_64) they check 16 bytes at a
+time. The scalar loops do the same thing one byte at a time.
+
+Reading 16 bytes at a time is fine even near the end of the source, because
+prepare_source() adds zero bytes after the end, and all these functions stop
+at a zero byte.
+*/
+#define SCAN_PADDING 16
+
+// Skips bytes that can appear in identifiers and numbers.
+static const char *skip_identifier_bytes(const char *p)
 {
-    memset(*dest, 0, sizeof *dest);
-    int destlen = 0;
+#ifdef __SSE2__
+    const __m128i bit20 = _mm_set1_epi8(0x20);
+    const __m128i before_a = _mm_set1_epi8('a' - 1), after_z = _mm_set1_epi8('z' + 1);
+    const __m128i before_0 = _mm_set1_epi8('0' - 1), after_9 = _mm_set1_epi8('9' + 1);
+    const __m128i underscores = _mm_set1_epi8('_');
+    while(1) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        // Setting the 0x20 bit makes uppercase letters lowercase, and doesn't turn anything else into a letter.
+        // Bytes >= 0x80 are negative, so they are not in any of these ranges.
+        __m128i lower = _mm_or_si128(bytes, bit20);
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, before_a), _mm_cmplt_epi8(lower, after_z));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(bytes, before_0), _mm_cmplt_epi8(bytes, after_9));
+        __m128i underscore = _mm_cmpeq_epi8(bytes, underscores);
+        int mask = ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter, digit), underscore)) & 0xffff;
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#else
+    while (is_identifier_or_number_byte(*p))
+        p++;
+    return p;
+#endif
+}
 
-    assert(is_identifier_or_number_byte(firstbyte));
-    (*dest)[destlen++] = firstbyte;
+// Skips space characters.
+static const char *skip_spaces(const char *p)
+{
+#ifdef __SSE2__
+    const __m128i spaces = _mm_set1_epi8(' ');
+    while(1) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, spaces)) & 0xffff;
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#else
+    while (*p == ' ')
+        p++;
+    return p;
+#endif
+}
 
+// Finds the next newline or the end of the source.
+static const char *find_end_of_line(const char *p)
+{
+#ifdef __SSE2__
+    const __m128i newlines = _mm_set1_epi8('\n');
+    const __m128i zeros = _mm_setzero_si128();
     while(1) {
-        char c = read_byte(st);
-        if (is_identifier_or_number_byte(c)
-            || ('0'<=firstbyte && firstbyte<='9' && c=='.')
-            || ('0'<=firstbyte && firstbyte<='9' && (*dest)[destlen-1]=='e' && c=='-'))
-        {
-            if (destlen == sizeof *dest - 1)
-                fail_with_error(st->location, "name is too long: %.20s...", *dest);
-            (*dest)[destlen++] = c;
-        } else {
-            unread_byte(st, c);
-            return;
-        }
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        __m128i found = _mm_or_si128(_mm_cmpeq_epi8(bytes, newlines), _mm_cmpeq_epi8(bytes, zeros));
+        int mask = _mm_movemask_epi8(found);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
     }
+#else
+    while (*p != '\n' && *p != '\0')
+        p++;
+    return p;
+#endif
 }
 
-static void consume_rest_of_line(struct State *st)
+// Finds the next byte that needs special handling inside a string or byte literal.
+static const char *find_special_string_byte(const char *p, char quote)
 {
+#ifdef __SSE2__
+    const __m128i quotes = _mm_set1_epi8(quote);
+    const __m128i backslashes = _mm_set1_epi8('\\');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    const __m128i zeros = _mm_setzero_si128();
     while(1) {
-        char c = read_byte(st);
-        if (c == '\n') {
-            unread_byte(st, '\n');
-            return;
-        }
-        if (c == '\0')  // end of file
-            return;
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        __m128i found = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, quotes), _mm_cmpeq_epi8(bytes, backslashes)),
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, newlines), _mm_cmpeq_epi8(bytes, zeros)));
+        int mask = _mm_movemask_epi8(found);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#else
+    while (*p != quote && *p != '\\' && *p != '\n' && *p != '\0')
+        p++;
+    return p;
+#endif
+}
+
+// Finds the next '\r' or zero byte in the file, or returns end. Unlike the
+// functions above, this runs before the padding has been added.
+static const char *find_cr_or_zero(const char *p, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i crs = _mm_set1_epi8('\r');
+    const __m128i zeros = _mm_setzero_si128();
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        __m128i found = _mm_or_si128(_mm_cmpeq_epi8(bytes, crs), _mm_cmpeq_epi8(bytes, zeros));
+        int mask = _mm_movemask_epi8(found);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '\r' && *p != '\0')
+        p++;
+    return p;
+}
+
+// Assumes that firstbyte has been read already.
+static void read_identifier_or_number(struct State *st, char firstbyte, char (*dest)[100])
+{
+    assert(is_identifier_or_number_byte(firstbyte));
+    assert(st->pos[-1] == firstbyte);
+    bool is_number = ('0'<=firstbyte && firstbyte<='9');
+
+    const char *start = st->pos - 1;
+    const char *end = st->pos;
+    while(1) {
+        end = skip_identifier_bytes(end);
+        if (is_number && (*end == '.' || (*end == '-' && end[-1] == 'e')))
+            end++;
+        else
+            break;
     }
+    check_for_bad_byte(st, end);
+
+    memset(*dest, 0, sizeof *dest);
+    if (end - start >= (ptrdiff_t)sizeof *dest) {
+        memcpy(*dest, start, 20);
+        fail_with_error(st->location, "name is too long: %.20s...", *dest);
+    }
+    memcpy(*dest, start, end - start);
+    st->pos = end;
+}
+
+static void consume_rest_of_line(struct State *st)
+{
+    // There are no newlines before the end of the line, so lineno doesn't change.
+    st->pos = find_end_of_line(st->pos);
 }
 
 // Assumes that the initial '\n' byte has been read already.
@@ -117,10 +238,12 @@ static int read_indentation_level_for_newline_token(struct State *st)
 {
     int level = 0;
     while(1) {
+        const char *p = skip_spaces(st->pos);
+        level += p - st->pos;
+        st->pos = p;
+
         char c = read_byte(st);
-        if (c == ' ')
-            level++;
-        else if (c == '\n')
+        if (c == '\n')
             level = 0;
         else if (c == '#')
             consume_rest_of_line(st);
@@ -212,24 +335,54 @@ static bool is_valid_float(const char *str)
     return result;
 }
 
-static bool is_keyword(const char *s)
+static const char *const keyword_names[] = {
+    // This keyword list is in 3 places. Please keep them in sync:
+    //   - the Jou compiler written in C (also update enum Keyword)
+    //   - self-hosted compiler
+    //   - syntax documentation
+    [KEYWORD_FROM]="from", [KEYWORD_IMPORT]="import",
+    [KEYWORD_DEF]="def", [KEYWORD_DECLARE]="declare", [KEYWORD_CLASS]="class", [KEYWORD_ENUM]="enum", [KEYWORD_GLOBAL]="global",
+    [KEYWORD_RETURN]="return", [KEYWORD_IF]="if", [KEYWORD_ELIF]="elif", [KEYWORD_ELSE]="else", [KEYWORD_WHILE]="while",
+    [KEYWORD_FOR]="for", [KEYWORD_BREAK]="break", [KEYWORD_CONTINUE]="continue",
+    [KEYWORD_TRUE]="True", [KEYWORD_FALSE]="False", [KEYWORD_NULL]="NULL", [KEYWORD_SELF]="self",
+    [KEYWORD_AND]="and", [KEYWORD_OR]="or", [KEYWORD_NOT]="not", [KEYWORD_AS]="as", [KEYWORD_SIZEOF]="sizeof",
+    [KEYWORD_VOID]="void", [KEYWORD_BOOL]="bool", [KEYWORD_BYTE]="byte", [KEYWORD_INT]="int",
+    [KEYWORD_LONG]="long", [KEYWORD_FLOAT]="float", [KEYWORD_DOUBLE]="double",
+};
+
+// Returns -1 if the name is not a keyword.
+static int find_keyword(const char *name)
 {
-    const char *keywords[] = {
-        // This keyword list is in 3 places. Please keep them in sync:
-        //   - the Jou compiler written in C
-        //   - self-hosted compiler
-        //   - syntax documentation
-        "from", "import",
-        "def", "declare", "class", "enum", "global",
-        "return", "if", "elif", "else", "while", "for", "break", "continue",
-        "True", "False", "NULL", "self",
-        "and", "or", "not", "as", "sizeof",
-        "void", "bool", "byte", "int", "long", "float", "double",
+    /*
+    This runs for every name in the file, so we compare only with the keywords
+    that start with the same byte. Each row is a count followed by keywords.
+    */
+    static const int8_t keywords_by_first_byte[256][4] = {
+        ['a'] = { 2, KEYWORD_AND, KEYWORD_AS },
+        ['b'] = { 3, KEYWORD_BOOL, KEYWORD_BREAK, KEYWORD_BYTE },
+        ['c'] = { 2, KEYWORD_CLASS, KEYWORD_CONTINUE },
+        ['d'] = { 3, KEYWORD_DEF, KEYWORD_DECLARE, KEYWORD_DOUBLE },
+        ['e'] = { 3, KEYWORD_ELIF, KEYWORD_ELSE, KEYWORD_ENUM },
+        ['f'] = { 3, KEYWORD_FLOAT, KEYWORD_FOR, KEYWORD_FROM },
+        ['g'] = { 1, KEYWORD_GLOBAL },
+        ['i'] = { 3, KEYWORD_IF, KEYWORD_IMPORT, KEYWORD_INT },
+        ['l'] = { 1, KEYWORD_LONG },
+        ['n'] = { 1, KEYWORD_NOT },
+        ['o'] = { 1, KEYWORD_OR },
+        ['r'] = { 1, KEYWORD_RETURN },
+        ['s'] = { 2, KEYWORD_SELF, KEYWORD_SIZEOF },
+        ['v'] = { 1, KEYWORD_VOID },
+        ['w'] = { 1, KEYWORD_WHILE },
+        ['F'] = { 1, KEYWORD_FALSE },
+        ['N'] = { 1, KEYWORD_NULL },
+        ['T'] = { 1, KEYWORD_TRUE },
     };
-    for (const char **kw = &keywords[0]; kw < &keywords[sizeof(keywords)/sizeof(keywords[0])]; kw++)
-        if (!strcmp(*kw, s))
-            return true;
-    return false;
+
+    const int8_t *row = keywords_by_first_byte[(unsigned char)name[0]];
+    for (int i = 1; i <= row[0]; i++)
+        if (!strcmp(keyword_names[row[i]], name))
+            return row[i];
+    return -1;
 }
 
 static char read_hex_escape_byte(struct State *st)
@@ -250,8 +403,14 @@ static char *read_string(struct State *st, char quote, int *len)
     List(char) result = {0};
 
     char c, after_backslash;
-    while( (c=read_byte(st)) != quote )
+    while(1)
     {
+        const char *special = find_special_string_byte(st->pos, quote);
+        while (st->pos < special)
+            Append(&result, *st->pos++);
+
+        if ((c=read_byte(st)) == quote)
+            break;
         switch(c) {
         case '\n':
             st->location.lineno--;  // to get error at the correct line number
@@ -344,19 +503,50 @@ static char read_char_literal(struct State *st)
 
 static const char operatorChars[] = "=<>!.,()[]{};:+-*/&%";
 
-static const char *read_operator(struct State *st)
+static const char *const operator_names[] = {
+    // This list of operators is in 3 places. Please keep them in sync:
+    //   - the Jou compiler written in C (also update enum Operator and operators_by_first_byte)
+    //   - self-hosted compiler
+    //   - syntax documentation
+    [OPERATOR_ELLIPSIS]="...",
+    [OPERATOR_EQ]="==", [OPERATOR_NE]="!=", [OPERATOR_ARROW]="->", [OPERATOR_LE]="<=", [OPERATOR_GE]=">=",
+    [OPERATOR_INCREMENT]="++", [OPERATOR_DECREMENT]="--",
+    [OPERATOR_ADD_ASSIGN]="+=", [OPERATOR_SUB_ASSIGN]="-=", [OPERATOR_MUL_ASSIGN]="*=", [OPERATOR_DIV_ASSIGN]="/=", [OPERATOR_MOD_ASSIGN]="%=",
+    [OPERATOR_DOUBLE_COLON]="::",
+    [OPERATOR_DOT]=".", [OPERATOR_COMMA]=",", [OPERATOR_COLON]=":", [OPERATOR_SEMICOLON]=";", [OPERATOR_ASSIGN]="=",
+    [OPERATOR_LPAREN]="(", [OPERATOR_RPAREN]=")", [OPERATOR_LBRACE]="{", [OPERATOR_RBRACE]="}",
+    [OPERATOR_LBRACKET]="[", [OPERATOR_RBRACKET]="]",
+    [OPERATOR_AMPERSAND]="&", [OPERATOR_MOD]="%", [OPERATOR_STAR]="*", [OPERATOR_DIV]="/",
+    [OPERATOR_ADD]="+", [OPERATOR_SUB]="-", [OPERATOR_LT]="<", [OPERATOR_GT]=">",
+};
+
+static enum Operator read_operator(struct State *st)
 {
-    const char *operators[] = {
-        // This list of operators is in 3 places. Please keep them in sync:
-        //   - the Jou compiler written in C
-        //   - self-hosted compiler
-        //   - syntax documentation
-        //
-        // Longer operators are first, so that '==' does not tokenize as '=' '='
-        "...", "===", "!==",
-        "==", "!=", "->", "<=", ">=", "++", "--", "+=", "-=", "*=", "/=", "%=", "::",
-        ".", ",", ":", ";", "=", "(", ")", "{", "}", "[", "]", "&", "%", "*", "/", "+", "-", "<", ">",
-        NULL,
+    /*
+    Operators that start with each byte, longest first, so that '==' does
+    not tokenize as '=' '='. Each row is a count followed by operators.
+    */
+    static const int8_t operators_by_first_byte[256][5] = {
+        ['.'] = { 2, OPERATOR_ELLIPSIS, OPERATOR_DOT },
+        ['='] = { 2, OPERATOR_EQ, OPERATOR_ASSIGN },
+        ['!'] = { 1, OPERATOR_NE },
+        ['-'] = { 4, OPERATOR_ARROW, OPERATOR_DECREMENT, OPERATOR_SUB_ASSIGN, OPERATOR_SUB },
+        ['<'] = { 2, OPERATOR_LE, OPERATOR_LT },
+        ['>'] = { 2, OPERATOR_GE, OPERATOR_GT },
+        ['+'] = { 3, OPERATOR_INCREMENT, OPERATOR_ADD_ASSIGN, OPERATOR_ADD },
+        ['*'] = { 2, OPERATOR_MUL_ASSIGN, OPERATOR_STAR },
+        ['/'] = { 2, OPERATOR_DIV_ASSIGN, OPERATOR_DIV },
+        ['%'] = { 2, OPERATOR_MOD_ASSIGN, OPERATOR_MOD },
+        [':'] = { 2, OPERATOR_DOUBLE_COLON, OPERATOR_COLON },
+        [','] = { 1, OPERATOR_COMMA },
+        [';'] = { 1, OPERATOR_SEMICOLON },
+        ['('] = { 1, OPERATOR_LPAREN },
+        [')'] = { 1, OPERATOR_RPAREN },
+        ['{'] = { 1, OPERATOR_LBRACE },
+        ['}'] = { 1, OPERATOR_RBRACE },
+        ['['] = { 1, OPERATOR_LBRACKET },
+        [']'] = { 1, OPERATOR_RBRACKET },
+        ['&'] = { 1, OPERATOR_AMPERSAND },
     };
 
     char operator[4] = {0};
@@ -371,15 +561,17 @@ static const char *read_operator(struct State *st)
         operator[strlen(operator)] = c;
     }
 
-    for (const char *const *op = operators; *op; op++) {
-        if (!strncmp(operator, *op, strlen(*op))) {
-            // Unread the bytes we didn't use.
-            for (int i = strlen(operator) - 1; i >= (int)strlen(*op); i--)
-                unread_byte(st, operator[i]);
-            // "===" and "!==" are here only to give a better error message to javascript people.
-            if (!strcmp(*op, "===") || !strcmp(*op, "!=="))
-                break;
-            return *op;
+    // "===" and "!==" are only checked to give a better error message to javascript people.
+    if (strcmp(operator, "===") && strcmp(operator, "!==")) {
+        const int8_t *row = operators_by_first_byte[(unsigned char)operator[0]];
+        for (int i = 1; i <= row[0]; i++) {
+            const char *op = operator_names[row[i]];
+            if (!strncmp(operator, op, strlen(op))) {
+                // Unread the bytes we didn't use.
+                for (int j = strlen(operator) - 1; j >= (int)strlen(op); j--)
+                    unread_byte(st, operator[j]);
+                return row[i];
+            }
         }
     }
 
@@ -394,30 +586,30 @@ static void handle_parentheses(struct State *st, const struct Token *t)
 
     if (t->type == TOKEN_END_OF_FILE && st->nparens > 0) {
         Token opentoken = st->parens[0];
-        char open = opentoken.data.operator[0];
+        char open = token_text(&opentoken)[0];
         char close = open2close[(int)open];
-        fail_with_error(opentoken.location, "'%c' without a matching '%c'", open, close);
+        fail_with_error(token_location(&opentoken), "'%c' without a matching '%c'", open, close);
     }
 
-    if (t->type == TOKEN_OPERATOR && strstr("[{(", t->data.operator)) {
+    if (t->type == TOKEN_OPERATOR && strstr("[{(", token_text(t))) {
         if (st->nparens == sizeof(st->parens)/sizeof(st->parens[0]))
-            fail_with_error(t->location, "too many nested parentheses");
+            fail_with_error(token_location(t), "too many nested parentheses");
         st->parens[st->nparens++] = *t;
     }
 
-    if (t->type == TOKEN_OPERATOR && strstr("]})", t->data.operator)) {
-        char close = t->data.operator[0];
+    if (t->type == TOKEN_OPERATOR && strstr("]})", token_text(t))) {
+        char close = token_text(t)[0];
         char open = close2open[(int)close];
 
-        if (st->nparens == 0 || st->parens[--st->nparens].data.operator[0] != open)
-            fail_with_error(t->location, "'%c' without a matching '%c'", close, open);
+        if (st->nparens == 0 || token_text(&st->parens[--st->nparens])[0] != open)
+            fail_with_error(token_location(t), "'%c' without a matching '%c'", close, open);
     }
 }
 
 static Token read_token(struct State *st)
 {
     while(1) {
-        Token t = { .location = st->location };
+        Token t = { .filename = st->filename, .lineno = st->location.lineno };
         char c = read_byte(st);
 
         switch(c) {
@@ -434,33 +626,46 @@ static Token read_token(struct State *st)
             handle_parentheses(st, &t);
             break;
         case '\'': t.type = TOKEN_CHAR; t.data.char_value = read_char_literal(st); break;
-        case '"': t.type = TOKEN_STRING; t.data.string_value = read_string(st, '"', NULL); break;
+        case '"':
+            {
+                char *s = read_string(st, '"', NULL);
+                t.type = TOKEN_STRING;
+                t.data.text = intern_string(s);
+                free(s);
+            }
+            break;
         default:
             if(is_identifier_or_number_byte(c)) {
-                read_identifier_or_number(st, c, &t.data.name);
-                if (is_keyword(t.data.name))
+                char name[100];
+                read_identifier_or_number(st, c, &name);
+                int kw = find_keyword(name);
+                if (kw != -1) {
                     t.type = TOKEN_KEYWORD;
-                else if ('0'<=t.data.name[0] && t.data.name[0]<='9') {
-                    if (is_valid_double(t.data.name)) {
+                    t.data.keyword = kw;
+                } else if ('0'<=name[0] && name[0]<='9') {
+                    if (is_valid_double(name)) {
                         t.type = TOKEN_DOUBLE;
-                    } else if (is_valid_float(t.data.name)) {
-                        t.data.name[strlen(t.data.name)-1] = '\0';  // remove 'F' or 'f' suffix
+                    } else if (is_valid_float(name)) {
+                        name[strlen(name)-1] = '\0';  // remove 'F' or 'f' suffix
                         t.type = TOKEN_FLOAT;
-                    } else if (t.data.name[strlen(t.data.name)-1] == 'L') {
-                        t.data.name[strlen(t.data.name)-1] = '\0';
+                    } else if (name[strlen(name)-1] == 'L') {
+                        name[strlen(name)-1] = '\0';
                         t.type = TOKEN_LONG;
-                        t.data.long_value = (int64_t)parse_integer(t.data.name, t.location, 64);
+                        long long value = parse_integer(name, token_location(&t), 64);
+                        snprintf(name, sizeof name, "%lld", value);
                     } else {
                         t.type = TOKEN_INT;
-                        t.data.int_value = (int32_t)parse_integer(t.data.name, t.location, 32);
+                        t.data.int_value = (int32_t)parse_integer(name, token_location(&t), 32);
                     }
                 } else {
                     t.type = TOKEN_NAME;
                 }
+                if (t.type != TOKEN_INT && t.type != TOKEN_KEYWORD)
+                    t.data.text = intern_string(name);
             } else if (strchr(operatorChars, c)) {
                 unread_byte(st, c);
                 t.type = TOKEN_OPERATOR;
-                strcpy(t.data.operator, read_operator(st));
+                t.data.operator = read_operator(st);
                 handle_parentheses(st, &t);
             } else {
                 if ((unsigned char)c < 0x80 && isprint(c))
@@ -474,82 +679,183 @@ static Token read_token(struct State *st)
     }
 }
 
-static Token *tokenize_without_indent_dedent_tokens(FILE *f, const char *filename)
-{
-    assert(f);
-    struct State st = { .location.filename=filename, .f = f };
-
-    /*
-    Add a fake newline to the beginning. It does a few things:
-      * Less special-casing: blank lines in the beginning of the file can
+/*
+Makes a copy of the source file that is easy to tokenize:
+  * \r\n is replaced with \n.
+  * The copy ends at the first zero byte or \r that isn't followed by \n,
+    so that '\0' can mark the end of the source. The bad byte goes to
+    st->bad_byte, and read_byte() reports it as an error when the tokenizer
+    gets there. This way, errors earlier in the file are shown first.
+  * A fake newline is added to the beginning. It does a few things:
+      - Less special-casing: blank lines in the beginning of the file can
         cause there to be a newline token anyway.
-      * It is easier to detect an unexpected indentation in the beginning
+      - It is easier to detect an unexpected indentation in the beginning
         of the file, as it becomes just like any other indentation.
-      * Line numbers start at 1.
-    */
-    Append(&st.pushback, '\n');
+      - Line numbers start at 1.
+*/
+static char *prepare_source(const char *data, size_t len, struct State *st)
+{
+    char *result = malloc(len + 2 + SCAN_PADDING);
+    char *out = result;
+    *out++ = '\n';
 
-    List(Token) tokens = {0};
-    while(tokens.len == 0 || tokens.ptr[tokens.len-1].type != TOKEN_END_OF_FILE)
-        Append(&tokens, read_token(&st));
+    const char *p = data;
+    const char *end = data + len;
+    while(1) {
+        const char *special = find_cr_or_zero(p, end);
+        memcpy(out, p, special - p);
+        out += special - p;
+        p = special;
 
-    free(st.pushback.ptr);
-    return tokens.ptr;
+        if (p == end)
+            break;
+        if (*p == '\r' && p+1 < end && p[1] == '\n') {
+            p++;  // skip \r, the \n gets copied
+            continue;
+        }
+
+        st->bad_byte = out;
+        st->bad_byte_value = *p;
+        break;
+    }
+
+    memset(out, 0, 1 + SCAN_PADDING);
+    return result;
 }
 
-// Add indent/dedent tokens after newline tokens that change the indentation level.
-static Token *handle_indentations(const Token *temp_tokens)
-{
-    List(Token) tokens = {0};
-    const Token *t = temp_tokens;
-    int level = 0;
+/*
+Tokens are created when the parser asks for them. A token stream stores
+only the few tokens that the parser can look ahead, so the whole file is
+never in memory as tokens.
+
+INDENT and DEDENT tokens are also created lazily: after a newline token,
+the stream emits indents or dedents until its indentation level matches
+the next line.
+*/
+#define LOOKAHEAD 4  // power of two, more than any n passed to peek_token()
+
+struct TokenStream {
+    struct State st;
+    char *source;
+    bool started;  // false until the fake newline token in the beginning has been skipped
+    int level, target_level;  // current indentation, and what it should become
+    Token indent_dedent;  // location for the next INDENT or DEDENT tokens
+    Location bad_indentation;  // first line indented by a non-multiple of 4, lineno 0 if none
+    bool at_end;
+    Token end_token;
+    Token ring[LOOKAHEAD];
+    int ringstart, ringlen;
+};
 
-    do{
-        if (t->type == TOKEN_END_OF_FILE) {
-            while(level) {
-                Append(&tokens, (Token){ .location=t->location, .type=TOKEN_DEDENT });
-                level -= 4;
-            }
+static Token produce_token(TokenStream *ts)
+{
+    while(1) {
+        if (ts->level < ts->target_level) {
+            ts->level += 4;
+            ts->indent_dedent.type = TOKEN_INDENT;
+            return ts->indent_dedent;
+        }
+        if (ts->level > ts->target_level) {
+            ts->level -= 4;
+            ts->indent_dedent.type = TOKEN_DEDENT;
+            return ts->indent_dedent;
+        }
+        if (ts->at_end)
+            return ts->end_token;  // forever, if someone keeps asking
+
+        Token t = read_token(&ts->st);
+
+        if (t.type == TOKEN_END_OF_FILE) {
+            // Other tokenizer errors come first, even if they are later in the file.
+            if (ts->bad_indentation.lineno != 0)
+                fail_with_error(ts->bad_indentation, "indentation must be a multiple of 4 spaces");
+            ts->at_end = true;
+            ts->end_token = t;
+            ts->target_level = 0;
+            ts->indent_dedent = (Token){ .filename=t.filename, .lineno=t.lineno };
+            continue;
         }
 
-        Append(&tokens, *t);
+        if (t.type == TOKEN_NEWLINE) {
+            ts->indent_dedent = (Token){ .filename=t.filename, .lineno=t.lineno + 1 };
+            if (t.data.indentation_level % 4 != 0 && ts->bad_indentation.lineno == 0)
+                ts->bad_indentation = token_location(&ts->indent_dedent);
+            // Rounding keeps INDENT and DEDENT tokens working until the error is shown.
+            ts->target_level = t.data.indentation_level / 4 * 4;
+        }
 
-        if (t->type == TOKEN_NEWLINE) {
-            Location after_newline = t->location;
-            after_newline.lineno++;
+        if (!ts->started) {
+            /*
+            Skip the fake newline token in the beginning (see prepare_source()).
 
-            if (t->data.indentation_level % 4 != 0)
-                fail_with_error(after_newline, "indentation must be a multiple of 4 spaces");
+            If the file has indentations after it, they are still represented by
+            indent tokens and parsing will fail.
+            */
+            assert(t.type == TOKEN_NEWLINE);
+            ts->started = true;
+            continue;
+        }
+        return t;
+    }
+}
 
-            while (level < t->data.indentation_level) {
-                Append(&tokens, (Token){ .location=after_newline, .type=TOKEN_INDENT });
-                level += 4;
-            }
+TokenStream *open_token_stream(const char *data, size_t len, const char *filename)
+{
+    TokenStream *ts = calloc(1, sizeof *ts);
+    ts->st = (struct State){ .location.filename=filename, .filename=intern_string(filename) };
+    ts->source = prepare_source(data, len, &ts->st);
+    ts->st.pos = ts->source;
+    return ts;
+}
 
-            while (level > t->data.indentation_level) {
-                Append(&tokens, (Token){ .location=after_newline, .type=TOKEN_DEDENT });
-                level -= 4;
-            }
+// The parser calls this many times for each token, so the common case must be fast.
+const Token *peek_token(TokenStream *ts, int n)
+{
+    if (n >= ts->ringlen) {
+        assert(0 <= n && n < LOOKAHEAD);
+        while (ts->ringlen <= n) {
+            ts->ring[(ts->ringstart + ts->ringlen) & (LOOKAHEAD - 1)] = produce_token(ts);
+            ts->ringlen++;
         }
-    } while (t++->type != TOKEN_END_OF_FILE);
+    }
+    return &ts->ring[(ts->ringstart + n) & (LOOKAHEAD - 1)];
+}
 
-    /*
-    Delete the newline token in the beginning.
+Token next_token(TokenStream *ts)
+{
+    Token t = *peek_token(ts, 0);
+    ts->ringstart = (ts->ringstart + 1) & (LOOKAHEAD - 1);
+    ts->ringlen--;
+    return t;
+}
 
-    If the file has indentations after it, they are now represented by separate
-    indent tokens and parsing will fail. If the file doesn't have any blank/comment
-    lines in the beginning, it has a newline token anyway to avoid special casing.
-    */
-    assert(tokens.ptr[0].type == TOKEN_NEWLINE);
-    memmove(&tokens.ptr[0], &tokens.ptr[1], sizeof(tokens.ptr[0]) * (tokens.len - 1));
+void close_token_stream(TokenStream *ts)
+{
+    free(ts->source);
+    free(ts);
+}
 
+Token *tokenize(const char *data, size_t len, const char *filename)
+{
+    TokenStream *ts = open_token_stream(data, len, filename);
+    List(Token) tokens = {0};
+    do {
+        Append(&tokens, next_token(ts));
+    } while (tokens.ptr[tokens.len - 1].type != TOKEN_END_OF_FILE);
+    close_token_stream(ts);
     return tokens.ptr;
 }
 
-Token *tokenize(FILE *f, const char *filename)
+Location token_location(const Token *t)
 {
-    Token *tokens1 = tokenize_without_indent_dedent_tokens(f, filename);
-    Token *tokens2 = handle_indentations(tokens1);
-    free(tokens1);
-    return tokens2;
+    return (Location){ .filename = get_interned_string(t->filename), .lineno = t->lineno };
+}
+
+const char *token_text(const Token *t)
+{
+    switch(t->type) {
+        case TOKEN_KEYWORD: return keyword_names[t->data.keyword];
+        case TOKEN_OPERATOR: return operator_names[t->data.operator];
+        default: return get_interned_string(t->data.text);
+    }
 }
@@ -1,38 +1,68 @@
 #include "jou_compiler.h"
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdnoreturn.h>
 
+/*
+The function or method whose body is being checked in stage 3, or NULL.
+Each thread checks its own function, see typecheck_stage3_check_body().
+*/
+static _Thread_local FunctionOrMethodTypes *current_fom_types = NULL;
+
+void add_type(FileTypes *ft, const Type *t, _Atomic bool *usedptr)
+{
+    if (hashtable_get(&ft->type_indexes, t->name) == -1)
+        hashtable_set(&ft->type_indexes, t->name, ft->types.len);
+    Append(&ft->types, (struct TypeAndUsedPtr){ .type=t, .usedptr=usedptr });
+}
+
+void add_function(FileTypes *ft, Signature sig, _Atomic bool *usedptr)
+{
+    if (hashtable_get(&ft->function_indexes, sig.name) == -1)
+        hashtable_set(&ft->function_indexes, sig.name, ft->functions.len);
+    Append(&ft->functions, (struct SignatureAndUsedPtr){ .signature=sig, .usedptr=usedptr });
+}
+
+void add_global_var(FileTypes *ft, GlobalVariable *g)
+{
+    if (hashtable_get(&ft->global_indexes, g->name) == -1)
+        hashtable_set(&ft->global_indexes, g->name, ft->globals.len);
+    Append(&ft->globals, g);
+}
+
 static const Type *find_type(const FileTypes *ft, const char *name)
 {
-    for (struct TypeAndUsedPtr *t = ft->types.ptr; t < End(ft->types); t++) {
-        if (!strcmp(t->type->name, name)) {
-            if (t->usedptr)
-                *t->usedptr = true;
-            return t->type;
-        }
-    }
-    return NULL;
+    int i = hashtable_get(&ft->type_indexes, name);
+    if (i == -1)
+        return NULL;
+    if (ft->types.ptr[i].usedptr)
+        atomic_store_explicit(ft->types.ptr[i].usedptr, true, memory_order_relaxed);
+    return ft->types.ptr[i].type;
+}
+
+// Classes defined in the current file come before any imported type with the same name.
+static Type *find_owned_class(const FileTypes *ft, const char *name)
+{
+    int i = hashtable_get(&ft->type_indexes, name);
+    assert(i != -1 && !ft->types.ptr[i].usedptr);
+    return (Type *)ft->types.ptr[i].type;
 }
 
 static const Signature *find_function(const FileTypes *ft, const char *name)
 {
-    for (struct SignatureAndUsedPtr *f = ft->functions.ptr; f < End(ft->functions); f++) {
-        if (!strcmp(f->signature.name, name)) {
-            if (f->usedptr)
-                *f->usedptr = true;
-            return &f->signature;
-        }
-    }
-    return NULL;
+    int i = hashtable_get(&ft->function_indexes, name);
+    if (i == -1)
+        return NULL;
+    if (ft->functions.ptr[i].usedptr)
+        atomic_store_explicit(ft->functions.ptr[i].usedptr, true, memory_order_relaxed);
+    return &ft->functions.ptr[i].signature;
 }
 
 static const Signature *find_method(const Type *selfclass, const char *name)
 {
     if (selfclass->kind != TYPE_CLASS)
         return NULL;
-    for (const Signature *m = selfclass->data.classdata.methods.ptr; m < End(selfclass->data.classdata.methods); m++)
-        if (!strcmp(m->name, name))
-            return m;
-    return NULL;
+    return find_class_method(selfclass, name);
 }
 
 static const Signature *find_function_or_method(const FileTypes *ft, const Type *selfclass, const char *name)
@@ -43,28 +73,27 @@ static const Signature *find_function_or_method(const FileTypes *ft, const Type
         return find_function(ft, name);
 }
 
-static const LocalVariable *find_local_var(const FileTypes *ft, const char *name)
+static const LocalVariable *find_local_var(const char *name)
 {
-    if (ft->current_fom_types)
-        for (LocalVariable **var = ft->current_fom_types->locals.ptr; var < End(ft->current_fom_types->locals); var++)
-            if (!strcmp((*var)->name, name))
-                return *var;
-    return NULL;
+    if (!current_fom_types)
+        return NULL;
+    int i = hashtable_get(&current_fom_types->local_indexes, name);
+    return i == -1 ? NULL : current_fom_types->locals.ptr[i];
 }
 
 static const Type *find_any_var(const FileTypes *ft, const char *name)
 {
-    if (ft->current_fom_types)
-        for (LocalVariable **var = ft->current_fom_types->locals.ptr; var < End(ft->current_fom_types->locals); var++)
-            if (!strcmp((*var)->name, name))
-                return (*var)->type;
-    for (GlobalVariable **var = ft->globals.ptr; var < End(ft->globals); var++)
-        if (!strcmp((*var)->name, name)) {
-            if ((*var)->usedptr)
-                *(*var)->usedptr = true;
-            return (*var)->type;
-        }
-    return NULL;
+    const LocalVariable *local = find_local_var(name);
+    if (local)
+        return local->type;
+
+    int i = hashtable_get(&ft->global_indexes, name);
+    if (i == -1)
+        return NULL;
+    GlobalVariable *g = ft->globals.ptr[i];
+    if (g->usedptr)
+        atomic_store_explicit(g->usedptr, true, memory_order_relaxed);
+    return g->type;
 }
 
 ExportSymbol *typecheck_stage1_create_types(FileTypes *ft, const AstToplevelNode *ast)
@@ -77,11 +106,11 @@ ExportSymbol *typecheck_stage1_create_types(FileTypes *ft, const AstToplevelNode
 
         switch(ast->kind) {
         case AST_TOPLEVEL_DEFINE_CLASS:
-            safe_strcpy(name, ast->data.classdef.name);
+            checked_strcpy(name, ast->data.classdef.name);
             t = create_opaque_struct(name);
             break;
         case AST_TOPLEVEL_DEFINE_ENUM:
-            safe_strcpy(name, ast->data.enumdef.name);
+            checked_strcpy(name, ast->data.enumdef.name);
             t = create_enum(name, ast->data.enumdef.nmembers, ast->data.enumdef.membernames);
             break;
         default:
@@ -91,7 +120,7 @@ ExportSymbol *typecheck_stage1_create_types(FileTypes *ft, const AstToplevelNode
         if (find_type(ft, name))
             fail_with_error(ast->location, "a type named '%s' already exists", name);
 
-        Append(&ft->types, (struct TypeAndUsedPtr){ .type=t, .usedptr=NULL });
+        add_type(ft, t, NULL);
         Append(&ft->owned_types, t);
 
         struct ExportSymbol es = { .kind = EXPSYM_TYPE, .data.type = t };
@@ -103,23 +132,12 @@ ExportSymbol *typecheck_stage1_create_types(FileTypes *ft, const AstToplevelNode
     return exports.ptr;
 }
 
-int evaluate_array_length(const AstExpression *expr)
-{
-    if (expr->kind == AST_EXPR_CONSTANT
-        && expr->data.constant.kind == CONSTANT_INTEGER
-        && expr->data.constant.data.integer.is_signed
-        && expr->data.constant.data.integer.width_in_bits == 32)
-    {
-        return (int)expr->data.constant.data.integer.value;
-    }
-
-    fail_with_error(expr->location, "cannot evaluate array length at compile time");
-}
+static int evaluate_array_length(FileTypes *ft, const AstExpression *expr);
 
 // NULL return value means it is void
-static const Type *type_or_void_from_ast(const FileTypes *ft, const AstType *asttype);
+static const Type *type_or_void_from_ast(FileTypes *ft, const AstType *asttype);
 
-static const Type *type_from_ast(const FileTypes *ft, const AstType *asttype)
+static const Type *type_from_ast(FileTypes *ft, const AstType *asttype)
 {
     const Type *t = type_or_void_from_ast(ft, asttype);
     if (!t)
@@ -127,7 +145,7 @@ static const Type *type_from_ast(const FileTypes *ft, const AstType *asttype)
     return t;
 }
 
-static const Type *type_or_void_from_ast(const FileTypes *ft, const AstType *asttype)
+static const Type *type_or_void_from_ast(FileTypes *ft, const AstType *asttype)
 {
     const Type *tmp;
 
@@ -160,25 +178,22 @@ static const Type *type_or_void_from_ast(const FileTypes *ft, const AstType *ast
 
     case AST_TYPE_ARRAY:
         tmp = type_from_ast(ft, asttype->data.valuetype);
-        int len = evaluate_array_length(asttype->data.array.len);
-        if (len <= 0)
-            fail_with_error(asttype->data.array.len->location, "array length must be positive");
-        return get_array_type(tmp, len);
+        return get_array_type(tmp, evaluate_array_length(ft, asttype->data.array.len));
     }
 }
 
 static ExportSymbol handle_global_var(FileTypes *ft, const AstNameTypeValue *vardecl, bool defined_here)
 {
-    assert(ft->current_fom_types == NULL);  // find_any_var() only finds global vars
+    assert(current_fom_types == NULL);  // find_any_var() only finds global vars
     if (find_any_var(ft, vardecl->name))
         fail_with_error(vardecl->name_location, "a global variable named '%s' already exists", vardecl->name);
 
     assert(!vardecl->value);
     GlobalVariable *g = calloc(1, sizeof *g);
-    safe_strcpy(g->name, vardecl->name);
+    checked_strcpy(g->name, vardecl->name);
     g->type = type_from_ast(ft, &vardecl->type);
     g->defined_in_current_file = defined_here;
-    Append(&ft->globals, g);
+    add_global_var(ft, g);
 
     ExportSymbol es = { .kind = EXPSYM_GLOBAL_VAR, .data.type = g->type };
     safe_strcpy(es.name, g->name);
@@ -191,12 +206,12 @@ static Signature handle_signature(FileTypes *ft, const AstSignature *astsig, con
         fail_with_error(astsig->name_location, "a %s named '%s' already exists", self_type ? "method" : "function", astsig->name);
 
     Signature sig = { .nargs = astsig->args.len, .takes_varargs = astsig->takes_varargs };
-    safe_strcpy(sig.name, astsig->name);
+    checked_strcpy(sig.name, astsig->name);
 
     size_t size = sizeof(sig.argnames[0]) * sig.nargs;
     sig.argnames = malloc(size);
     for (int i = 0; i < sig.nargs; i++)
-        safe_strcpy(sig.argnames[i], astsig->args.ptr[i].name);
+        checked_strcpy(sig.argnames[i], astsig->args.ptr[i].name);
 
     sig.argtypes = malloc(sizeof(sig.argtypes[0]) * sig.nargs);  // NOLINT
     for (int i = 0; i < sig.nargs; i++) {
@@ -216,7 +231,7 @@ static Signature handle_signature(FileTypes *ft, const AstSignature *astsig, con
     sig.returntype_location = astsig->returntype.location;
 
     if (!self_type)
-        Append(&ft->functions, (struct SignatureAndUsedPtr){ .signature=copy_signature(&sig), .usedptr=NULL });
+        add_function(ft, copy_signature(&sig), NULL);
 
     return sig;
 }
@@ -224,29 +239,19 @@ static Signature handle_signature(FileTypes *ft, const AstSignature *astsig, con
 static const Type *handle_class_members_stage2(FileTypes *ft, const AstClassDef *classdef)
 {
     // Previous type-checking stage created an opaque struct.
-    Type *type = NULL;
-    for (Type **s = ft->owned_types.ptr; s < End(ft->owned_types); s++) {
-        if (!strcmp((*s)->name, classdef->name)) {
-            type = *s;
-            break;
-        }
-    }
-    assert(type);
+    Type *type = find_owned_class(ft, classdef->name);
     assert(type->kind == TYPE_OPAQUE_CLASS);
     type->kind = TYPE_CLASS;
 
     memset(&type->data.classdata, 0, sizeof type->data.classdata);
 
-    for (const AstNameTypeValue *classfield = classdef->fields.ptr; classfield < End(classdef->fields); classfield++) {
-        struct ClassField f = {.type = type_from_ast(ft, &classfield->type)};
-        safe_strcpy(f.name, classfield->name);
-        Append(&type->data.classdata.fields, f);
-    }
+    for (const AstNameTypeValue *classfield = classdef->fields.ptr; classfield < End(classdef->fields); classfield++)
+        add_class_field(type, classfield->name, type_from_ast(ft, &classfield->type));
 
     for (const AstFunctionDef *m = classdef->methods.ptr; m < End(classdef->methods); m++) {
         // Don't handle the method body yet: that is a part of stage 3, not stage 2
         Signature sig = handle_signature(ft, &m->signature, type);
-        Append(&type->data.classdata.methods, sig);
+        add_class_method(type, sig);
     }
 
     return type;
@@ -289,18 +294,19 @@ ExportSymbol *typecheck_stage2_signatures_globals_structbodies(FileTypes *ft, co
     return exports.ptr;
 }
 
-static LocalVariable *add_variable(FileTypes *ft, const Type *t, const char *name)
+static LocalVariable *add_variable(const Type *t, const char *name)
 {
     LocalVariable *var = calloc(1, sizeof *var);
-    var->id = ft->current_fom_types->locals.len;
+    var->id = current_fom_types->locals.len;
     var->type = t;
 
     assert(name);
-    assert(!find_local_var(ft, name));
+    assert(!find_local_var(name));
     assert(strlen(name) < sizeof var->name);
     strcpy(var->name, name);
 
-    Append(&ft->current_fom_types->locals, var);
+    hashtable_set(&current_fom_types->local_indexes, name, var->id);
+    Append(&current_fom_types->locals, var);
     return var;
 }
 
@@ -321,10 +327,10 @@ static noreturn void fail_with_implicit_cast_error(
     List(char) msg = {0};
     while(*template){
         if (!strncmp(template, "FROM", 4)) {
-            AppendStr(&msg, from->name);
+            AppendStr(&msg, type_name(from));
             template += 4;
         } else if (!strncmp(template, "TO", 2)) {
-            AppendStr(&msg, to->name);
+            AppendStr(&msg, type_name(to));
             template += 2;
         } else {
             Append(&msg, template[0]);
@@ -385,10 +391,25 @@ static void check_explicit_cast(const Type *from, const Type *to, Location locat
     )
     {
         // TODO: test this error
-        fail_with_error(location, "cannot cast from type %s to %s", from->name, to->name);
+        fail_with_error(location, "cannot cast from type %s to %s", type_name(from), type_name(to));
     }
 }
 
+/*
+The type checker doesn't otherwise modify the AST, but build_cfg.c needs a
+fast way to find the types of each expression, so we store an index into
+the AST.
+*/
+static void set_expr_types(const AstExpression *expr, ExpressionTypes *types)
+{
+    int index = -1;
+    if (types) {
+        index = current_fom_types->expr_types.len;
+        Append(&current_fom_types->expr_types, types);
+    }
+    ((AstExpression *)expr)->types_index = index;
+}
+
 static ExpressionTypes *typecheck_expression(FileTypes *ft, const AstExpression *expr);
 
 static ExpressionTypes *typecheck_expression_not_void(FileTypes *ft, const AstExpression *expr)
@@ -467,7 +488,7 @@ static const Type *check_binop(
         || got_numbers
         || ((got_enums || got_pointers) && (op == AST_EXPR_EQ || op == AST_EXPR_NE))
     ))
-        fail_with_error(location, "wrong types: cannot %s %s and %s", do_what, lhstypes->type->name, rhstypes->type->name);
+        fail_with_error(location, "wrong types: cannot %s %s and %s", do_what, type_name(lhstypes->type), type_name(rhstypes->type));
 
     const Type *cast_type = NULL;
     if (got_integers) {
@@ -509,7 +530,7 @@ static const Type *check_binop(
 // Intended for errors. Returned string can be overwritten in next call.
 static const char *short_expression_description(const AstExpression *expr)
 {
-    static char result[200];
+    static _Thread_local char result[200];
 
     switch(expr->kind) {
     // Imagine "cannot assign to" in front of these, e.g. "cannot assign to a constant"
@@ -613,7 +634,7 @@ static const Type *check_increment_or_decrement(FileTypes *ft, const AstExpressi
     ensure_can_take_address(&expr->data.operands[0], bad_expr_fmt);
     const Type *t = typecheck_expression_not_void(ft, &expr->data.operands[0])->type;
     if (!is_integer_type(t) && !is_pointer_type(t))
-        fail_with_error(expr->location, bad_type_fmt, t->name);
+        fail_with_error(expr->location, bad_type_fmt, type_name(t));
     return t;
 }
 
@@ -621,7 +642,7 @@ static void typecheck_dereferenced_pointer(Location location, const Type *t)
 {
     // TODO: improved error message for dereferencing void*
     if (t->kind != TYPE_POINTER)
-        fail_with_error(location, "the dereference operator '*' is only for pointers, not for %s", t->name);
+        fail_with_error(location, "the dereference operator '*' is only for pointers, not for %s", type_name(t));
 }
 
 // ptr[index]
@@ -630,7 +651,7 @@ static const Type *typecheck_indexing(
 {
     const Type *ptrtype = typecheck_expression_not_void(ft, ptrexpr)->type;
     if (ptrtype->kind != TYPE_POINTER && ptrtype->kind != TYPE_ARRAY)
-        fail_with_error(ptrexpr->location, "value of type %s cannot be indexed", ptrtype->name);
+        fail_with_error(ptrexpr->location, "value of type %s cannot be indexed", type_name(ptrtype));
     if (ptrtype->kind == TYPE_ARRAY)
         ensure_can_take_address(ptrexpr, "cannot create a pointer into an array that comes from %s");
 
@@ -639,7 +660,7 @@ static const Type *typecheck_indexing(
         fail_with_error(
             indexexpr->location,
             "the index inside [...] must be an integer, not %s",
-            indextype->name);
+            type_name(indextype));
     }
 
     if (ptrtype->kind == TYPE_ARRAY)
@@ -667,7 +688,7 @@ static const char *nth(int n)
     if (n < (int)(sizeof(first_few)/sizeof(first_few[0])))
         return first_few[n];
 
-    static char result[100];
+    static _Thread_local char result[100];
     sprintf(result, "%dth", n);
     return result;
 }
@@ -686,14 +707,14 @@ static const Type *typecheck_function_or_method_call(FileTypes *ft, const AstCal
                 location,
                 "the method '%s' is defined on class %s, not on the pointer type %s,"
                 " so you need to dereference the pointer first (e.g. by using '->' instead of '.')",
-                call->calledname, self_type->data.valuetype->name, self_type->name);
+                call->calledname, type_name(self_type->data.valuetype), type_name(self_type));
         }
         // If it is not a class, explain to the user that there are no methods
         if (self_type->kind != TYPE_CLASS) {
-            fail_with_error(location, "type %s does not have any methods because it is not a class", self_type->name);
+            fail_with_error(location, "type %s does not have any methods because it is not a class", type_name(self_type));
         }
         fail_with_error(location, "class %s does not have a method named '%s'",
-            self_type->name, call->calledname);
+            type_name(self_type), call->calledname);
     }
 
     char *sigstr = signature_to_string(sig, false);
@@ -751,9 +772,9 @@ static const Type *typecheck_class_field(
 {
     assert(classtype->kind == TYPE_CLASS);
 
-    for (struct ClassField *f = classtype->data.classdata.fields.ptr; f < End(classtype->data.classdata.fields); f++)
-        if (!strcmp(f->name, fieldname))
-            return f->type;
+    const struct ClassField *f = find_class_field(classtype, fieldname);
+    if (f)
+        return f->type;
 
     fail_with_error(location, "class %s has no field named '%s'", classtype->name, fieldname);
 }
@@ -761,7 +782,7 @@ static const Type *typecheck_class_field(
 static const Type *typecheck_struct_init(FileTypes *ft, const AstCall *call, Location location)
 {
     struct AstType tmp = { .kind = AST_TYPE_NAMED, .location = location };
-    safe_strcpy(tmp.data.name, call->calledname);
+    tmp.data.name = call->calledname;
     const Type *t = type_from_ast(ft, &tmp);
 
     if (t->kind != TYPE_CLASS) {
@@ -769,7 +790,7 @@ static const Type *typecheck_struct_init(FileTypes *ft, const AstCall *call, Loc
         // all non-struct types are created with keywords, and this
         // function is called only when there is a name token followed
         // by a '{'.
-        fail_with_error(location, "type %s cannot be instantiated with the Foo{...} syntax", t->name);
+        fail_with_error(location, "type %s cannot be instantiated with the Foo{...} syntax", type_name(t));
     }
 
     for (int i = 0; i < call->nargs; i++) {
@@ -806,13 +827,14 @@ static const char *very_short_type_description(const Type *t)
     }
 }
 
-static bool enum_member_exists(const Type *t, const char *name)
+// Returns -1 if the enum has no member with the given name.
+static int find_enum_member(const Type *t, const char *name)
 {
     assert(t->kind == TYPE_ENUM);
     for (int i = 0; i < t->data.enummembers.count; i++)
         if (!strcmp(t->data.enummembers.names[i], name))
-            return true;
-    return false;
+            return i;
+    return -1;
 }
 
 static const Type *cast_array_members_to_a_common_type(Location error_location, ExpressionTypes **exprtypes)
@@ -848,7 +870,7 @@ static const Type *cast_array_members_to_a_common_type(Location error_location,
     if (compatible_with_all.len != 1) {
         List(char) namestr = {0};
         for (const Type **t = distinct.ptr; t < End(distinct); t++) {
-            AppendStr(&namestr, (*t)->name);
+            AppendStr(&namestr, type_name(*t));
             AppendStr(&namestr, ", ");
         }
         fail_with_error(
@@ -864,6 +886,263 @@ static const Type *cast_array_members_to_a_common_type(Location error_location,
     return elemtype;
 }
 
+/*
+Values of expressions like 4*1024 or sizeof(int) are computed while type
+checking, so that they can be used as array sizes and build_cfg.c can use
+the result directly. Only integers and booleans are evaluated, and the
+result must always be the same as what the generated code would compute.
+*/
+
+// Truncates to the size of the type, just like the generated code does on overflow.
+static Constant wrap_integer(const Type *t, unsigned long long value)
+{
+    int bits = t->data.width_in_bits;
+    if (bits < 64) {
+        unsigned long long mask = (1ULL << bits) - 1;
+        value &= mask;
+        if (t->kind == TYPE_SIGNED_INTEGER && (value >> (bits-1)))
+            value |= ~mask;  // sign extend
+    }
+    return int_constant(t, (long long)value);
+}
+
+// Returns false if the result cannot be known at compile time.
+static bool cast_constant(Constant *c, const Type *to)
+{
+    if (type_of_constant(c) == to)
+        return true;
+
+    if (is_integer_type(to)) {
+        switch(c->kind) {
+        case CONSTANT_INTEGER:
+            *c = wrap_integer(to, c->data.integer.value);
+            return true;
+        case CONSTANT_BOOL:
+            *c = int_constant(to, c->data.boolean);
+            return true;
+        case CONSTANT_ENUM_MEMBER:
+            *c = wrap_integer(to, c->data.enum_member.memberidx);
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    if (to->kind == TYPE_ENUM
+        && c->kind == CONSTANT_INTEGER
+        && 0 <= c->data.integer.value
+        && c->data.integer.value < to->data.enummembers.count)
+    {
+        *c = (Constant){ CONSTANT_ENUM_MEMBER, {.enum_member = {to, (int)c->data.integer.value}} };
+        return true;
+    }
+
+    return false;
+}
+
+// Value of an expression that has already been type-checked, after implicit cast.
+static bool get_value(const AstExpression *expr, Constant *result)
+{
+    if (expr->types_index == -1)
+        return false;
+    const ExpressionTypes *types = current_fom_types->expr_types.ptr[expr->types_index];
+    if (!types->value)
+        return false;
+    *result = *types->value;
+    return !types->type_after_cast || cast_constant(result, types->type_after_cast);
+}
+
+static bool evaluate_integer_binop(enum AstExpressionKind op, const Type *t, long long x, long long y, Constant *result)
+{
+    bool is_signed = (t->kind == TYPE_SIGNED_INTEGER);
+    unsigned long long ux = x, uy = y;
+
+    switch(op) {
+    case AST_EXPR_ADD: *result = wrap_integer(t, ux + uy); return true;
+    case AST_EXPR_SUB: *result = wrap_integer(t, ux - uy); return true;
+    case AST_EXPR_MUL: *result = wrap_integer(t, ux * uy); return true;
+    case AST_EXPR_DIV:
+    case AST_EXPR_MOD:
+        // Let these fail at runtime as usual
+        if (y == 0 || (is_signed && y == -1 && x == wrap_integer(t, 1ULL << (t->data.width_in_bits - 1)).data.integer.value))
+            return false;
+        if (!is_signed) {
+            *result = wrap_integer(t, op == AST_EXPR_DIV ? ux / uy : ux % uy);
+        } else {
+            // Same formulas as build_signed_mod() and build_signed_div() in codegen.c
+            long long mod = wrap_integer(t, (unsigned long long)(x % y) + uy).data.integer.value % y;
+            long long top = wrap_integer(t, ux - (unsigned long long)mod).data.integer.value;
+            *result = wrap_integer(t, op == AST_EXPR_DIV ? (unsigned long long)(top / y) : (unsigned long long)mod);
+        }
+        return true;
+    case AST_EXPR_EQ: *result = (Constant){ CONSTANT_BOOL, {.boolean = (x == y)} }; return true;
+    case AST_EXPR_NE: *result = (Constant){ CONSTANT_BOOL, {.boolean = (x != y)} }; return true;
+    default:
+        break;
+    }
+
+    // The generated code compares unsigned integers as if they were signed, see codegen.c
+    if (!is_signed)
+        return false;
+
+    switch(op) {
+    case AST_EXPR_GT: *result = (Constant){ CONSTANT_BOOL, {.boolean = (x > y)} }; return true;
+    case AST_EXPR_GE: *result = (Constant){ CONSTANT_BOOL, {.boolean = (x >= y)} }; return true;
+    case AST_EXPR_LT: *result = (Constant){ CONSTANT_BOOL, {.boolean = (x < y)} }; return true;
+    case AST_EXPR_LE: *result = (Constant){ CONSTANT_BOOL, {.boolean = (x <= y)} }; return true;
+    default: assert(0);
+    }
+}
+
+// Called after type-checking an expression. Returns false if the value is not known at compile time.
+static bool evaluate_constant(const AstExpression *expr, const Type *type, Constant *result)
+{
+    Constant lhs, rhs;
+
+    switch(expr->kind) {
+    case AST_EXPR_CONSTANT:
+        *result = expr->data.constant;
+        return result->kind == CONSTANT_INTEGER || result->kind == CONSTANT_BOOL;
+    case AST_EXPR_GET_ENUM_MEMBER:
+        *result = (Constant){ CONSTANT_ENUM_MEMBER, {.enum_member = {
+            .enumtype = type,
+            .memberidx = find_enum_member(type, expr->data.enummember.membername),
+        }}};
+        return true;
+    case AST_EXPR_SIZEOF:
+        {
+            const AstExpression *obj = &expr->data.operands[0];
+            *result = int_constant(longType, get_type_size(current_fom_types->expr_types.ptr[obj->types_index]->type));
+            return true;
+        }
+    case AST_EXPR_AS:
+        return get_value(expr->data.as.obj, result) && cast_constant(result, type);
+    case AST_EXPR_NOT:
+        if (!get_value(&expr->data.operands[0], &lhs))
+            return false;
+        *result = (Constant){ CONSTANT_BOOL, {.boolean = !lhs.data.boolean} };
+        return true;
+    case AST_EXPR_AND:
+    case AST_EXPR_OR:
+        if (!get_value(&expr->data.operands[0], &lhs) || !get_value(&expr->data.operands[1], &rhs))
+            return false;
+        if (expr->kind == AST_EXPR_AND)
+            *result = (Constant){ CONSTANT_BOOL, {.boolean = lhs.data.boolean && rhs.data.boolean} };
+        else
+            *result = (Constant){ CONSTANT_BOOL, {.boolean = lhs.data.boolean || rhs.data.boolean} };
+        return true;
+    case AST_EXPR_NEG:
+        if (!get_value(&expr->data.operands[0], &lhs) || lhs.kind != CONSTANT_INTEGER)
+            return false;
+        *result = wrap_integer(type, -(unsigned long long)lhs.data.integer.value);
+        return true;
+    case AST_EXPR_ADD:
+    case AST_EXPR_SUB:
+    case AST_EXPR_MUL:
+    case AST_EXPR_DIV:
+    case AST_EXPR_MOD:
+    case AST_EXPR_EQ:
+    case AST_EXPR_NE:
+    case AST_EXPR_GT:
+    case AST_EXPR_GE:
+    case AST_EXPR_LT:
+    case AST_EXPR_LE:
+        // Both sides have been implicitly cast to the same type.
+        if (!get_value(&expr->data.operands[0], &lhs)
+            || !get_value(&expr->data.operands[1], &rhs)
+            || lhs.kind != CONSTANT_INTEGER
+            || rhs.kind != CONSTANT_INTEGER)
+        {
+            return false;
+        }
+        return evaluate_integer_binop(
+            expr->kind, type_of_constant(&lhs), lhs.data.integer.value, rhs.data.integer.value, result);
+    default:
+        return false;
+    }
+}
+
+/*
+Array lengths outside functions are evaluated before all classes are known,
+and the result goes to the interface file, whose cache key only depends on
+the file itself (see get_interface_cache_key()). So only things defined in
+the same file can be used, and sizeof cannot be used at all.
+*/
+static void check_array_length_outside_function(const FileTypes *ft, const AstExpression *expr)
+{
+    switch(expr->kind) {
+    case AST_EXPR_CONSTANT:
+        break;
+    case AST_EXPR_GET_ENUM_MEMBER:
+        {
+            int i = hashtable_get(&ft->type_indexes, expr->data.enummember.enumname);
+            if (i != -1 && ft->types.ptr[i].usedptr)
+                fail_with_error(
+                    expr->location, "array length outside a function cannot use enum %s from another file",
+                    expr->data.enummember.enumname);
+        }
+        break;
+    case AST_EXPR_SIZEOF:
+        fail_with_error(expr->location, "array length outside a function cannot use sizeof");
+    case AST_EXPR_AS:
+        check_array_length_outside_function(ft, expr->data.as.obj);
+        break;
+    case AST_EXPR_NOT:
+    case AST_EXPR_NEG:
+        check_array_length_outside_function(ft, &expr->data.operands[0]);
+        break;
+    case AST_EXPR_AND:
+    case AST_EXPR_OR:
+    case AST_EXPR_ADD:
+    case AST_EXPR_SUB:
+    case AST_EXPR_MUL:
+    case AST_EXPR_DIV:
+    case AST_EXPR_MOD:
+    case AST_EXPR_EQ:
+    case AST_EXPR_NE:
+    case AST_EXPR_GT:
+    case AST_EXPR_GE:
+    case AST_EXPR_LT:
+    case AST_EXPR_LE:
+        check_array_length_outside_function(ft, &expr->data.operands[0]);
+        check_array_length_outside_function(ft, &expr->data.operands[1]);
+        break;
+    default:
+        fail_with_error(expr->location, "cannot evaluate array length at compile time");
+    }
+}
+
+static int evaluate_array_length(FileTypes *ft, const AstExpression *expr)
+{
+    Constant value;
+    bool ok;
+
+    if (current_fom_types) {
+        typecheck_expression_not_void(ft, expr);
+        ok = get_value(expr, &value);
+    } else {
+        // Type-check the expression as if it was in a function, and then throw away the result.
+        check_array_length_outside_function(ft, expr);
+        FunctionOrMethodTypes tmp = {0};
+        current_fom_types = &tmp;
+        typecheck_expression_not_void(ft, expr);
+        ok = get_value(expr, &value);
+        current_fom_types = NULL;
+        free(tmp.expr_types.ptr);
+        free_arena(&tmp.expr_types_arena);
+    }
+
+    if (!ok)
+        fail_with_error(expr->location, "cannot evaluate array length at compile time");
+    if (value.kind != CONSTANT_INTEGER)
+        fail_with_error(expr->location, "array length must be an integer, not %s", type_name(type_of_constant(&value)));
+    if (value.data.integer.value <= 0)
+        fail_with_error(expr->location, "array length must be positive");
+    if (value.data.integer.value > INT_MAX)
+        fail_with_error(expr->location, "array length is too big");
+    return (int)value.data.integer.value;
+}
+
 static ExpressionTypes *typecheck_expression(FileTypes *ft, const AstExpression *expr)
 {
     const Type *temptype;
@@ -879,14 +1158,16 @@ static ExpressionTypes *typecheck_expression(FileTypes *ft, const AstExpression
             fail_with_error(
                 expr->location, "the '::' syntax is only for enums, but %s is %s",
                 expr->data.enummember.enumname, very_short_type_description(result));
-        if (!enum_member_exists(result, expr->data.enummember.membername))
+        if (find_enum_member(result, expr->data.enummember.membername) == -1)
             fail_with_error(expr->location, "enum %s has no member named '%s'",
                 expr->data.enummember.enumname, expr->data.enummember.membername);
         break;
     case AST_EXPR_FUNCTION_CALL:
         result = typecheck_function_or_method_call(ft, &expr->data.call, NULL, expr->location);
-        if (!result)
+        if (!result) {
+            set_expr_types(expr, NULL);
             return NULL;
+        }
         break;
     case AST_EXPR_SIZEOF:
         typecheck_expression_not_void(ft, &expr->data.operands[0]);
@@ -913,7 +1194,7 @@ static ExpressionTypes *typecheck_expression(FileTypes *ft, const AstExpression
             fail_with_error(
                 expr->location,
                 "left side of the '.' operator must be a class, not %s",
-                temptype->name);
+                type_name(temptype));
         result = typecheck_class_field(temptype, expr->data.classfield.fieldname, expr->location);
         break;
     case AST_EXPR_DEREF_AND_GET_FIELD:
@@ -922,7 +1203,7 @@ static ExpressionTypes *typecheck_expression(FileTypes *ft, const AstExpression
             fail_with_error(
                 expr->location,
                 "left side of the '->' operator must be a pointer to a class, not %s",
-                temptype->name);
+                type_name(temptype));
         result = typecheck_class_field(temptype->data.valuetype, expr->data.classfield.fieldname, expr->location);
         break;
     case AST_EXPR_DEREF_AND_CALL_METHOD:
@@ -931,14 +1212,16 @@ static ExpressionTypes *typecheck_expression(FileTypes *ft, const AstExpression
             fail_with_error(
                 expr->location,
                 "left side of the '->' operator must be a pointer, not %s",
-                temptype->name);
+                type_name(temptype));
         result = typecheck_function_or_method_call(ft, &expr->data.methodcall.call, temptype->data.valuetype, expr->location);
         break;
     case AST_EXPR_CALL_METHOD:
         temptype = typecheck_expression_not_void(ft, expr->data.methodcall.obj)->type;
         result = typecheck_function_or_method_call(ft, &expr->data.methodcall.call, temptype, expr->location);
-        if (!result)
+        if (!result) {
+            set_expr_types(expr, NULL);
             return NULL;
+        }
         break;
     case AST_EXPR_INDEXING:
         result = typecheck_indexing(ft, &expr->data.operands[0], &expr->data.operands[1]);
@@ -981,7 +1264,7 @@ static ExpressionTypes *typecheck_expression(FileTypes *ft, const AstExpression
             fail_with_error(
                 expr->location,
                 "value after '-' must be a float or double or a signed integer, not %s",
-                result->name);
+                type_name(result));
         break;
     case AST_EXPR_ADD:
     case AST_EXPR_SUB:
@@ -1013,10 +1296,15 @@ static ExpressionTypes *typecheck_expression(FileTypes *ft, const AstExpression
         break;
     }
 
-    ExpressionTypes *types = calloc(1, sizeof *types);
+    ExpressionTypes *types = arena_alloc(&current_fom_types->expr_types_arena, sizeof *types);
     types->expr = expr;
     types->type = result;
-    Append(&ft->current_fom_types->expr_types, types);
+
+    Constant value;
+    if (evaluate_constant(expr, result, &value))
+        types->value = arena_dup(&current_fom_types->expr_types_arena, &value, sizeof value);
+
+    set_expr_types(expr, types);
     return types;
 }
 
@@ -1082,7 +1370,7 @@ static void typecheck_statement(FileTypes *ft, const AstStatement *stmt)
             {
                 // Making a new variable. Use the type of the value being assigned.
                 const ExpressionTypes *types = typecheck_expression_not_void(ft, valueexpr);
-                add_variable(ft, types->type, targetexpr->data.varname);
+                add_variable(types->type, targetexpr->data.varname);
             } else {
                 // Convert value to the type of an existing variable or other assignment target.
                 ensure_can_take_address(targetexpr, "cannot assign to %s");
@@ -1134,29 +1422,29 @@ static void typecheck_statement(FileTypes *ft, const AstStatement *stmt)
 
     case AST_STMT_RETURN_VALUE:
     {
-        if(!ft->current_fom_types->signature.returntype){
+        if(!current_fom_types->signature.returntype){
             fail_with_error(
                 stmt->location,
                 "function '%s' cannot return a value because it was defined with '-> void'",
-                ft->current_fom_types->signature.name);
+                current_fom_types->signature.name);
         }
 
         char msg[200];
         snprintf(msg, sizeof msg,
             "attempting to return a value of type FROM from function '%s' defined with '-> TO'",
-            ft->current_fom_types->signature.name);
+            current_fom_types->signature.name);
         typecheck_expression_with_implicit_cast(
-            ft, &stmt->data.expression, find_local_var(ft, "return")->type, msg);
+            ft, &stmt->data.expression, find_local_var("return")->type, msg);
         break;
     }
 
     case AST_STMT_RETURN_WITHOUT_VALUE:
-        if (ft->current_fom_types->signature.returntype) {
+        if (current_fom_types->signature.returntype) {
             fail_with_error(
                 stmt->location,
                 "a return value is needed, because the return type of function '%s' is %s",
-                ft->current_fom_types->signature.name,
-                ft->current_fom_types->signature.returntype->name);
+                current_fom_types->signature.name,
+                type_name(current_fom_types->signature.returntype));
         }
         break;
 
@@ -1165,7 +1453,7 @@ static void typecheck_statement(FileTypes *ft, const AstStatement *stmt)
             fail_with_error(stmt->location, "a variable named '%s' already exists", stmt->data.vardecl.name);
 
         const Type *type = type_from_ast(ft, &stmt->data.vardecl.type);
-        add_variable(ft, type, stmt->data.vardecl.name);
+        add_variable(type, stmt->data.vardecl.name);
         if (stmt->data.vardecl.value) {
             typecheck_expression_with_implicit_cast(
                 ft, stmt->data.vardecl.value, type,
@@ -1179,60 +1467,62 @@ static void typecheck_statement(FileTypes *ft, const AstStatement *stmt)
     }
 }
 
-static void typecheck_function_or_method_body(FileTypes *ft, const Signature *sig, const AstBody *body)
+static void add_function_or_method_body(FileTypes *ft, const Signature *sig, const AstBody *body)
 {
-    assert(!ft->current_fom_types);
-    Append(&ft->fomtypes, (struct FunctionOrMethodTypes){0});
-    ft->current_fom_types = End(ft->fomtypes) - 1;
-    ft->current_fom_types->signature = copy_signature(sig);
-
-    for (int i = 0; i < sig->nargs; i++) {
-        LocalVariable *v = add_variable(ft, sig->argtypes[i], sig->argnames[i]);
-        v->is_argument = true;
-    }
-    if (sig->returntype)
-        add_variable(ft, sig->returntype, "return");
-
-    typecheck_body(ft, body);
-    ft->current_fom_types = NULL;
+    Append(&ft->fomtypes, (struct FunctionOrMethodTypes){ .signature = copy_signature(sig) });
+    Append(&ft->fombodies, body);
 }
 
-void typecheck_stage3_function_and_method_bodies(FileTypes *ft, const AstToplevelNode *ast)
+int typecheck_stage3_prepare(FileTypes *ft, const AstToplevelNode *ast)
 {
+    assert(ft->fomtypes.len == 0);
+
     for (; ast->kind != AST_TOPLEVEL_END_OF_FILE; ast++) {
         if (ast->kind == AST_TOPLEVEL_DEFINE_FUNCTION) {
-            const Signature *sig = NULL;
-            for (struct SignatureAndUsedPtr *f = ft->functions.ptr; f < End(ft->functions); f++) {
-                if (!strcmp(f->signature.name, ast->data.funcdef.signature.name)) {
-                    sig = &f->signature;
-                    break;
-                }
-            }
-            assert(sig);
-            typecheck_function_or_method_body(ft, sig, &ast->data.funcdef.body);
+            int i = hashtable_get(&ft->function_indexes, ast->data.funcdef.signature.name);
+            assert(i != -1);
+            const Signature *sig = &ft->functions.ptr[i].signature;
+            add_function_or_method_body(ft, sig, &ast->data.funcdef.body);
         }
 
         if (ast->kind == AST_TOPLEVEL_DEFINE_CLASS) {
-            Type *classtype = NULL;
-            for (Type **t = ft->owned_types.ptr; t < End(ft->owned_types); t++) {
-                if (!strcmp((*t)->name, ast->data.classdef.name)) {
-                    classtype = *t;
-                    break;
-                }
-            }
-            assert(classtype);
-
+            const Type *classtype = find_owned_class(ft, ast->data.classdef.name);
             for (AstFunctionDef *m = ast->data.classdef.methods.ptr; m < End(ast->data.classdef.methods); m++) {
-                Signature *sig = NULL;
-                for (Signature *s = classtype->data.classdata.methods.ptr; s < End(classtype->data.classdata.methods); s++) {
-                    if (!strcmp(s->name, m->signature.name)) {
-                        sig = s;
-                        break;
-                    }
-                }
+                const Signature *sig = find_class_method(classtype, m->signature.name);
                 assert(sig);
-                typecheck_function_or_method_body(ft, sig, &m->body);
+                add_function_or_method_body(ft, sig, &m->body);
             }
         }
     }
+    return ft->fomtypes.len;
+}
+
+void typecheck_stage3_check_body(FileTypes *ft, int index)
+{
+    /*
+    If checking the body failed with jump_silently_on_error(), it can be
+    checked again to show the error. Start over from an empty state.
+    */
+    assert(0 <= index && index < ft->fomtypes.len);
+    FunctionOrMethodTypes *f = &ft->fomtypes.ptr[index];
+    *f = (FunctionOrMethodTypes){ .signature = f->signature };
+    current_fom_types = f;
+
+    const Signature *sig = &f->signature;
+    for (int i = 0; i < sig->nargs; i++) {
+        LocalVariable *v = add_variable(sig->argtypes[i], sig->argnames[i]);
+        v->is_argument = true;
+    }
+    if (sig->returntype)
+        add_variable(sig->returntype, "return");
+
+    typecheck_body(ft, ft->fombodies.ptr[index]);
+    current_fom_types = NULL;
+}
+
+void typecheck_stage3_function_and_method_bodies(FileTypes *ft, const AstToplevelNode *ast)
+{
+    int n = typecheck_stage3_prepare(ft, ast);
+    for (int i = 0; i < n; i++)
+        typecheck_stage3_check_body(ft, i);
 }
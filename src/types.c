@@ -1,14 +1,31 @@
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "jou_compiler.h"
 
+/*
+Array types with the same element type, in a hash table keyed by length.
+
+Reading doesn't need a lock. Once a table is visible to other threads,
+the only change to it is filling in empty slots. When it gets too full,
+a bigger copy replaces it. The old table may still be in use by another
+thread, so it is freed together with the element type.
+*/
+struct ArrayTypes {
+    struct ArrayTypes *prev;  // smaller table that this replaced, or NULL
+    int len;
+    int alloc;  // power of two
+    _Atomic(struct TypeInfo *) entries[];
+};
+
 struct TypeInfo {
     Type type;
-    struct TypeInfo *pointer;  // type that represents a pointer to this type, or NULL
-    List(struct TypeInfo *) arrays;  // types that represent arrays of this type
+    _Atomic(struct TypeInfo *) pointer;  // type that represents a pointer to this type, or NULL
+    _Atomic(struct ArrayTypes *) arrays;  // types that represent arrays of this type, or NULL
 };
 
 static struct {
@@ -29,10 +46,23 @@ const Type *voidPtrType = &global_state.voidptr.type;
 // and all array types with element type T.
 static void free_pointer_and_array_types(const struct TypeInfo *info)
 {
-    free_type(&info->pointer->type);
-    for (struct TypeInfo **arrtype = info->arrays.ptr; arrtype < End(info->arrays); arrtype++)
-        free_type(&(*arrtype)->type);
-    free(info->arrays.ptr);
+    struct TypeInfo *ptr = atomic_load_explicit(&info->pointer, memory_order_relaxed);
+    if (ptr)
+        free_type(&ptr->type);
+
+    struct ArrayTypes *arrays = atomic_load_explicit(&info->arrays, memory_order_relaxed);
+    if (arrays) {
+        for (int i = 0; i < arrays->alloc; i++) {
+            struct TypeInfo *arr = atomic_load_explicit(&arrays->entries[i], memory_order_relaxed);
+            if (arr)
+                free_type(&arr->type);
+        }
+    }
+    while (arrays) {
+        struct ArrayTypes *prev = arrays->prev;
+        free(arrays);
+        arrays = prev;
+    }
 }
 
 void free_type(Type *t)
@@ -43,6 +73,8 @@ void free_type(Type *t)
                 free_signature(m);
             free(t->data.classdata.fields.ptr);
             free(t->data.classdata.methods.ptr);
+            hashtable_free(&t->data.classdata.field_indexes);
+            hashtable_free(&t->data.classdata.method_indexes);
         }
         assert(offsetof(struct TypeInfo, type) == 0);
         free_pointer_and_array_types((struct TypeInfo *)t);
@@ -62,6 +94,11 @@ static void free_global_state(void)
             free_pointer_and_array_types(&global_state.integers[size][is_signed]);
 }
 
+static const char *intern_name(const char *name)
+{
+    return get_interned_string(intern_string(name));
+}
+
 void init_types(void)
 {
     assert(!global_state.inited);
@@ -76,17 +113,16 @@ void init_types(void)
         global_state.integers[size][false].type.kind = TYPE_UNSIGNED_INTEGER;
 
         for (int is_signed = 0; is_signed <= 1; is_signed++) {
+            char name[100];
+            sprintf(name, "<%d-bit %s integer>", size, is_signed?"signed":"unsigned");
             global_state.integers[size][is_signed].type.data.width_in_bits = size;
-            sprintf(
-                global_state.integers[size][is_signed].type.name,
-                "<%d-bit %s integer>",
-                size, is_signed?"signed":"unsigned");
+            global_state.integers[size][is_signed].type.name = intern_name(name);
         }
     }
 
-    strcpy(global_state.integers[8][false].type.name, "byte");
-    strcpy(global_state.integers[32][true].type.name, "int");
-    strcpy(global_state.integers[64][true].type.name, "long");
+    global_state.integers[8][false].type.name = "byte";
+    global_state.integers[32][true].type.name = "int";
+    global_state.integers[64][true].type.name = "long";
 
     global_state.inited = true;
     atexit(free_global_state);  // not really necessary, but makes valgrind happier
@@ -98,37 +134,123 @@ const Type *get_integer_type(int size_in_bits, bool is_signed)
     return &global_state.integers[size_in_bits][is_signed].type;
 }
 
+/*
+Pointer and array types are created on demand, possibly in several threads
+at once. Looking up an existing type doesn't lock, but creating a type or
+its name does.
+*/
+static pthread_mutex_t pointer_and_array_types_lock = PTHREAD_MUTEX_INITIALIZER;
+
 const Type *get_pointer_type(const Type *t)
 {
     assert(offsetof(struct TypeInfo, type) == 0);
     struct TypeInfo *info = (struct TypeInfo *)t;
 
-    if (!info->pointer) {
-        struct TypeInfo *ptr = calloc(1, sizeof *ptr);
+    struct TypeInfo *ptr = atomic_load_explicit(&info->pointer, memory_order_acquire);
+    if (ptr)
+        return &ptr->type;
+
+    pthread_mutex_lock(&pointer_and_array_types_lock);
+    ptr = atomic_load_explicit(&info->pointer, memory_order_relaxed);
+    if (!ptr) {
+        ptr = calloc(1, sizeof *ptr);
         ptr->type = (Type){ .kind=TYPE_POINTER, .data.valuetype=t };
-        snprintf(ptr->type.name, sizeof ptr->type.name, "%s*", t->name);
-        info->pointer = ptr;
+        atomic_store_explicit(&info->pointer, ptr, memory_order_release);
+    }
+    pthread_mutex_unlock(&pointer_and_array_types_lock);
+    return &ptr->type;
+}
+
+// Returns the entry for the given length, or the empty entry where it would go.
+static _Atomic(struct TypeInfo *) *find_array_type_entry(struct ArrayTypes *arrays, int len)
+{
+    unsigned mask = arrays->alloc - 1;
+    for (unsigned i = (unsigned)len & mask; ; i = (i+1) & mask) {
+        struct TypeInfo *arr = atomic_load_explicit(&arrays->entries[i], memory_order_acquire);
+        if (!arr || arr->type.data.array.len == len)
+            return &arrays->entries[i];
     }
-    return &info->pointer->type;
+}
+
+// Must be called with the lock held. The new table isn't visible to other threads yet.
+static struct ArrayTypes *grow_array_types(struct ArrayTypes *old)
+{
+    int alloc = old ? 2*old->alloc : 8;
+    struct ArrayTypes *arrays = calloc(1, sizeof(*arrays) + alloc*sizeof(arrays->entries[0]));
+    arrays->prev = old;
+    arrays->alloc = alloc;
+
+    for (int i = 0; old && i < old->alloc; i++) {
+        struct TypeInfo *arr = atomic_load_explicit(&old->entries[i], memory_order_relaxed);
+        if (arr) {
+            atomic_store_explicit(find_array_type_entry(arrays, arr->type.data.array.len), arr, memory_order_relaxed);
+            arrays->len++;
+        }
+    }
+    return arrays;
 }
 
 const Type *get_array_type(const Type *t, int len)
 {
     assert(offsetof(struct TypeInfo, type) == 0);
     struct TypeInfo *info = (struct TypeInfo *)t;
-
     assert(len > 0);
-    for (struct TypeInfo **existing = info->arrays.ptr; existing < End(info->arrays); existing++)
-        if ((*existing)->type.data.array.len == len)
-            return &(*existing)->type;
-
-    struct TypeInfo *arr = calloc(1, sizeof *arr);
-    arr->type = (Type){ .kind = TYPE_ARRAY, .data.array.membertype = t, .data.array.len = len };
-    snprintf(arr->type.name, sizeof arr->type.name, "%s[%d]", t->name, len);
-    Append(&info->arrays, arr);
+
+    struct ArrayTypes *arrays = atomic_load_explicit(&info->arrays, memory_order_acquire);
+    struct TypeInfo *arr = arrays ? atomic_load_explicit(find_array_type_entry(arrays, len), memory_order_acquire) : NULL;
+    if (arr)
+        return &arr->type;
+
+    pthread_mutex_lock(&pointer_and_array_types_lock);
+    arrays = atomic_load_explicit(&info->arrays, memory_order_relaxed);
+    arr = arrays ? atomic_load_explicit(find_array_type_entry(arrays, len), memory_order_relaxed) : NULL;
+    if (!arr) {
+        // Keep at most half of the entries in use, so that the linear search stays short.
+        if (!arrays || 2*(arrays->len + 1) > arrays->alloc) {
+            arrays = grow_array_types(arrays);
+            atomic_store_explicit(&info->arrays, arrays, memory_order_release);
+        }
+        arr = calloc(1, sizeof *arr);
+        arr->type = (Type){ .kind = TYPE_ARRAY, .data.array.membertype = t, .data.array.len = len };
+        atomic_store_explicit(find_array_type_entry(arrays, len), arr, memory_order_release);
+        arrays->len++;
+    }
+    pthread_mutex_unlock(&pointer_and_array_types_lock);
     return &arr->type;
 }
 
+const char *type_name(const Type *t)
+{
+    if (t->kind != TYPE_POINTER && t->kind != TYPE_ARRAY)
+        return t->name;
+
+    pthread_mutex_lock(&pointer_and_array_types_lock);
+    const char *name = t->name;
+    pthread_mutex_unlock(&pointer_and_array_types_lock);
+    if (name)
+        return name;
+
+    // This is usually for an error message, so it doesn't need to be fast.
+    char *tmp;
+    if (t->kind == TYPE_POINTER) {
+        const char *valuetypename = type_name(t->data.valuetype);
+        tmp = malloc(strlen(valuetypename) + 2);
+        sprintf(tmp, "%s*", valuetypename);
+    } else {
+        const char *membertypename = type_name(t->data.array.membertype);
+        tmp = malloc(strlen(membertypename) + 20);
+        sprintf(tmp, "%s[%d]", membertypename, t->data.array.len);
+    }
+    name = intern_name(tmp);
+    free(tmp);
+
+    // Interning gives the same pointer, even if another thread did this at the same time.
+    pthread_mutex_lock(&pointer_and_array_types_lock);
+    ((Type *)t)->name = name;
+    pthread_mutex_unlock(&pointer_and_array_types_lock);
+    return name;
+}
+
 bool is_integer_type(const Type *t)
 {
     return (t->kind == TYPE_SIGNED_INTEGER || t->kind == TYPE_UNSIGNED_INTEGER);
@@ -168,25 +290,18 @@ const Type *type_of_constant(const Constant *c)
 Type *create_opaque_struct(const char *name)
 {
     struct TypeInfo *result = calloc(1, sizeof *result);
-    result->type = (Type){ .kind = TYPE_OPAQUE_CLASS };
-
-    assert(strlen(name) < sizeof result->type.name);
-    strcpy(result->type.name, name);
-
+    result->type = (Type){ .name = intern_name(name), .kind = TYPE_OPAQUE_CLASS };
     return &result->type;
 }
 
-Type *create_enum(const char *name, int membercount, char (*membernames)[100])
+Type *create_enum(const char *name, int membercount, const char **membernames)
 {
     struct TypeInfo *result = calloc(1, sizeof *result);
     result->type = (Type){
+        .name = intern_name(name),
         .kind = TYPE_ENUM,
         .data.enummembers = { .count=membercount, .names=membernames },
     };
-
-    assert(strlen(name) < sizeof result->type.name);
-    strcpy(result->type.name, name);
-
     return &result->type;
 }
 
@@ -211,7 +326,7 @@ char *signature_to_string(const Signature *sig, bool include_return_type)
             AppendStr(&result, ", ");
         AppendStr(&result, sig->argnames[i]);
         AppendStr(&result, ": ");
-        AppendStr(&result, sig->argtypes[i]->name);
+        AppendStr(&result, type_name(sig->argtypes[i]));
     }
     if (sig->takes_varargs) {
         if (sig->nargs)
@@ -221,7 +336,7 @@ char *signature_to_string(const Signature *sig, bool include_return_type)
     Append(&result, ')');
     if (include_return_type) {
         AppendStr(&result, " -> ");
-        AppendStr(&result, sig->returntype ? sig->returntype->name : "void");
+        AppendStr(&result, sig->returntype ? type_name(sig->returntype) : "void");
     }
     Append(&result, '\0');
     return result.ptr;
@@ -240,3 +355,39 @@ Signature copy_signature(const Signature *sig)
 
     return result;
 }
+
+void add_class_field(Type *classtype, const char *name, const Type *fieldtype)
+{
+    assert(classtype->kind == TYPE_CLASS);
+    struct ClassData *cd = &classtype->data.classdata;
+    struct ClassField f = { .type = fieldtype };
+    assert(strlen(name) < sizeof f.name);
+    strcpy(f.name, name);
+
+    if (hashtable_get(&cd->field_indexes, name) == -1)
+        hashtable_set(&cd->field_indexes, name, cd->fields.len);
+    Append(&cd->fields, f);
+}
+
+void add_class_method(Type *classtype, Signature sig)
+{
+    assert(classtype->kind == TYPE_CLASS);
+    struct ClassData *cd = &classtype->data.classdata;
+    if (hashtable_get(&cd->method_indexes, sig.name) == -1)
+        hashtable_set(&cd->method_indexes, sig.name, cd->methods.len);
+    Append(&cd->methods, sig);
+}
+
+const struct ClassField *find_class_field(const Type *classtype, const char *name)
+{
+    assert(classtype->kind == TYPE_CLASS);
+    int i = hashtable_get(&classtype->data.classdata.field_indexes, name);
+    return i == -1 ? NULL : &classtype->data.classdata.fields.ptr[i];
+}
+
+const Signature *find_class_method(const Type *classtype, const char *name)
+{
+    assert(classtype->kind == TYPE_CLASS);
+    int i = hashtable_get(&classtype->data.classdata.method_indexes, name);
+    return i == -1 ? NULL : &classtype->data.classdata.methods.ptr[i];
+}
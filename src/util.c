@@ -6,6 +6,7 @@
 
 #include "util.h"
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -40,6 +41,175 @@ void simplify_path(char *path)
 }
 
 
+// FNV-1a
+static unsigned hash_string(const char *s)
+{
+    unsigned h = 2166136261u;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Returns the entry where key is, or the empty entry where it would go.
+static struct HashTableEntry *find_entry(const HashTable *t, const char *key)
+{
+    assert(t->alloc > 0);
+    unsigned i = hash_string(key) & (t->alloc - 1);
+    while (t->entries[i].key && strcmp(t->entries[i].key, key))
+        i = (i + 1) & (t->alloc - 1);
+    return &t->entries[i];
+}
+
+void hashtable_set(HashTable *t, const char *key, int value)
+{
+    assert(value >= 0);
+
+    // Keep at most half of the entries in use, so that the linear search in find_entry() stays short.
+    if (2*(t->len + 1) > t->alloc) {
+        HashTable bigger = { .alloc = t->alloc ? 2*t->alloc : 16 };
+        bigger.entries = calloc(bigger.alloc, sizeof bigger.entries[0]);
+        if (!bigger.entries) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for (int i = 0; i < t->alloc; i++)
+            if (t->entries[i].key)
+                *find_entry(&bigger, t->entries[i].key) = t->entries[i];
+        bigger.len = t->len;
+        free(t->entries);
+        *t = bigger;
+    }
+
+    struct HashTableEntry *e = find_entry(t, key);
+    if (!e->key) {
+        e->key = strdup(key);
+        t->len++;
+    }
+    e->value = value;
+}
+
+int hashtable_get(const HashTable *t, const char *key)
+{
+    if (t->len == 0)
+        return -1;
+    const struct HashTableEntry *e = find_entry(t, key);
+    return e->key ? e->value : -1;
+}
+
+void hashtable_free(HashTable *t)
+{
+    for (int i = 0; i < t->alloc; i++)
+        free(t->entries[i].key);
+    free(t->entries);
+    memset(t, 0, sizeof *t);
+}
+
+
+/*
+The interned strings are in chunks that never move, so that reading them
+doesn't need a lock. A string id is only ever handed out after it has been
+added, so its chunk always exists when someone asks for the string.
+*/
+#define INTERN_CHUNK_SIZE (1 << 16)
+#define INTERN_MAX_CHUNKS (1 << 15)  // ids must fit in HashTable values (int)
+
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static HashTable intern_ids;
+static char **intern_chunks[INTERN_MAX_CHUNKS];
+static uint32_t intern_count;
+
+uint32_t intern_string(const char *s)
+{
+    pthread_mutex_lock(&intern_lock);
+    int id = hashtable_get(&intern_ids, s);
+    if (id == -1) {
+        if (intern_count == (uint32_t)INTERN_CHUNK_SIZE * INTERN_MAX_CHUNKS) {
+            fprintf(stderr, "error: too many different names and strings\n");
+            exit(1);
+        }
+        id = intern_count++;
+        char ***chunk = &intern_chunks[id / INTERN_CHUNK_SIZE];
+        if (!*chunk) {
+            *chunk = malloc(INTERN_CHUNK_SIZE * sizeof (*chunk)[0]);  // NOLINT
+            if (!*chunk) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+        }
+        (*chunk)[id % INTERN_CHUNK_SIZE] = strdup(s);
+        hashtable_set(&intern_ids, s, id);
+    }
+    pthread_mutex_unlock(&intern_lock);
+    return id;
+}
+
+const char *get_interned_string(uint32_t id)
+{
+    assert(id < INTERN_CHUNK_SIZE * (uint32_t)INTERN_MAX_CHUNKS && intern_chunks[id / INTERN_CHUNK_SIZE]);
+    return intern_chunks[id / INTERN_CHUNK_SIZE][id % INTERN_CHUNK_SIZE];
+}
+
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16  // enough for any type we put in an arena
+
+struct ArenaChunk {
+    struct ArenaChunk *prev;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (size > (size_t)(arena->end - arena->ptr)) {
+        // Big allocations get a chunk of their own, so that the rest of the current chunk isn't wasted.
+        size_t chunksize = max(size, ARENA_CHUNK_SIZE);
+        struct ArenaChunk *chunk = malloc(sizeof(*chunk) + chunksize);
+        if (!chunk) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        if (size >= ARENA_CHUNK_SIZE && arena->chunks) {
+            chunk->prev = arena->chunks->prev;
+            arena->chunks->prev = chunk;
+            return memset(chunk->data, 0, size);
+        }
+        chunk->prev = arena->chunks;
+        arena->chunks = chunk;
+        arena->ptr = chunk->data;
+        arena->end = chunk->data + chunksize;
+    }
+
+    void *result = arena->ptr;
+    arena->ptr += size;
+    return memset(result, 0, size);
+}
+
+void *arena_dup(Arena *arena, const void *src, size_t size)
+{
+    return size ? memcpy(arena_alloc(arena, size), src, size) : NULL;
+}
+
+char *arena_strdup(Arena *arena, const char *s)
+{
+    return arena_dup(arena, s, strlen(s) + 1);
+}
+
+void free_arena(Arena *arena)
+{
+    struct ArenaChunk *chunk = arena->chunks;
+    while (chunk) {
+        struct ArenaChunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+    memset(arena, 0, sizeof *arena);
+}
+
+
 // argv[0] doesn't work as expected when Jou is ran through PATH.
 char *find_current_executable(void)
 {
@@ -73,3 +243,50 @@ char *find_current_executable(void)
     }
     return result;
 }
+
+struct ParallelJobs {
+    pthread_mutex_t lock;
+    int next, n;
+    void (*f)(void *data, int i);
+    void *data;
+};
+
+static void *parallel_worker(void *arg)
+{
+    struct ParallelJobs *jobs = arg;
+    while(1) {
+        pthread_mutex_lock(&jobs->lock);
+        int i = jobs->next < jobs->n ? jobs->next++ : -1;
+        pthread_mutex_unlock(&jobs->lock);
+        if (i == -1)
+            return NULL;
+        jobs->f(jobs->data, i);
+    }
+}
+
+void run_in_parallel(int njobs, int n, void (*f)(void *data, int i), void *data)
+{
+    njobs = min(njobs, n);
+    if (njobs <= 1) {
+        for (int i = 0; i < n; i++)
+            f(data, i);
+        return;
+    }
+
+    struct ParallelJobs jobs = { .next = 0, .n = n, .f = f, .data = data };
+    pthread_mutex_init(&jobs.lock, NULL);
+
+    pthread_t *threads = malloc(sizeof(threads[0]) * njobs);  // NOLINT
+    for (int i = 0; i < njobs; i++) {
+        int err = pthread_create(&threads[i], NULL, parallel_worker, &jobs);
+        if (err) {
+            fprintf(stderr, "error: cannot create a thread: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    for (int i = 0; i < njobs; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    pthread_mutex_destroy(&jobs.lock);
+}
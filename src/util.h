@@ -2,6 +2,7 @@
 #define UTIL_H
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -88,6 +89,68 @@ Gotchas to watch out for:
     strcpy((dest),(src)); \
 } while(0)
 
+// Like safe_strcpy(), but src is a pointer (e.g. a name from the AST) and its length is checked at runtime.
+#define checked_strcpy(dest, src) do{ \
+    static_assert(sizeof(dest) > sizeof(char*), "dest must be an array, not a pointer"); \
+    assert(strlen(src) < sizeof(dest)); \
+    strcpy((dest),(src)); \
+} while(0)
+
+/*
+HashTable maps strings to non-negative ints, which are usually indexes into a
+List. The keys are copied into the table. Example:
+
+    HashTable t = {0};
+    hashtable_set(&t, "foo", 123);
+    hashtable_get(&t, "foo");  // 123
+    hashtable_get(&t, "bar");  // -1, not found
+    hashtable_free(&t);
+
+Reading the same table from multiple threads at once is fine.
+*/
+typedef struct HashTable {
+    struct HashTableEntry { char *key; int value; } *entries;
+    int len, alloc;  // alloc is 0 or a power of two
+} HashTable;
+void hashtable_set(HashTable *t, const char *key, int value);
+int hashtable_get(const HashTable *t, const char *key);
+void hashtable_free(HashTable *t);
+
+/*
+Interned strings: intern_string() gives each different string a small
+integer id, and returns the same id every time it gets an equal string.
+get_interned_string() turns the id back into a string, which stays alive
+until the compiler exits. Example:
+
+    uint32_t id = intern_string("foo");
+    intern_string("foo") == id;  // true
+    get_interned_string(id);  // "foo"
+
+Both functions can be called from multiple threads at once.
+*/
+uint32_t intern_string(const char *s);
+const char *get_interned_string(uint32_t id);
+
+/*
+Arena is a bump allocator. Allocating from it is cheap, and everything
+allocated from an arena is freed at once with free_arena(). Example:
+
+    Arena a = {0};
+    int *nums = arena_alloc(&a, 10 * sizeof nums[0]);  // zero-filled
+    char *s = arena_strdup(&a, "hello");
+    free_arena(&a);  // frees nums and s
+
+An arena must not be used from multiple threads at once.
+*/
+typedef struct Arena {
+    struct ArenaChunk *chunks;  // newest first
+    char *ptr, *end;  // unused part of the newest chunk
+} Arena;
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_dup(Arena *arena, const void *src, size_t size);
+char *arena_strdup(Arena *arena, const char *s);
+void free_arena(Arena *arena);
+
 /*
 On windows, change backslash to forward slash.
 Delete unnecessary "." and ".." components.
@@ -99,4 +162,13 @@ void simplify_path(char *path);
 // Return a full path to the currently running executable.
 char *find_current_executable(void);
 
+/*
+Call f(data, i) for i = 0,1,...,n-1 in at most njobs threads.
+
+The order in which the calls happen is unspecified, so f() should only touch
+things that belong to index i. With njobs <= 1, everything runs in the
+calling thread, in order.
+*/
+void run_in_parallel(int njobs, int n, void (*f)(void *data, int i), void *data);
+
 #endif